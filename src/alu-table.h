@@ -0,0 +1,91 @@
+#pragma once
+
+/**
+ * @file alu-table.h
+ * @brief Table-driven ALU (-DALU_TABLES): the 8-bit operations of alu.c
+ *        as one lookup each, the result and the flags packed in one entry
+ *
+ * The tables are generated at build time by alu-tables-gen.c into
+ * alu-tables.c; unit-test-alu-table.c checks them exhaustively against
+ * alu.c. Like alu.c, the flags of an entry are or-ed into the result
+ * (alu_carry_rotate() aside, which clears them first).
+ *
+ * @date 2020
+ */
+
+#include <stdint.h>
+
+#include "alu.h"
+#include "bit.h"
+#include "error.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * An entry: the 8-bit result in its low byte, the flags in its high byte
+ */
+typedef uint16_t alu_entry_t;
+
+#define ALU_ENTRY(value, flags) ((alu_entry_t) ((value) | (flags) << 8))
+#define ALU_ENTRY_VALUE(entry)  ((uint8_t) (entry))
+#define ALU_ENTRY_FLAGS(entry)  ((flags_t) ((entry) >> 8))
+
+#define ALU_CARRY_ROTATE_KEPT 0x01  // flags kept by alu_carry_rotate()
+
+extern const alu_entry_t alu_add8_table[2][256][256];           // [c0][x][y]
+extern const alu_entry_t alu_sub8_table[2][256][256];           // [b0][x][y]
+extern const alu_entry_t alu_shift_table[2][256];               // [dir][x]
+extern const alu_entry_t alu_shiftR_A_table[256];               // [x]
+extern const alu_entry_t alu_rotate_table[2][256];              // [dir][x]
+extern const alu_entry_t alu_carry_rotate_table[2][2][256];     // [dir][C][x]
+
+static inline void alu_table_apply(alu_output_t* result, alu_entry_t entry) {
+	result->value = ALU_ENTRY_VALUE(entry);
+	result->flags |= ALU_ENTRY_FLAGS(entry);
+}
+
+static inline int alu_table_add8(alu_output_t* result, uint8_t x, uint8_t y, bit_t c0) {
+	M_REQUIRE_NON_NULL(result);
+	alu_table_apply(result, alu_add8_table[c0 & 1][x][y]);
+	return ERR_NONE;
+}
+
+static inline int alu_table_sub8(alu_output_t* result, uint8_t x, uint8_t y, bit_t b0) {
+	M_REQUIRE_NON_NULL(result);
+	alu_table_apply(result, alu_sub8_table[b0 & 1][x][y]);
+	return ERR_NONE;
+}
+
+static inline int alu_table_shift(alu_output_t* result, uint8_t x, rot_dir_t dir) {
+	M_REQUIRE_NON_NULL(result);
+	M_REQUIRE(dir == LEFT || dir == RIGHT, ERR_BAD_PARAMETER, "dir = %d", dir);
+	alu_table_apply(result, alu_shift_table[dir][x]);
+	return ERR_NONE;
+}
+
+static inline int alu_table_shiftR_A(alu_output_t* result, uint8_t x) {
+	M_REQUIRE_NON_NULL(result);
+	alu_table_apply(result, alu_shiftR_A_table[x]);
+	return ERR_NONE;
+}
+
+static inline int alu_table_rotate(alu_output_t* result, uint8_t x, rot_dir_t dir) {
+	M_REQUIRE_NON_NULL(result);
+	M_REQUIRE(dir == LEFT || dir == RIGHT, ERR_BAD_PARAMETER, "dir = %d", dir);
+	alu_table_apply(result, alu_rotate_table[dir][x]);
+	return ERR_NONE;
+}
+
+static inline int alu_table_carry_rotate(alu_output_t* result, uint8_t x, rot_dir_t dir, flags_t flags) {
+	M_REQUIRE_NON_NULL(result);
+	M_REQUIRE(dir == LEFT || dir == RIGHT, ERR_BAD_PARAMETER, "dir = %d", dir);
+	result->flags &= ALU_CARRY_ROTATE_KEPT;
+	alu_table_apply(result, alu_carry_rotate_table[dir][(flags & FLAG_C) != 0][x]);
+	return ERR_NONE;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,158 @@
+/**
+ * @file alu-tables-gen.c
+ * @brief Generates the tables of the table-driven ALU (see alu-table.h)
+ *        on stdout, from the definitions of the Game Boy operations
+ *
+ * Usage: alu-tables-gen > alu-tables.c
+ *
+ * @date 2020
+ */
+
+#include "alu.h"
+
+#include <stdio.h>
+
+#define ENTRIES_PER_LINE 8
+
+// ======================================================================
+static unsigned zero(unsigned value)
+{
+	return (value & 0xFF) == 0 ? FLAG_Z : 0;
+}
+
+static unsigned add8(unsigned x, unsigned y, unsigned c0)
+{
+	const unsigned sum = x + y + c0;
+	const unsigned flags = zero(sum)
+						   | ((x & 0xF) + (y & 0xF) + c0 > 0xF ? FLAG_H : 0)
+						   | (sum > 0xFF ? FLAG_C : 0);
+	return (sum & 0xFF) | flags << 8;
+}
+
+static unsigned sub8(unsigned x, unsigned y, unsigned b0)
+{
+	const unsigned difference = (x - y - b0) & 0xFF;
+	const unsigned flags = zero(difference) | FLAG_N
+						   | ((x & 0xF) < (y & 0xF) + b0 ? FLAG_H : 0)
+						   | (x < y + b0 ? FLAG_C : 0);
+	return difference | flags << 8;
+}
+
+static unsigned shift(unsigned x, unsigned dir)
+{
+	const unsigned value = (dir == LEFT ? x << 1 : x >> 1) & 0xFF;
+	const unsigned out = dir == LEFT ? x & 0x80 : x & 0x01;
+	return value | (zero(value) | (out ? FLAG_C : 0)) << 8;
+}
+
+static unsigned shiftR_A(unsigned x)
+{
+	const unsigned value = (x >> 1) | (x & 0x80);
+	return value | (zero(value) | (x & 0x01 ? FLAG_C : 0)) << 8;
+}
+
+static unsigned rotate(unsigned x, unsigned dir, unsigned in)
+{
+	const unsigned value = (dir == LEFT ? x << 1 | in : x >> 1 | in << 7) & 0xFF;
+	const unsigned out = dir == LEFT ? x & 0x80 : x & 0x01;
+	return value | (zero(value) | (out ? FLAG_C : 0)) << 8;
+}
+
+// ======================================================================
+/**
+ * @brief Prints one entry of a row, ENTRIES_PER_LINE per line
+ */
+static void entry(unsigned value, size_t* count)
+{
+	printf("%s0x%04X,", *count % ENTRIES_PER_LINE == 0 ? "\n\t\t" : " ", value);
+	++*count;
+}
+
+static void row_begin(size_t* count)
+{
+	printf("\n\t{");
+	*count = 0;
+}
+
+static void row_end(void)
+{
+	printf("\n\t},");
+}
+
+// ======================================================================
+int main(void)
+{
+	size_t count = 0;
+	printf("/* generated by alu-tables-gen, do not edit */\n\n#include \"alu-table.h\"\n\n");
+
+	printf("const alu_entry_t alu_add8_table[2][256][256] = {");
+	for(unsigned c0 = 0; c0 < 2; ++c0) {
+		printf("\n{");
+		for(unsigned x = 0; x < 256; ++x) {
+			row_begin(&count);
+			for(unsigned y = 0; y < 256; ++y) {
+				entry(add8(x, y, c0), &count);
+			}
+			row_end();
+		}
+		printf("\n},");
+	}
+	printf("\n};\n\n");
+
+	printf("const alu_entry_t alu_sub8_table[2][256][256] = {");
+	for(unsigned b0 = 0; b0 < 2; ++b0) {
+		printf("\n{");
+		for(unsigned x = 0; x < 256; ++x) {
+			row_begin(&count);
+			for(unsigned y = 0; y < 256; ++y) {
+				entry(sub8(x, y, b0), &count);
+			}
+			row_end();
+		}
+		printf("\n},");
+	}
+	printf("\n};\n\n");
+
+	printf("const alu_entry_t alu_shift_table[2][256] = {");
+	for(unsigned dir = LEFT; dir <= RIGHT; ++dir) {
+		row_begin(&count);
+		for(unsigned x = 0; x < 256; ++x) {
+			entry(shift(x, dir), &count);
+		}
+		row_end();
+	}
+	printf("\n};\n\n");
+
+	printf("const alu_entry_t alu_shiftR_A_table[256] = {");
+	count = 0;
+	for(unsigned x = 0; x < 256; ++x) {
+		entry(shiftR_A(x), &count);
+	}
+	printf("\n};\n\n");
+
+	printf("const alu_entry_t alu_rotate_table[2][256] = {");
+	for(unsigned dir = LEFT; dir <= RIGHT; ++dir) {
+		row_begin(&count);
+		for(unsigned x = 0; x < 256; ++x) {
+			entry(rotate(x, dir, dir == LEFT ? x >> 7 : x & 0x01), &count);
+		}
+		row_end();
+	}
+	printf("\n};\n\n");
+
+	printf("const alu_entry_t alu_carry_rotate_table[2][2][256] = {");
+	for(unsigned dir = LEFT; dir <= RIGHT; ++dir) {
+		printf("\n{");
+		for(unsigned c = 0; c < 2; ++c) {
+			row_begin(&count);
+			for(unsigned x = 0; x < 256; ++x) {
+				entry(rotate(x, dir, c), &count);
+			}
+			row_end();
+		}
+		printf("\n},");
+	}
+	printf("\n};\n");
+
+	return ferror(stdout) ? 1 : 0;
+}
@@ -5,6 +5,11 @@
 #include "error.h"
 //#include "tests.h"
 
+// -DALU_TABLES looks the 8-bit operations up in precomputed tables
+#ifdef ALU_TABLES
+	#include "alu-table.h"
+#endif
+
 #define Z 7
 #define N 6
 #define H 5
@@ -68,6 +73,9 @@ void set_flag(flags_t* flags, flag_bit_t flag){
 }
 
 int alu_add8(alu_output_t* result, uint8_t x, uint8_t y, bit_t c0){
+	#ifdef ALU_TABLES
+		return alu_table_add8(result, x, y, c0);
+	#endif
 	M_REQUIRE_NON_NULL(result);
 	
 	bit_t c[carrySize];
@@ -88,6 +96,9 @@ int alu_add8(alu_output_t* result, uint8_t x, uint8_t y, bit_t c0){
 }
 
 int alu_sub8(alu_output_t* result, uint8_t x, uint8_t y, bit_t b0){
+	#ifdef ALU_TABLES
+		return alu_table_sub8(result, x, y, b0);
+	#endif
 	M_REQUIRE_NON_NULL(result);
 	bit_t b[carrySize];
 	b[0] = b0;
@@ -151,6 +162,9 @@ int alu_add16_high(alu_output_t* result, uint16_t x, uint16_t y) { /////////////
 }
 
 int alu_shift(alu_output_t* result, uint8_t x, rot_dir_t dir) {
+	#ifdef ALU_TABLES
+		return alu_table_shift(result, x, dir);
+	#endif
 	M_REQUIRE_NON_NULL(result);
 	M_EXIT_IF(dir < LEFT || dir > RIGHT, ERR_BAD_PARAMETER, "dir = %d doit etre égal a LEFT(0) ou RIGHT(1)", dir);
 	if(dir == LEFT) {
@@ -173,6 +187,9 @@ int alu_shift(alu_output_t* result, uint8_t x, rot_dir_t dir) {
 }
 
 int alu_shiftR_A(alu_output_t* result, uint8_t x) {
+	#ifdef ALU_TABLES
+		return alu_table_shiftR_A(result, x);
+	#endif
 	M_REQUIRE_NON_NULL(result);
 	
 	if(bit_get(x, lsbBit) == 1) {
@@ -196,6 +213,9 @@ int alu_shiftR_A(alu_output_t* result, uint8_t x) {
 }
 
 int alu_rotate(alu_output_t* result, uint8_t x, rot_dir_t dir) {
+	#ifdef ALU_TABLES
+		return alu_table_rotate(result, x, dir);
+	#endif
 	M_REQUIRE_NON_NULL(result);
 	M_EXIT_IF(dir < LEFT || dir > RIGHT, ERR_BAD_PARAMETER, "dir = %d doit etre égal a LEFT(0) ou RIGHT(1)", dir);
 	
@@ -218,6 +238,9 @@ int alu_rotate(alu_output_t* result, uint8_t x, rot_dir_t dir) {
 }
 
 int alu_carry_rotate(alu_output_t* result, uint8_t x, rot_dir_t dir, flags_t flags) {
+	#ifdef ALU_TABLES
+		return alu_table_carry_rotate(result, x, dir, flags);
+	#endif
 	M_REQUIRE_NON_NULL(result);
 	M_EXIT_IF(dir < LEFT || dir > RIGHT, ERR_BAD_PARAMETER, "dir = %d doit etre égal a LEFT(0) ou RIGHT(1)", dir);
 	
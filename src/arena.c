@@ -0,0 +1,75 @@
+/**
+ * @file arena.c
+ * @brief Arena: one contiguous, cache-line-aligned block from which all the
+ *        memories of a gameboy are carved, freed at once
+ *
+ * @date 2020
+ */
+
+#include "arena.h"
+#include "error.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define INIT_VALUE 0
+#define TRUE 1
+
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+// ======================================================================
+int arena_init(arena_t* arena, size_t size, bit_t huge_pages) {
+	M_REQUIRE_NON_NULL(arena);
+	M_REQUIRE(size > 0, ERR_BAD_PARAMETER, "size %zu", size);
+
+	memset(arena, 0, sizeof(*arena));
+	#ifdef MAP_HUGETLB
+		if(huge_pages) {
+			const size_t mapped_size = (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+			void* base = mmap(NULL, mapped_size, PROT_READ | PROT_WRITE,
+							  MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+			if(base != MAP_FAILED) {
+				// anonymous mappings are zeroed
+				arena->base = base;
+				arena->size = mapped_size;
+				arena->mapped = TRUE;
+				return ERR_NONE;
+			}
+		}
+	#else
+		(void) huge_pages;
+	#endif
+
+	arena->size = ARENA_ROUND(size);
+	arena->base = aligned_alloc(ARENA_ALIGN, arena->size);
+	if(arena->base == NULL) {
+		arena->size = INIT_VALUE;
+		return ERR_MEM;
+	}
+	memset(arena->base, 0, arena->size);
+	return ERR_NONE;
+}
+
+// ======================================================================
+void* arena_alloc(arena_t* arena, size_t size) {
+	if(arena == NULL || arena->base == NULL || ARENA_ROUND(size) > arena->size - arena->used) {
+		return NULL;
+	}
+	void* block = arena->base + arena->used;
+	arena->used += ARENA_ROUND(size);
+	return block;
+}
+
+// ======================================================================
+void arena_free(arena_t* arena) {
+	if(arena == NULL || arena->base == NULL) {
+		return;
+	}
+	if(arena->mapped) {
+		munmap(arena->base, arena->size);
+	} else {
+		free(arena->base);
+	}
+	memset(arena, 0, sizeof(*arena));
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+/**
+ * @file arena.h
+ * @brief Arena: one contiguous, cache-line-aligned block from which all the
+ *        memories of a gameboy are carved, freed at once
+ *
+ * @date 2020
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bit.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ARENA_ALIGN 64      // cache line
+#define ARENA_ROUND(size) (((size) + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN)
+
+/**
+ * @brief Type to represent an arena
+ */
+typedef struct {
+	uint8_t* base;
+	size_t size;
+	size_t used;
+	bit_t mapped;   // huge pages mapped with mmap() rather than allocated
+} arena_t;
+
+/**
+ * @brief Allocates an arena of the given size, zeroed
+ *
+ * @param arena arena to initialize
+ * @param size size of the arena, in bytes
+ * @param huge_pages whether to try to back it with huge pages (falls back
+ *        to normal pages when none is available)
+ * @return error code
+ */
+int arena_init(arena_t* arena, size_t size, bit_t huge_pages);
+
+/**
+ * @brief Carves a block out of an arena
+ *
+ * @param arena arena to allocate from
+ * @param size size of the block, in bytes
+ * @return the block, zeroed and ARENA_ALIGN-aligned, NULL if the arena is
+ *         full (or NULL)
+ */
+void* arena_alloc(arena_t* arena, size_t size);
+
+/**
+ * @brief Frees an arena and every block carved out of it
+ *
+ * @param arena arena to free
+ */
+void arena_free(arena_t* arena);
+
+#ifdef __cplusplus
+}
+#endif
@@ -7,11 +7,67 @@
 #include "memory.h"
 #include "cartridge.h"
 
+/*
+ * State left by the boot ROM, the cycle REG_BOOT_ROM_DISABLE is written
+ * (the write ends 2 cycles later). It does not depend on the cartridge but
+ * for the logo (gbdiff --skip-boot checks it against a run of the boot ROM).
+ */
+#define POST_BOOT_CYCLES        2172512
+#define POST_BOOT_FRAMES        120
+#define POST_BOOT_INSTRUCTIONS  730361
+#define POST_BOOT_IDLE_TIME     2
+#define POST_BOOT_TIMER         0x997C
+#define POST_BOOT_LCDC          0x91
+#define POST_BOOT_LCD_ON_CYCLE  66887
+#define POST_BOOT_LCD_NEXT      2172581
+
+// the logo of the cartridge header, each bit doubled into the tiles 1 to 24
+#define LOGO_START      0x0104
+#define LOGO_SIZE       48
+#define LOGO_TILES      (TILE_SRC_ADDR_LOW + TILE_SIZE)
+// the (R) tile and the tile map of the logo
+#define REGISTERED_TILE (LOGO_TILES + LOGO_SIZE * 8)
+#define LOGO_MAP_LINE_1 0x9904
+#define LOGO_MAP_LINE_2 0x9924
+#define LOGO_MAP_WIDTH  12
+#define REGISTERED_MAP  0x9910
+
+static const data_t registered_tile[] = { 0x3C, 0x42, 0xB9, 0xA5, 0xB9, 0xA5, 0x42, 0x3C };
+
+// non-zero I/O registers and high RAM (the stack of the boot ROM)
+static const struct {
+	addr_t addr;
+	data_t value;
+} post_boot_memory[] = {
+	{ 0xFF00, 0xFF }, { 0xFF04, 0x99 }, { 0xFF0F, 0x01 }, { 0xFF11, 0x80 },
+	{ 0xFF12, 0xF3 }, { 0xFF13, 0xC1 }, { 0xFF14, 0x87 }, { 0xFF24, 0x77 },
+	{ 0xFF25, 0xF3 }, { 0xFF26, 0x80 }, { REG_LCDC, POST_BOOT_LCDC }, { REG_STAT, 0x01 },
+	{ REG_LY, 0x90 }, { REG_BGP, 0xFC }, { REG_BOOT_ROM_DISABLE, 0x01 },
+	{ 0xFFF8, 0x03 }, { 0xFFF9, 0x99 }, { 0xFFFA, 0xA6 }, { 0xFFFC, 0xB0 }, { 0xFFFD, 0x01 }
+};
+
+/**
+ * @brief doubles each bit of a nibble
+ */
+static data_t double_bits(data_t nibble) {
+	data_t doubled = 0;
+	for(int i = 0; i < 4; ++i) {
+		if(nibble & (1 << i)) {
+			doubled |= (data_t) (0x3 << (2 * i));
+		}
+	}
+	return doubled;
+}
+
 
 int bootrom_init(component_t* c){
+	return bootrom_init_in(c, NULL);
+}
+
+int bootrom_init_in(component_t* c, arena_t* arena){
 	M_REQUIRE_NON_NULL(c);
 
-	M_EXIT_IF_ERR(component_create(c, MEM_SIZE(BOOT_ROM)));
+	M_EXIT_IF_ERR(component_create_in(c, MEM_SIZE(BOOT_ROM), arena));
 	
 	data_t content[MEM_SIZE(BOOT_ROM)] = GAMEBOY_BOOT_ROM_CONTENT; 
 	for(int i = 0; i < MEM_SIZE(BOOT_ROM); ++i) {
@@ -33,4 +89,51 @@ int bootrom_bus_listener(gameboy_t* gameboy, addr_t addr){
 	return ERR_NONE;
 }
 
+int bootrom_skip(gameboy_t* gameboy){
+	M_REQUIRE_NON_NULL(gameboy);
+	M_REQUIRE(gameboy->boot != 0 && gameboy->cycles == 1, ERR_BAD_PARAMETER, "%s", "gameboy not at power-on");
+	
+	// each nibble of the logo gives two lines of a tile (the low bit plane only)
+	for(addr_t i = 0; i < LOGO_SIZE; ++i) {
+		const data_t byte = *gameboy->bus[LOGO_START + i];
+		const addr_t tile = (addr_t) (LOGO_TILES + 8 * i);
+		*gameboy->bus[tile] = *gameboy->bus[tile + 2] = double_bits(byte >> 4);
+		*gameboy->bus[tile + 4] = *gameboy->bus[tile + 6] = double_bits(byte & 0x0F);
+	}
+	for(addr_t i = 0; i < sizeof(registered_tile); ++i) {
+		*gameboy->bus[REGISTERED_TILE + 2 * i] = registered_tile[i];
+	}
+	for(addr_t i = 0; i < LOGO_MAP_WIDTH; ++i) {
+		*gameboy->bus[LOGO_MAP_LINE_1 + i] = (data_t) (1 + i);
+		*gameboy->bus[LOGO_MAP_LINE_2 + i] = (data_t) (1 + LOGO_MAP_WIDTH + i);
+	}
+	*gameboy->bus[REGISTERED_MAP] = 2 * LOGO_MAP_WIDTH + 1;
+	for(size_t i = 0; i < sizeof(post_boot_memory) / sizeof(post_boot_memory[0]); ++i) {
+		*gameboy->bus[post_boot_memory[i].addr] = post_boot_memory[i].value;
+	}
+	
+	cpu_t* cpu = &gameboy->cpu;
+	cpu->AF = 0x01B0;
+	cpu->BC = 0x0013;
+	cpu->DE = 0x00D8;
+	cpu->HL = 0x014D;
+	cpu->SP = 0xFFFE;
+	cpu->PC = 0x0100;
+	cpu->IF = 0x01;
+	cpu->write_listener = REG_BOOT_ROM_DISABLE;
+	cpu->idle_time = POST_BOOT_IDLE_TIME;
+	cpu->nb_instructions = POST_BOOT_INSTRUCTIONS;
+	
+	gameboy->timer.counter = POST_BOOT_TIMER;
+	gameboy->screen.on = POST_BOOT_LCDC & LCDC_REG_LCD_STATUS_MASK;
+	gameboy->screen.on_cycle = POST_BOOT_LCD_ON_CYCLE;
+	gameboy->screen.next_cycle = POST_BOOT_LCD_NEXT;
+	gameboy->screen.DMA_from = GRAPH_RAM_END + 1;
+	gameboy->screen.DMA_to = GRAPH_RAM_END + 1;
+	gameboy->cycles = POST_BOOT_CYCLES;
+	gameboy->frames = POST_BOOT_FRAMES;
+	
+	return bootrom_bus_listener(gameboy, REG_BOOT_ROM_DISABLE);
+}
+
 
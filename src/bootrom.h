@@ -64,6 +64,15 @@ extern "C" {
  */
 int bootrom_init(component_t* c);
 
+/**
+ * @brief Writes bootrom content to a component carved out of an arena
+ *
+ * @param c component to write the bootrom content to
+ * @param arena arena to allocate from, NULL to allocate on the heap
+ * @return error code
+ */
+int bootrom_init_in(component_t* c, arena_t* arena);
+
 
 /**
  * @brief Macro to plug bootrom onto the bus
@@ -80,6 +89,18 @@ int bootrom_init(component_t* c);
  */
 int bootrom_bus_listener(gameboy_t* gameboy, addr_t addr);
 
+/**
+ * @brief Puts a gameboy in its power-on state in the state the boot ROM
+ *        leaves it in, without running it: the CPU at 0x0100, the logo of
+ *        the cartridge in video RAM, the I/O registers and the stack as
+ *        written by the boot ROM, and the boot ROM unmapped (the pixels
+ *        shown are not drawn)
+ *
+ * @param gameboy gameboy
+ * @return error code
+ */
+int bootrom_skip(gameboy_t* gameboy);
+
 #ifdef __cplusplus
 }
 #endif
@@ -103,7 +103,7 @@ int bus_read16(const bus_t bus, addr_t address, addr_t* data16) {
 	M_REQUIRE_NON_NULL(data16);
 	M_REQUIRE_NON_NULL(bus);
 	
-	if(bus[address] == NULL || bus[address + next] == NULL || address == MEMORY_MAP_END) {
+	if(address == MEMORY_MAP_END || bus[address] == NULL || bus[address + next] == NULL) {
 		*data16 = DEFAULT_VALUE;
 		return ERR_NONE;
 	} else {
@@ -127,6 +127,11 @@ int bus_write(bus_t bus, addr_t address, data_t data) {
 int bus_write16(bus_t bus, addr_t address, addr_t data16) {
 	M_REQUIRE_NON_NULL(bus);
 	M_REQUIRE_NON_NULL(bus[address]);
+	if(address == MEMORY_MAP_END) {
+		// (the high byte is past the end of the bus)
+		*bus[address] = lsb8(data16);
+		return ERR_NONE;
+	}
 	M_REQUIRE_NON_NULL(bus[address + next]);
 	
 	*bus[address] = lsb8(data16);
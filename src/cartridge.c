@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "cartridge.h"
 #include "component.h"
@@ -29,10 +30,30 @@ int cartridge_init_from_file(component_t* c, const char* filename){
 	return ERR_NONE;
 }
 
+int cartridge_init_from_buffer(component_t* c, const data_t* rom, size_t size){
+	M_REQUIRE_NON_NULL(c);
+	M_REQUIRE_NON_NULL(c->mem);
+	M_REQUIRE(c->mem->size >= BANK_ROM_SIZE, ERR_BAD_PARAMETER, "%s", "not the memory of a cartridge");
+	M_REQUIRE(rom != NULL || size == 0, ERR_BAD_PARAMETER, "%s", "no ROM image");
+	
+	const size_t copied = size < BANK_ROM_SIZE ? size : BANK_ROM_SIZE;
+	memcpy(c->mem->memory, rom, copied);
+	memset(c->mem->memory + copied, 0, BANK_ROM_SIZE - copied);
+	
+	if(c->mem->memory[CARTRIDGE_TYPE_ADDR] != 0){
+		return ERR_NOT_IMPLEMENTED;
+	}
+	return ERR_NONE;
+}
+
 int cartridge_init(cartridge_t* ct, const char* filename){
+	return cartridge_init_in(ct, filename, NULL);
+}
+
+int cartridge_init_in(cartridge_t* ct, const char* filename, arena_t* arena){
 	M_REQUIRE_NON_NULL(ct);	
 	M_REQUIRE_NON_NULL(filename);
-	M_EXIT_IF_ERR(component_create(&ct->c, BANK_ROM_SIZE)); ///////////////////////////////////////////
+	M_EXIT_IF_ERR(component_create_in(&ct->c, BANK_ROM_SIZE, arena)); ///////////////////////////////////////////
 	
 	return cartridge_init_from_file(&ct->c, filename);
 }
@@ -8,6 +8,7 @@
  * @date 2019
  */
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include "component.h"
@@ -47,6 +48,17 @@ typedef struct {
  */
 int cartridge_init_from_file(component_t* c, const char* filename);
 
+/**
+ * @brief Copies a ROM image into the memory of a component, the bytes
+ *        beyond it being zeroed (and those beyond BANK_ROM_SIZE ignored)
+ *
+ * @param c component to write to
+ * @param rom ROM image to copy
+ * @param size size of the ROM image, in bytes
+ * @return error code
+ */
+int cartridge_init_from_buffer(component_t* c, const data_t* rom, size_t size);
+
 
 /**
  * @brief Initiates a cartridge given a filename
@@ -57,6 +69,17 @@ int cartridge_init_from_file(component_t* c, const char* filename);
  */
 int cartridge_init(cartridge_t* ct, const char* filename);
 
+/**
+ * @brief Initiates a cartridge given a filename, its memory carved out of
+ *        an arena
+ *
+ * @param ct cartridge to initiate
+ * @param filename file to read from
+ * @param arena arena to allocate from, NULL to allocate on the heap
+ * @return error code
+ */
+int cartridge_init_in(cartridge_t* ct, const char* filename, arena_t* arena);
+
 
 /**
  * @brief Plugs a cartridge to the bus
@@ -8,19 +8,25 @@
 #define INIT_VALUE 0
 
 int component_create(component_t* c, size_t mem_size) {
+	return component_create_in(c, mem_size, NULL);
+}
+
+int component_create_in(component_t* c, size_t mem_size, arena_t* arena) {
 	M_REQUIRE_NON_NULL(c);
 	c->start = INIT_VALUE;
 	c->end = INIT_VALUE;	
 	if(mem_size > 0) { 
-		c->mem = calloc(1, sizeof(memory_t));
-		if(c->mem != NULL) {
-			int check = mem_create(c->mem, mem_size);
-			if(check != ERR_NONE) {
-				mem_free(c->mem);
+		c->mem = arena != NULL ? arena_alloc(arena, sizeof(memory_t)) : calloc(1, sizeof(memory_t));
+		if(c->mem == NULL) {
+			return ERR_MEM;
+		}
+		int check = mem_create_in(c->mem, mem_size, arena);
+		if(check != ERR_NONE) {
+			if(arena == NULL) {
 				free(c->mem);
-				c->mem = NULL;
-				M_EXIT_ERR(check, "%s", "impossible de creer le composant");
 			}
+			c->mem = NULL;
+			M_EXIT_ERR(check, "%s", "impossible de creer le composant");
 		}
 	} else {
 		c->mem = NULL;
@@ -31,8 +37,11 @@ int component_create(component_t* c, size_t mem_size) {
 void component_free(component_t* c) {
 	if(c != NULL) {
 		if(c->mem != NULL) {
+			const bool in_arena = c->mem->in_arena;
 			mem_free(c->mem);
-			free(c->mem);
+			if(!in_arena) {
+				free(c->mem);
+			}
 			c->mem = NULL;
 		}
 		c->start = INIT_VALUE;
@@ -38,6 +38,16 @@ typedef struct {
  */
 int component_create(component_t* c, size_t mem_size);
 
+/**
+ * @brief Creates a component whose memory is carved out of an arena
+ *
+ * @param c component pointer to initialize
+ * @param mem_size size of the memory of the component
+ * @param arena arena to allocate from, NULL to allocate on the heap
+ * @return error code
+ */
+int component_create_in(component_t* c, size_t mem_size, arena_t* arena);
+
 /**
  * @brief Shares memory between two components
  *
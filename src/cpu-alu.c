@@ -12,6 +12,15 @@
 #include "cpu-storage.h" // cpu_read_at_HL
 #include "cpu-registers.h" // cpu_HL_get
 
+// -DALU_TABLES: the instructions below look their results up inline
+#ifdef ALU_TABLES
+	#include "alu-table.h"
+	#define alu_add8 alu_table_add8
+	#define alu_sub8 alu_table_sub8
+	#define alu_shift alu_table_shift
+	#define alu_carry_rotate alu_table_carry_rotate
+#endif
+
 // external library provided later to lower workload
 extern int cpu_dispatch_alu_ext(const instruction_t* lu, cpu_t* cpu);
 
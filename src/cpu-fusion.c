@@ -0,0 +1,283 @@
+/**
+ * @file cpu-fusion.c
+ * @brief Game Boy CPU simulation, superinstructions
+ *
+ * @date 2020
+ */
+
+#include "error.h"
+#include "bit.h"
+#include "alu.h"
+#include "cpu-fusion.h"
+#include "cpu-alu.h" // cpu_combine_alu_flags
+#include "cpu-storage.h" // cpu_read_data_after_opcode
+#include "cpu-registers.h" // cpu_reg_get
+#include "gameboy.h" // REGISTERS_START
+#include "util.h" // FROM_GameBoy_16
+
+#define INIT_VALUE 0
+#define TRUE 1
+#define FALSE 0
+#define DECREMENT 1
+#define CARRY_ZERO 0
+#define SHIFT_ZERO 0
+
+const char* const cpu_fusion_names[CPU_NB_FUSIONS] = {
+	"none",
+	"ld_a_hlru_ld_der_a",
+	"dec_r8_jr_cc",
+	"ldh_a_cp_n8_jr_cc",
+	"xor_a_ld_hlru_a",
+	"xor_a_ld_hlr_a",
+	"xor_a_ld_n16r_a",
+	"xor_a_ld_n8r_a"
+};
+
+const uint8_t cpu_fusion_lengths[CPU_NB_FUSIONS] = { 1, 2, 2, 3, 2, 2, 2, 2 };
+
+// ---------------------------------------------------------------------
+/**
+ * @brief Reads a byte of code without it being seen as a CPU access
+ */
+static data_t cpu_fusion_peek(const cpu_t* cpu, addr_t addr)
+{
+	data_t value = INIT_VALUE;
+	bus_read(*cpu->bus, addr, &value);
+	return value;
+}
+
+// ---------------------------------------------------------------------
+/**
+ * @brief Tells whether the CPU alone accesses the given range while the
+ *        other components are idle: neither the I/O registers nor IE
+ */
+static bit_t cpu_fusion_private(addr_t start, addr_t end)
+{
+	return start <= end
+		&& (end < REGISTERS_START || (start >= HIGH_RAM_START && end <= HIGH_RAM_END));
+}
+
+// ---------------------------------------------------------------------
+/**
+ * @brief Tells whether the instructions of a superinstruction, at the
+ *        given addresses, can be run ahead: their code is private, the
+ *        idle loop detector does not expect their fetch and the fusion
+ *        window lasts until the last one is fetched
+ */
+static bit_t cpu_fusion_fits(const cpu_t* cpu, const addr_t* pc,
+							 const instruction_t* const* lu, int nb_instructions)
+{
+	const int last = nb_instructions - 1;
+	if(!cpu_fusion_private(pc[0], (addr_t) (pc[last] + lu[last]->bytes - 1))) {
+		return FALSE;
+	}
+	unsigned cycles = INIT_VALUE;
+	for(int i = 0; i < last; ++i) {
+		cycles += lu[i]->cycles;
+		if(pc[i + 1] == cpu->idle_loop.head) {
+			return FALSE;
+		}
+	}
+	return cycles < cpu->fusion_window;
+}
+
+// ======================================================================
+cpu_fusion_t cpu_fusion_find(const instruction_t* lu, cpu_t* cpu)
+{
+	if(lu->kind != DIRECT) {
+		return FUSION_NONE;
+	}
+	addr_t pc[CPU_FUSION_MAX_INSTRUCTIONS] = { cpu->PC };
+	const instruction_t* next[CPU_FUSION_MAX_INSTRUCTIONS] = { lu };
+	cpu_fusion_t fusion = FUSION_NONE;
+	int nb_instructions = 2;
+
+	pc[1] = (addr_t) (pc[0] + lu->bytes);
+	next[1] = &instruction_direct[cpu_fusion_peek(cpu, pc[1])];
+	switch(lu->family) {
+	case LD_A_HLRU:
+		if(next[1]->family == LD_DER_A && cpu_fusion_private(cpu->DE, cpu->DE)) {
+			fusion = FUSION_LD_A_HLRU_LD_DER_A;
+		}
+		break;
+
+	case DEC_R8:
+		if(next[1]->family == JR_CC_E8) {
+			fusion = FUSION_DEC_R8_JR_CC;
+		}
+		break;
+
+	case LD_A_N8R:
+		pc[2] = (addr_t) (pc[1] + next[1]->bytes);
+		next[2] = &instruction_direct[cpu_fusion_peek(cpu, pc[2])];
+		if(next[1]->family == CP_A_N8 && next[2]->family == JR_CC_E8) {
+			fusion = FUSION_LDH_A_CP_N8_JR_CC;
+			nb_instructions = 3;
+		}
+		break;
+
+	case XOR_A_R8:
+		if(extract_reg(lu->opcode, SHIFT_ZERO) != REG_A_CODE) {
+			break;
+		}
+		switch(next[1]->family) {
+		case LD_HLRU_A:
+			fusion = cpu_fusion_private(cpu->HL, cpu->HL) ? FUSION_XOR_A_LD_HLRU_A : FUSION_NONE;
+			break;
+		case LD_HLR_R8:
+			fusion = extract_reg(next[1]->opcode, SHIFT_ZERO) == REG_A_CODE
+					 && cpu_fusion_private(cpu->HL, cpu->HL) ? FUSION_XOR_A_LD_HLR_A : FUSION_NONE;
+			break;
+		case LD_N16R_A: {
+			const addr_t nn = (addr_t) (cpu_fusion_peek(cpu, (addr_t) (pc[1] + 1))
+										| cpu_fusion_peek(cpu, (addr_t) (pc[1] + 2)) << 8);
+			fusion = cpu_fusion_private(nn, nn) ? FUSION_XOR_A_LD_N16R_A : FUSION_NONE;
+		} break;
+		case LD_N8R_A: {
+			const addr_t addr = REGISTERS_START + cpu_fusion_peek(cpu, (addr_t) (pc[1] + 1));
+			fusion = cpu_fusion_private(addr, addr) ? FUSION_XOR_A_LD_N8R_A : FUSION_NONE;
+		} break;
+		default:
+			break;
+		}
+		break;
+
+	default:
+		break;
+	}
+
+	return fusion != FUSION_NONE && cpu_fusion_fits(cpu, pc, next, nb_instructions)
+		   ? fusion : FUSION_NONE;
+}
+
+// ---------------------------------------------------------------------
+/**
+ * @brief Accounts for one instruction of a superinstruction, moves PC
+ *        to the next one and gives it
+ */
+static const instruction_t* cpu_fusion_next(cpu_t* cpu, const instruction_t* lu, uint8_t cycles,
+											unsigned* total)
+{
+	#ifdef PROFILER
+		profiler_instruction(cpu->profiler, cpu->PC, lu->family, cycles);
+	#endif
+	*total += cycles;
+	cpu->PC += lu->bytes;
+	++cpu->nb_instructions;
+	++cpu->idle_loop.nb_instructions;
+	if(cpu->coverage != NULL) {
+		cpu_coverage_fetch(cpu, cpu->PC);
+	}
+	return &instruction_direct[cpu_read_at_idx(cpu, cpu->PC)];
+}
+
+// ---------------------------------------------------------------------
+/**
+ * @brief Runs JR cc,e, the last instruction of a superinstruction
+ */
+static void cpu_fusion_jr_cc(cpu_t* cpu, const instruction_t* lu, unsigned* total)
+{
+	const signed char e = (signed char) cpu_read_data_after_opcode(cpu);
+	const bit_t taken = jumpConditionnal(cpu, extract_cc(lu->opcode));
+	const uint8_t cycles = (uint8_t) (lu->cycles + (taken ? lu->xtra_cycles : 0));
+	#ifdef PROFILER
+		profiler_instruction(cpu->profiler, cpu->PC, lu->family, cycles);
+	#endif
+	*total += cycles;
+	cpu->PC += lu->bytes + (taken ? e : 0);
+}
+
+// ---------------------------------------------------------------------
+/**
+ * @brief Runs a store of A, the last instruction of a superinstruction
+ */
+static int cpu_fusion_store(cpu_t* cpu, const instruction_t* lu, addr_t addr, unsigned* total)
+{
+	M_EXIT_IF_ERR(cpu_write_at_idx(cpu, addr, cpu_A_get(cpu)));
+	#ifdef PROFILER
+		profiler_instruction(cpu->profiler, cpu->PC, lu->family, lu->cycles);
+	#endif
+	*total += lu->cycles;
+	cpu->PC += lu->bytes;
+	return ERR_NONE;
+}
+
+// ======================================================================
+int cpu_dispatch_fused(cpu_fusion_t fusion, const instruction_t* lu, cpu_t* cpu, addr_t* last)
+{
+	M_REQUIRE_NON_NULL(lu);
+	M_REQUIRE_NON_NULL(cpu);
+	M_REQUIRE_NON_NULL(last);
+
+	unsigned total = INIT_VALUE;
+	unsigned ahead = INIT_VALUE;	// cycles before the fetch of the last instruction
+	cpu->alu.value = INIT_VALUE;
+	cpu->alu.flags = INIT_VALUE;
+
+	switch(fusion) {
+	case FUSION_LD_A_HLRU_LD_DER_A:
+		cpu_A_set(cpu, cpu_read_at_HL(cpu));
+		cpu_HL_set(cpu, cpu_HL_get(cpu) + extract_HL_increment(lu->opcode));
+		lu = cpu_fusion_next(cpu, lu, lu->cycles, &total);
+		*last = cpu->PC;
+		ahead = total;
+		M_EXIT_IF_ERR(cpu_fusion_store(cpu, lu, cpu_DE_get(cpu), &total));
+		break;
+
+	case FUSION_DEC_R8_JR_CC: {
+		const uint8_t r = extract_n3(lu->opcode);
+		alu_sub8(&cpu->alu, cpu_reg_get(cpu, r), DECREMENT, CARRY_ZERO);
+		cpu_reg_set(cpu, r, cpu->alu.value);
+		M_EXIT_IF_ERR(cpu_combine_alu_flags(cpu, DEC_FLAGS_SRC));
+		lu = cpu_fusion_next(cpu, lu, lu->cycles, &total);
+		*last = cpu->PC;
+		ahead = total;
+		cpu_fusion_jr_cc(cpu, lu, &total);
+	} break;
+
+	case FUSION_LDH_A_CP_N8_JR_CC:
+		cpu_A_set(cpu, cpu_read_at_idx(cpu, REGISTERS_START + cpu_read_data_after_opcode(cpu)));
+		lu = cpu_fusion_next(cpu, lu, lu->cycles, &total);
+		alu_sub8(&cpu->alu, cpu_A_get(cpu), cpu_read_data_after_opcode(cpu), CARRY_ZERO);
+		M_EXIT_IF_ERR(cpu_combine_alu_flags(cpu, SUB_FLAGS_SRC));
+		lu = cpu_fusion_next(cpu, lu, lu->cycles, &total);
+		*last = cpu->PC;
+		ahead = total;
+		cpu_fusion_jr_cc(cpu, lu, &total);
+		break;
+
+	case FUSION_XOR_A_LD_HLRU_A:
+	case FUSION_XOR_A_LD_HLR_A:
+	case FUSION_XOR_A_LD_N16R_A:
+	case FUSION_XOR_A_LD_N8R_A: {
+		cpu_A_set(cpu, INIT_VALUE);
+		cpu->F = FLAG_Z;
+		lu = cpu_fusion_next(cpu, lu, lu->cycles, &total);
+		*last = cpu->PC;
+		ahead = total;
+		addr_t addr = cpu_HL_get(cpu);
+		if(fusion == FUSION_XOR_A_LD_N16R_A) {
+			addr = cpu_read_addr_after_opcode(cpu);
+		} else if(fusion == FUSION_XOR_A_LD_N8R_A) {
+			addr = REGISTERS_START + cpu_read_data_after_opcode(cpu);
+		}
+		M_EXIT_IF_ERR(cpu_fusion_store(cpu, lu, addr, &total));
+		if(fusion == FUSION_XOR_A_LD_HLRU_A) {
+			cpu_HL_set(cpu, cpu_HL_get(cpu) + extract_HL_increment(lu->opcode));
+		}
+	} break;
+
+	default:
+		return ERR_BAD_PARAMETER;
+	}
+
+	// as left by the dispatch of the last instruction, which is no ALU one
+	cpu->alu.value = INIT_VALUE;
+	cpu->alu.flags = INIT_VALUE;
+	cpu->idle_time = (uint8_t) (total - 1);
+	cpu->fused_time = (uint8_t) ahead;
+	if(cpu->fusion_counts != NULL) {
+		++cpu->fusion_counts[fusion];
+	}
+	return ERR_NONE;
+}
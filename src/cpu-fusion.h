@@ -0,0 +1,78 @@
+#pragma once
+
+/**
+ * @file cpu-fusion.h
+ * @brief Superinstructions: hot sequences of instructions recognized when
+ *        their first one is fetched and run by one handler
+ *
+ * The instructions after the first one are run ahead of their own fetch.
+ * The CPU only fuses them when nothing but itself can act until the last
+ * one would have been fetched (see cpu_t.fusion_window, set by
+ * gameboy_run() from the next timer and LCD events), and when they only
+ * touch its registers, the code and memory below the I/O registers or in
+ * the high RAM: no interrupt, no component and no caller can tell the
+ * difference. cpu_t.fused_time counts the cycles until that last fetch.
+ *
+ * @date 2020
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "opcode.h"
+#include "cpu.h"
+
+#define CPU_FUSION_MAX_INSTRUCTIONS 3
+
+/**
+ * @brief Superinstructions
+ */
+typedef enum {
+	FUSION_NONE,
+	FUSION_LD_A_HLRU_LD_DER_A,  // LD A,(HL+/-) ; LD (DE),A
+	FUSION_DEC_R8_JR_CC,        // DEC r ; JR cc,e
+	FUSION_LDH_A_CP_N8_JR_CC,   // LDH A,(n) ; CP n ; JR cc,e
+	FUSION_XOR_A_LD_HLRU_A,     // XOR A ; LD (HL+/-),A
+	FUSION_XOR_A_LD_HLR_A,      // XOR A ; LD (HL),A
+	FUSION_XOR_A_LD_N16R_A,     // XOR A ; LD (nn),A
+	FUSION_XOR_A_LD_N8R_A,      // XOR A ; LDH (n),A
+	CPU_NB_FUSIONS
+} cpu_fusion_t;
+
+/**
+ * @brief Names of the superinstructions, for reports
+ */
+extern const char* const cpu_fusion_names[CPU_NB_FUSIONS];
+
+/**
+ * @brief Number of instructions of each superinstruction
+ */
+extern const uint8_t cpu_fusion_lengths[CPU_NB_FUSIONS];
+
+/**
+ * @brief Recognizes the superinstruction starting with the instruction
+ *        fetched, if it can be run within the fusion window of the CPU
+ *
+ * @param lu instruction fetched, at PC
+ * @param cpu CPU fetching
+ * @return the superinstruction, FUSION_NONE to dispatch lu alone
+ */
+cpu_fusion_t cpu_fusion_find(const instruction_t* lu, cpu_t* cpu);
+
+/**
+ * @brief Runs a superinstruction found by cpu_fusion_find(): its
+ *        instructions are counted and profiled one by one, and idle_time
+ *        is the one of the last one plus the cycles of the others
+ *
+ * @param fusion superinstruction to run
+ * @param lu its first instruction, fetched at PC
+ * @param cpu CPU running it
+ * @param last (output) address of its last instruction
+ * @return error code
+ */
+int cpu_dispatch_fused(cpu_fusion_t fusion, const instruction_t* lu, cpu_t* cpu, addr_t* last);
+
+#ifdef __cplusplus
+}
+#endif
@@ -10,31 +10,86 @@
 #include "cpu-registers.h" // cpu_BC_get
 #include "gameboy.h" // REGISTER_START
 #include "util.h"
+#include "watch.h"
+#include "state-hash.h"
 #include <inttypes.h> // PRIX8
 #include <stdio.h> // fprintf
 
 #define SP_CHANGE 2
+#define TRUE 1
+#define FALSE 0
 #define SHIFT_ZERO 0
 
+// ---------------------------------------------------------------------
+/**
+ * @brief Slow path of the accesses to watched pages (an idle loop accessing
+ *        them must not be skipped)
+ */
+static void cpu_watch(cpu_t* cpu, watch_kind_t kind, addr_t addr, data_t value)
+{
+	cpu_idle_loop_break(cpu);
+	watch_hit(cpu->watch, cpu, kind, addr, value);
+}
+
+// ---------------------------------------------------------------------
+/**
+ * @brief Queues a write to an I/O register, its handler is run after the
+ *        cycle (see cpu_io_dispatch())
+ */
+static int cpu_io_written(cpu_t* cpu, addr_t addr)
+{
+	if(cpu->io == NULL || addr < IO_START) {
+		return ERR_NONE;
+	}
+	if(cpu->nb_io_writes == CPU_IO_WRITES) {
+		// (no instruction writes that many bytes)
+		return io_write(cpu->io, addr);
+	}
+	cpu->io_writes[cpu->nb_io_writes++] = addr;
+	return ERR_NONE;
+}
+
 // ==== see cpu-storage.h ========================================
-data_t cpu_read_at_idx(const cpu_t* cpu, addr_t addr)
+data_t cpu_read_at_idx(cpu_t* cpu, addr_t addr)
 {
     M_REQUIRE_NON_NULL(cpu);
     M_REQUIRE_NON_NULL(cpu->bus);
     
+	cpu_idle_loop_access(cpu, addr, FALSE);
+	io_read(cpu->io, addr);
+	const sig_atomic_t phase = gb_phase;
+	gb_phase = GB_PHASE_BUS;
 	data_t value = 0;
 	bus_read(*(cpu->bus), addr, &value);
+	gb_phase = phase;
+	if(watch_flagged(cpu->watch, addr, WATCH_READ)) {
+		cpu_watch(cpu, WATCH_READ, addr, value);
+	}
 	return value;
 }
 
 // ==== see cpu-storage.h ========================================
-addr_t cpu_read16_at_idx(const cpu_t* cpu, addr_t addr)
+addr_t cpu_read16_at_idx(cpu_t* cpu, addr_t addr)
 {
     M_REQUIRE_NON_NULL(cpu);
     M_REQUIRE_NON_NULL(cpu->bus);
     
+	cpu_idle_loop_access(cpu, addr, FALSE);
+	cpu_idle_loop_access(cpu, addr + 1, FALSE);
+	io_read(cpu->io, addr);
+	io_read(cpu->io, addr + 1);
+	const sig_atomic_t phase = gb_phase;
+	gb_phase = GB_PHASE_BUS;
 	addr_t value = 0;
 	bus_read16(*(cpu->bus), addr, &value);
+	gb_phase = phase;
+	const addr_t next = addr + 1;
+	if(watch_flagged(cpu->watch, addr, WATCH_READ)) {
+		cpu_watch(cpu, WATCH_READ, addr, lsb8(value));
+	}
+	if(watch_flagged(cpu->watch, next, WATCH_READ)) {
+		cpu_watch(cpu, WATCH_READ, next, msb8(value));
+	}
 	return value;
 }
 
@@ -44,8 +99,23 @@ int cpu_write_at_idx(cpu_t* cpu, addr_t addr, data_t data)
 	M_REQUIRE_NON_NULL(cpu);
 	M_REQUIRE_NON_NULL(cpu->bus);
 	 
+	cpu_idle_loop_access(cpu, addr, TRUE);
 	cpu->write_listener = addr;
-	return bus_write(*(cpu->bus), addr, data);
+	const sig_atomic_t phase = gb_phase;
+	gb_phase = GB_PHASE_BUS;
+	const int err = bus_write(*(cpu->bus), addr, data);
+	gb_phase = phase;
+	M_EXIT_IF_ERR(err);
+	if(cpu->trace != NULL) {
+		trace_write(cpu->trace, addr, data, FALSE);
+	}
+	if(cpu->dirty != NULL) {
+		cpu->dirty[addr >> STATE_HASH_PAGE_SHIFT] = TRUE;
+	}
+	if(watch_flagged(cpu->watch, addr, WATCH_WRITE)) {
+		cpu_watch(cpu, WATCH_WRITE, addr, data);
+	}
+	return cpu_io_written(cpu, addr);
 }
 
 // ==== see cpu-storage.h ========================================
@@ -54,8 +124,29 @@ int cpu_write16_at_idx(cpu_t* cpu, addr_t addr, addr_t data16)
 	M_REQUIRE_NON_NULL(cpu);
 	M_REQUIRE_NON_NULL(cpu->bus);
 	 
+	cpu_idle_loop_access(cpu, addr, TRUE);
 	cpu->write_listener = addr;
-	return bus_write16(*(cpu->bus), addr, data16);
+	const sig_atomic_t phase = gb_phase;
+	gb_phase = GB_PHASE_BUS;
+	const int err = bus_write16(*(cpu->bus), addr, data16);
+	gb_phase = phase;
+	M_EXIT_IF_ERR(err);
+	if(cpu->trace != NULL) {
+		trace_write(cpu->trace, addr, data16, TRUE);
+	}
+	const addr_t next = addr + 1;
+	if(cpu->dirty != NULL) {
+		cpu->dirty[addr >> STATE_HASH_PAGE_SHIFT] = TRUE;
+		cpu->dirty[next >> STATE_HASH_PAGE_SHIFT] = TRUE;
+	}
+	if(watch_flagged(cpu->watch, addr, WATCH_WRITE)) {
+		cpu_watch(cpu, WATCH_WRITE, addr, lsb8(data16));
+	}
+	if(watch_flagged(cpu->watch, next, WATCH_WRITE)) {
+		cpu_watch(cpu, WATCH_WRITE, next, msb8(data16));
+	}
+	M_EXIT_IF_ERR(cpu_io_written(cpu, addr));
+	return cpu_io_written(cpu, next);
 }
 
 // ==== see cpu-storage.h ========================================
@@ -24,7 +24,7 @@ extern "C" {
  *
  * @return data read
  */
-data_t cpu_read_at_idx(const cpu_t* cpu, addr_t addr);
+data_t cpu_read_at_idx(cpu_t* cpu, addr_t addr);
 
 /**
  * @brief Reads data at HL address from bus
@@ -46,7 +46,7 @@ data_t cpu_read_at_idx(const cpu_t* cpu, addr_t addr);
  *
  * @return data16 read
  */
-addr_t cpu_read16_at_idx(const cpu_t* cpu, addr_t addr);
+addr_t cpu_read16_at_idx(cpu_t* cpu, addr_t addr);
 
 /**
  * @brief Reads 16bit data after opcode from bus
@@ -11,8 +11,10 @@
 #include "cpu-alu.h"
 #include "cpu-registers.h"
 #include "cpu-storage.h"
+#include "cpu-fusion.h"
 #include "util.h"
 #include "gameboy.h"
+#include "watch.h"
 
 #include <inttypes.h> // PRIX8
 #include <stdio.h> // fprintf
@@ -30,9 +32,13 @@
 #define MASK 1
 #define RIGHT_SHIFT 1
 #define NO_INTERRUPTION -1
+#define INTERRUPTS_MASK ((1 << INTERRUPT_COUNT) - 1)
 #define INTERRUPT_ADDR 0x40
 #define INTERRUPT_IDLE_TIME 5
 
+#define IDLE_LOOP_MAX_BYTES 32
+#define IDLE_LOOP_MAX_CYCLES 256
+
 #define NOT_ZERO 0
 #define ZERO 1
 #define NOT_CARRY 2
@@ -41,11 +47,16 @@
 
 // ======================================================================
 int cpu_init(cpu_t* cpu) {
+	return cpu_init_in(cpu, NULL);
+}
+
+// ======================================================================
+int cpu_init_in(cpu_t* cpu, arena_t* arena) {
 	M_REQUIRE_NON_NULL(cpu);
 	cpu->idle_time = INIT_VALUE;
 	cpu->alu.value = INIT_VALUE;
 	cpu->alu.flags = INIT_VALUE;
-	M_EXIT_IF_ERR(component_create(&cpu->high_ram, HIGH_RAM_SIZE)); 
+	M_EXIT_IF_ERR(component_create_in(&cpu->high_ram, HIGH_RAM_SIZE, arena)); 
 	cpu->AF = INIT_VALUE;
 	cpu->BC = INIT_VALUE;
 	cpu->DE = INIT_VALUE;
@@ -59,6 +70,28 @@ int cpu_init(cpu_t* cpu) {
 	cpu->HALT = FALSE;
 
 	cpu->write_listener = INIT_VALUE;
+	cpu->io = NULL;
+	cpu->nb_io_writes = INIT_VALUE;
+	cpu->nb_instructions = INIT_VALUE;
+	cpu->trace = NULL;
+	cpu->watch = NULL;
+	cpu->dirty = NULL;
+	cpu->fusion_window = INIT_VALUE;
+	cpu->fused_time = INIT_VALUE;
+	cpu->fusion_counts = NULL;
+	cpu->coverage = NULL;
+	cpu->coverage_prev = INIT_VALUE;
+	#ifdef PROFILER
+		cpu->profiler = NULL;
+	#endif
+
+	cpu->idle_loop.head = INIT_VALUE;
+	cpu->idle_loop.armed = FALSE;
+	cpu->idle_loop.tracking = FALSE;
+	cpu->idle_loop.length = INIT_VALUE;
+	cpu->idle_loop.nb_instructions = INIT_VALUE;
+	cpu->idle_loop.nb_reads = INIT_VALUE;
+	cpu_idle_loop_break(cpu);
 
     return ERR_NONE;
 }
@@ -125,7 +158,7 @@ int jumpConditionnal(const cpu_t* cpu,uint8_t cc) {
 int extractIrqBit(const uint8_t interruption) {
 	uint8_t i = interruption;
 	int index = 0;
-	while(i <= INTERRUPT_COUNT) {
+	while(index < INTERRUPT_COUNT) {
 		if(i & MASK) {
 			return index;
 		}
@@ -335,6 +368,7 @@ static int cpu_dispatch(const instruction_t* lu, cpu_t* cpu)
 
     case HALT:
 		cpu->HALT = TRUE;
+		cpu_idle_loop_break(cpu);
         break;
 
     case STOP:
@@ -354,37 +388,178 @@ static int cpu_dispatch(const instruction_t* lu, cpu_t* cpu)
     return ERR_NONE;
 }
 
+//=========================================================================
+/**
+ * @brief Reads a byte on the bus without it being seen as a CPU access
+ */
+static data_t cpu_idle_loop_peek(const cpu_t* cpu, addr_t addr)
+{
+	data_t value = INIT_VALUE;
+	bus_read(*cpu->bus, addr, &value);
+	return value;
+}
+
+//=========================================================================
+/**
+ * @brief Checks, when the head of the idle loop is fetched, whether the
+ *        last iteration brought the CPU back to the very same state
+ * @param cpu, the CPU which is fetching
+ */
+static void cpu_idle_loop_fetch(cpu_t* cpu)
+{
+	idle_loop_t* loop = &cpu->idle_loop;
+	if(cpu->PC != loop->head) {
+		return;
+	}
+	
+	loop->period = INIT_VALUE;
+	if(loop->armed && loop->clean && loop->length <= IDLE_LOOP_MAX_CYCLES
+		&& loop->AF == cpu->AF && loop->BC == cpu->BC && loop->DE == cpu->DE
+		&& loop->HL == cpu->HL && loop->SP == cpu->SP && loop->IME == cpu->IME
+		&& loop->IE == cpu->IE && cpu_idle_loop_holds(cpu)) {
+		// the next iterations will read the very same bytes
+		loop->period = loop->length;
+		loop->period_instructions = loop->nb_instructions;
+	} else {
+		loop->nb_reads = INIT_VALUE;
+	}
+	
+	loop->AF = cpu->AF;
+	loop->BC = cpu->BC;
+	loop->DE = cpu->DE;
+	loop->HL = cpu->HL;
+	loop->SP = cpu->SP;
+	loop->IME = cpu->IME;
+	loop->IE = cpu->IE;
+	loop->IF = cpu->IF;
+	loop->armed = TRUE;
+	loop->clean = TRUE;
+	loop->length = INIT_VALUE;
+	loop->nb_instructions = INIT_VALUE;
+}
+
+//=========================================================================
+/**
+ * @brief Makes the target of a short backward jump the new idle loop head
+ * @param cpu, the CPU which just jumped from pc
+ * @param pc, address of the jump instruction
+ */
+static void cpu_idle_loop_jump(cpu_t* cpu, addr_t pc)
+{
+	if(cpu->PC < pc && pc - cpu->PC <= IDLE_LOOP_MAX_BYTES && cpu->PC != cpu->idle_loop.head) {
+		cpu->idle_loop.head = cpu->PC;
+		cpu->idle_loop.armed = FALSE;
+	}
+}
+
+// ---------------------------------------------------------------------
+/**
+ * @brief Starts the trace record of what the CPU dispatches, with the
+ *        registers before the dispatch
+ */
+static trace_record_t* cpu_trace_begin(const cpu_t* cpu, uint8_t flags) {
+	trace_record_t* record = trace_begin(cpu->trace);
+	record->pc = cpu->PC;
+	record->AF = cpu->AF;
+	record->BC = cpu->BC;
+	record->DE = cpu->DE;
+	record->HL = cpu->HL;
+	record->SP = cpu->SP;
+	record->IME = cpu->IME;
+	record->IE = cpu->IE;
+	record->IF = cpu->IF;
+	record->flags = flags;
+	return record;
+}
+
+// ---------------------------------------------------------------------
+/**
+ * @brief Commits the trace record of a dispatch which failed, flagged
+ *        TRACE_ERROR, so that the trace ends with it
+ *
+ * @return the error code of the dispatch
+ */
+static int cpu_trace_error(const cpu_t* cpu, trace_record_t* record, int err) {
+	if(err != ERR_NONE && record != NULL) {
+		record->flags |= TRACE_ERROR;
+		trace_commit(cpu->trace);
+	}
+	return err;
+}
+
 // ---------------------------------------------------------------------
 static int cpu_do_cycle(cpu_t* cpu)
 {
     M_REQUIRE_NON_NULL(cpu);
-	uint8_t interrupt = cpu->IE & cpu->IF;
+	// (the upper bits of IE and IF request nothing)
+	uint8_t interrupt = cpu->IE & cpu->IF & INTERRUPTS_MASK;
 
 	if(interrupt != 0 && cpu->IME) {
 		interrupt_t interruption = extractIrqBit(interrupt);
 		if(interruption == NO_INTERRUPTION) {
 			return ERR_BAD_PARAMETER;
 		}
+		trace_record_t* record = cpu->trace == NULL ? NULL : cpu_trace_begin(cpu, TRACE_INTERRUPT);
 		cpu->IME = FALSE;
 		bit_unset(&(cpu->IF), interruption);
-		M_EXIT_IF_ERR(cpu_SP_push(cpu, cpu->PC));
+		M_EXIT_IF_ERR(cpu_trace_error(cpu, record, cpu_SP_push(cpu, cpu->PC)));
 		cpu->PC = INTERRUPT_ADDR + (interruption << SHIFT);
+		if(record != NULL) {
+			// the record gives the vector, the interrupted PC is the value pushed
+			record->pc = cpu->PC;
+			trace_commit(cpu->trace);
+		}
 		cpu->idle_time += INTERRUPT_IDLE_TIME;
+		#ifdef PROFILER
+			profiler_instruction(cpu->profiler, cpu->PC, PROFILER_INTERRUPT, INTERRUPT_IDLE_TIME + 1);
+		#endif
 		return ERR_NONE;
 	}
 
 	if(cpu->idle_time <= 0){
+		const addr_t pc = cpu->PC;
+		cpu_idle_loop_fetch(cpu);
+		++cpu->nb_instructions;
+		++cpu->idle_loop.nb_instructions;
 		uint8_t op = cpu_read_at_idx(cpu, cpu->PC); //////////////////////////////////////////
-		if(op == PREFIXE) {
-			M_EXIT_IF_ERR(cpu_dispatch(&instruction_prefixed[cpu_read_data_after_opcode(cpu)], cpu));
-		} else {
-			M_EXIT_IF_ERR(cpu_dispatch(&instruction_direct[op], cpu));
+		if(cpu->coverage != NULL) {
+			cpu_coverage_fetch(cpu, pc);
+		}
+		if(watch_flagged(cpu->watch, pc, WATCH_EXEC)) {
+			cpu_idle_loop_break(cpu);
+			watch_hit(cpu->watch, cpu, WATCH_EXEC, pc, op);
+		}
+		const instruction_t* lu = op == PREFIXE
+			? &instruction_prefixed[cpu_read_data_after_opcode(cpu)]
+			: &instruction_direct[op];
+		trace_record_t* record = NULL;
+		if(cpu->trace != NULL) {
+			record = cpu_trace_begin(cpu, op == PREFIXE ? TRACE_PREFIXED : 0);
+			record->opcode = op;
+			record->prefixed_opcode = op == PREFIXE ? lu->opcode : 0;
+		}
+		const cpu_fusion_t fusion = cpu->fusion_window == 0 ? FUSION_NONE : cpu_fusion_find(lu, cpu);
+		if(fusion != FUSION_NONE) {
+			// no trace nor watchpoint while fusing, see gameboy_run()
+			addr_t last = pc;
+			M_EXIT_IF_ERR(cpu_dispatch_fused(fusion, lu, cpu, &last));
+			cpu_idle_loop_jump(cpu, last);
+			return ERR_NONE;
 		}
+		M_EXIT_IF_ERR(cpu_trace_error(cpu, record, cpu_dispatch(lu, cpu)));
+		if(record != NULL) {
+			trace_commit(cpu->trace);
+		}
+		#ifdef PROFILER
+			// the instruction lasts until the next dispatch, extra cycles included
+			profiler_instruction(cpu->profiler, pc, lu->family, cpu->idle_time + 1);
+		#endif
+		cpu_idle_loop_jump(cpu, pc);
 
 		return ERR_NONE;
 	} else {
 		cpu->idle_time -= 1;
-		return ERR_BAD_PARAMETER;
+		return ERR_NONE;
 	}
 }
 
@@ -397,14 +572,96 @@ int cpu_cycle(cpu_t* cpu)
     M_REQUIRE_NON_NULL(cpu);
     M_REQUIRE_NON_NULL(cpu->bus);
 	cpu->write_listener = INIT_VALUE;
+	cpu->nb_io_writes = INIT_VALUE;
+	if(cpu->fused_time != 0) {
+		cpu->fused_time -= 1;
+	}
     if(cpu->HALT == FALSE || (cpu->HALT == TRUE && cpu->IF != 0 && cpu->idle_time == 0)) {
 		cpu->HALT = FALSE;
-		cpu_do_cycle(cpu);
+		cpu->idle_loop.tracking = TRUE;
+		const int err = cpu_do_cycle(cpu);
+		cpu->idle_loop.tracking = FALSE;
+		M_EXIT_IF_ERR(err);
+	} else {
+		#ifdef PROFILER
+			profiler_wait(cpu->profiler, 1);
+		#endif
+	}
+	if(cpu->idle_loop.length <= IDLE_LOOP_MAX_CYCLES) {
+		cpu->idle_loop.length += 1;
 	}
     return ERR_NONE;
 }
 
+// ======================================================================
+int cpu_io_dispatch(cpu_t* cpu)
+{
+	M_REQUIRE_NON_NULL(cpu);
+	const uint8_t nb_writes = cpu->nb_io_writes;
+	cpu->nb_io_writes = INIT_VALUE;
+	for(uint8_t i = 0; i < nb_writes; ++i) {
+		M_EXIT_IF_ERR(io_write(cpu->io, cpu->io_writes[i]));
+	}
+	return ERR_NONE;
+}
+
+// ======================================================================
+void cpu_coverage_fetch(cpu_t* cpu, addr_t pc) {
+	++cpu->coverage[(addr_t) (pc ^ cpu->coverage_prev)];
+	cpu->coverage_prev = (addr_t) (pc >> 1);
+}
+
 // ======================================================================
 void cpu_request_interrupt(cpu_t* cpu, interrupt_t i) {
 	cpu->IF = (cpu->IF | 1 << i);
 }
+
+// ======================================================================
+void cpu_idle_loop_access(cpu_t* cpu, addr_t addr, bit_t write) {
+	idle_loop_t* loop = &cpu->idle_loop;
+	// ROM can only change through a write; the timer registers change by themselves
+	if(!loop->tracking || (!write && addr < VIDEO_RAM_START)) {
+		return;
+	}
+	if(write || (addr >= REG_DIV && addr <= REG_TAC)) {
+		cpu_idle_loop_break(cpu);
+		return;
+	}
+	
+	const data_t value = cpu_idle_loop_peek(cpu, addr);
+	for(int i = 0; i < loop->nb_reads; ++i) {
+		if(loop->read_addr[i] == addr) {
+			if(loop->read_value[i] != value) {
+				cpu_idle_loop_break(cpu);
+			}
+			return;
+		}
+	}
+	if(loop->nb_reads == IDLE_LOOP_MAX_READS) {
+		cpu_idle_loop_break(cpu);
+		return;
+	}
+	loop->read_addr[loop->nb_reads] = addr;
+	loop->read_value[loop->nb_reads] = value;
+	++loop->nb_reads;
+}
+
+// ======================================================================
+bit_t cpu_idle_loop_holds(const cpu_t* cpu) {
+	const idle_loop_t* loop = &cpu->idle_loop;
+	if(cpu->IF != loop->IF) {
+		return FALSE;
+	}
+	for(int i = 0; i < loop->nb_reads; ++i) {
+		if(cpu_idle_loop_peek(cpu, loop->read_addr[i]) != loop->read_value[i]) {
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+// ======================================================================
+void cpu_idle_loop_break(cpu_t* cpu) {
+	cpu->idle_loop.clean = FALSE;
+	cpu->idle_loop.period = INIT_VALUE;
+}
@@ -14,6 +14,11 @@ extern "C" {
 
 #include "alu.h"
 #include "bus.h"
+#include "io.h"
+#include "trace.h"
+#ifdef PROFILER
+#include "profiler.h"
+#endif
 
 //=========================================================================
 /**
@@ -30,6 +35,40 @@ typedef enum {
 #define HIGH_RAM_END     0xFFFE
 #define HIGH_RAM_SIZE ((HIGH_RAM_END - HIGH_RAM_START)+1)
 
+#define CPU_COVERAGE_SIZE 0x10000	// edge counters, one per value of a PC (see cpu_t)
+#define CPU_IO_WRITES 4				// I/O register writes kept per cycle (see cpu_io_dispatch())
+
+//=========================================================================
+/**
+ * @brief Type to represent the idle loop detector of the CPU.
+ *
+ *        The head is the target of the last short backward jump. Each time
+ *        the head is fetched, the registers are compared with the ones of
+ *        its previous fetch: if they are equal, the CPU did not write during
+ *        the iteration and the RAM and I/O bytes it read still hold the
+ *        same values, the CPU is polling in an idle loop which will repeat
+ *        every period cycles until one of these bytes (or IF) changes.
+ */
+#define IDLE_LOOP_MAX_READS 8
+
+typedef struct {
+	addr_t head;
+	uint16_t AF, BC, DE, HL, SP;
+	bit_t IME;
+	uint8_t IE;
+	uint8_t IF;
+	bit_t armed;		// registers above were saved at the last head fetch
+	bit_t clean;		// no write, no timer read since the last head fetch
+	bit_t tracking;		// the CPU is running a cycle (see cpu_cycle())
+	uint16_t length;	// cycles since the last head fetch
+	uint16_t nb_instructions;	// instructions since the last head fetch
+	uint16_t period;	// cycles of the idle loop, 0 if none was found
+	uint16_t period_instructions;	// instructions of the idle loop
+	uint8_t nb_reads;
+	addr_t read_addr[IDLE_LOOP_MAX_READS];
+	data_t read_value[IDLE_LOOP_MAX_READS];
+} idle_loop_t;
+
 //=========================================================================
 /**
  * @brief Type to represent CPU
@@ -72,6 +111,24 @@ typedef struct {
 	component_t high_ram;
 	addr_t write_listener;
 	uint8_t idle_time;
+	idle_loop_t idle_loop;
+	const io_table_t* io;
+	addr_t io_writes[CPU_IO_WRITES];	// I/O registers written by the last cycle, not dispatched yet
+	uint8_t nb_io_writes;
+	uint64_t nb_instructions;	// executed (or skipped) since cpu_init()
+	trace_t* trace;				// NULL when not tracing
+	struct watch_table_* watch;	// see watch.h
+	uint8_t* dirty;				// pages written, see state-hash.h (NULL when not hashing)
+	uint8_t fusion_window;		// cycles from the current one on during which only the CPU acts
+								// (set by gameboy_run(), 0 for no superinstruction, see cpu-fusion.h)
+	uint8_t fused_time;			// cycles before the fetch of the last instruction run ahead
+	uint64_t* fusion_counts;	// superinstructions run, per cpu_fusion_t (NULL when not counting)
+	uint8_t* coverage;			// hits per edge between two instructions fetched, CPU_COVERAGE_SIZE
+								// counters indexed by their PCs (NULL when not collecting, see gbfuzz.c)
+	addr_t coverage_prev;		// PC of the last instruction fetched, shifted right by 1
+#ifdef PROFILER
+	profiler_t* profiler;
+#endif
 } cpu_t;
 
 //=========================================================================
@@ -83,6 +140,16 @@ typedef struct {
  */
 int cpu_cycle(cpu_t* cpu);
 
+//=========================================================================
+/**
+ * @brief Notifies the I/O handlers of the registers written by the last
+ *        cycle, in the order of the writes: the caller runs them once the
+ *        other components ran that cycle, as the bus listeners used to
+ * @param cpu (modified), the CPU which ran the cycle
+ * @return error code
+ */
+int cpu_io_dispatch(cpu_t* cpu);
+
 
 /**
  * @brief Plugs a bus into the cpu
@@ -104,6 +171,17 @@ int cpu_plug(cpu_t* cpu, bus_t* bus);
  */
 int cpu_init(cpu_t* cpu);
 
+/**
+ * @brief Starts the cpu like cpu_init(), its high RAM carved out of an
+ *        arena
+ *
+ * @param cpu cpu to start
+ * @param arena arena to allocate from, NULL to allocate on the heap
+ *
+ * @return error code
+ */
+int cpu_init_in(cpu_t* cpu, arena_t* arena);
+
 
 /**
  * @brief Frees a cpu
@@ -113,12 +191,60 @@ int cpu_init(cpu_t* cpu);
 void cpu_free(cpu_t* cpu);
 
 
+/**
+ * @brief Tells whether the condition cc of a conditional jump holds
+ */
+int jumpConditionnal(const cpu_t* cpu, uint8_t cc);
+
+
 /**
  * @brief Set an interruption
  */
 void cpu_request_interrupt(cpu_t* cpu, interrupt_t i);
 
 
+/**
+ * @brief Tells the idle loop detector that the CPU accessed the bus at the
+ *        given address (does nothing outside of cpu_cycle())
+ *
+ * @param cpu cpu which reads or writes
+ * @param addr address accessed
+ * @param write whether it is a write
+ */
+void cpu_idle_loop_access(cpu_t* cpu, addr_t addr, bit_t write);
+
+
+/**
+ * @brief Tells whether the bytes read by the idle loop, and IF, still hold
+ *        the values the loop found
+ *
+ * @param cpu cpu to check
+ *
+ * @return TRUE if the idle loop will keep on repeating
+ */
+bit_t cpu_idle_loop_holds(const cpu_t* cpu);
+
+
+/**
+ * @brief Forgets about the current iteration of the idle loop (for instance
+ *        after a joypad event)
+ *
+ * @param cpu cpu whose detector to reset
+ */
+void cpu_idle_loop_break(cpu_t* cpu);
+
+
+/**
+ * @brief Counts the edge from the last instruction fetched (or interrupt
+ *        vector) to the one fetched at pc, the instructions run in a
+ *        superinstruction included (see cpu_t)
+ *
+ * @param cpu cpu which fetches, collecting the coverage
+ * @param pc address of the instruction fetched
+ */
+void cpu_coverage_fetch(cpu_t* cpu, addr_t pc);
+
+
 #ifdef __cplusplus
 }
 #endif
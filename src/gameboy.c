@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "gameboy.h"
 #include "error.h"
 #include "bus.h"
@@ -8,6 +9,8 @@
 #include "cpu-storage.h"
 
 #define INIT_VALUE 0
+#define TRUE 1
+#define FALSE 0
 
 #define W_RAM 0
 #define REG 1
@@ -17,36 +20,149 @@
 #define U 5
 #define BOOT_INIT 1
 
+// a memory_t and its content per memory, in the order they are carved out
+// of the arena: the hottest first, so that they share pages
+#define GB_ARENA_BLOCK(size) (ARENA_ROUND(sizeof(memory_t)) + ARENA_ROUND(size))
+#define GB_ARENA_SIZE \
+	(GB_ARENA_BLOCK(MEM_SIZE(WORK_RAM)) + GB_ARENA_BLOCK(HIGH_RAM_SIZE) \
+	 + GB_ARENA_BLOCK(MEM_SIZE(REGISTERS)) + GB_ARENA_BLOCK(MEM_SIZE(GRAPH_RAM)) \
+	 + GB_ARENA_BLOCK(MEM_SIZE(VIDEO_RAM)) + GB_ARENA_BLOCK(MEM_SIZE(EXTERN_RAM)) \
+	 + GB_ARENA_BLOCK(MEM_SIZE(USELESS)) + GB_ARENA_BLOCK(MEM_SIZE(BOOT_ROM)) \
+	 + GB_ARENA_BLOCK(BANK_ROM_SIZE))
 
-#ifdef BLARGG
-static int blargg_bus_listener(gameboy_t* gameboy, addr_t addr) {
-	M_REQUIRE_NON_NULL(gameboy);
-	if(addr == BLARGG_REG){
-		printf("%c", cpu_read_at_idx(&(gameboy->cpu), addr));
+// -DGB_HUGE_PAGES backs the arena with a huge page when the system has one
+#ifdef GB_HUGE_PAGES
+	#define GB_ARENA_HUGE_PAGES TRUE
+#else
+	#define GB_ARENA_HUGE_PAGES FALSE
+#endif
+
+#ifdef PROFILER
+	// -DPROFILER_PERIOD=N samples one cycle out of N instead of attributing all of them
+	#ifdef PROFILER_PERIOD
+		#define PROFILER_MODE PROFILER_SAMPLED
+	#else
+		#define PROFILER_MODE PROFILER_EXACT
+		#define PROFILER_PERIOD 1
+	#endif
+#endif
+
+_Thread_local volatile sig_atomic_t gb_phase = GB_PHASE_NONE;
+
+/*
+ * I/O write handlers of the components (see io.h)
+ */
+static int timer_io_write(void* timer, addr_t addr) {
+	return timer_bus_listener(timer, addr);
+}
+
+static int serial_io_write(void* serial, addr_t addr) {
+	return serial_bus_listener(serial, addr);
+}
+
+static int lcdc_io_write(void* lcd, addr_t addr) {
+	return lcdc_bus_listener(lcd, addr);
+}
+
+static int bootrom_io_write(void* gameboy, addr_t addr) {
+	M_EXIT_IF_ERR(bootrom_bus_listener(gameboy, addr));
+	#ifdef PROFILER
+		profiler_set_boot(&((gameboy_t*) gameboy)->profiler, ((gameboy_t*) gameboy)->boot);
+	#endif
+	return ERR_NONE;
+}
+
+static int joypad_io_write(void* pad, addr_t addr) {
+	return joypad_bus_listener(pad, addr);
+}
+
+/**
+ * @brief registers the I/O registers of every component and plugs the
+ *        table into the CPU
+ */
+static int gameboy_io_plug(gameboy_t* gameboy) {
+	M_EXIT_IF_ERR(io_init(&gameboy->io));
+	M_EXIT_IF_ERR(io_register(&gameboy->io, REG_P1, REG_P1, NULL, joypad_io_write, &gameboy->pad));
+	M_EXIT_IF_ERR(io_register(&gameboy->io, SERIAL_START, SERIAL_END, NULL, serial_io_write, &gameboy->serial));
+	M_EXIT_IF_ERR(io_register(&gameboy->io, TIMER_START, TIMER_END, NULL, timer_io_write, &gameboy->timer));
+	M_EXIT_IF_ERR(io_register(&gameboy->io, REGS_LCDC_START, REGS_LCDC_END, NULL, lcdc_io_write, &gameboy->screen));
+	M_EXIT_IF_ERR(io_register(&gameboy->io, REG_BOOT_ROM_DISABLE, REG_BOOT_ROM_DISABLE, NULL, bootrom_io_write, gameboy));
+	gameboy->cpu.io = &gameboy->io;
+	return ERR_NONE;
+}
+
+/**
+ * @brief State restored by gameboy_reset(): the memories are restored from
+ *        the copy of the arena, the rest from the registers of the state
+ *        (the boot ROM or the cartridge being mapped at the start of the bus)
+ */
+typedef struct gameboy_image_ {
+	data_t* arena;
+	data_t* boot_bus[MEM_SIZE(BOOT_ROM)];
+	component_t bootrom;
+	gameboy_state_t state;
+} gameboy_image_t;
+
+/**
+ * @brief takes the image of the current state of a gameboy
+ */
+static int gameboy_image_take(const gameboy_t* gameboy, gameboy_image_t** image) {
+	gameboy_image_t* taken = malloc(sizeof(gameboy_image_t));
+	if(taken == NULL) {
+		return ERR_MEM;
 	}
+	taken->arena = malloc(gameboy->arena.used);
+	if(taken->arena == NULL) {
+		free(taken);
+		return ERR_MEM;
+	}
+	memcpy(taken->arena, gameboy->arena.base, gameboy->arena.used);
+	memcpy(taken->boot_bus, gameboy->bus, sizeof(taken->boot_bus));
+	taken->bootrom = gameboy->bootrom;
+	M_EXIT_IF_ERR_DO_SOMETHING(gameboy_save_state(gameboy, &taken->state),
+							   (free(taken->arena), free(taken)));
+	*image = taken;
 	return ERR_NONE;
 }
-#endif
+
+static void gameboy_image_free(gameboy_image_t** image) {
+	if(*image != NULL) {
+		free((*image)->arena);
+		free(*image);
+		*image = NULL;
+	}
+}
 
 int gameboy_create(gameboy_t* gameboy, const char* filename) {
 	M_REQUIRE_NON_NULL(gameboy);
 	//gameboy->cycles = INIT_VALUE;
 	gameboy->cycles = 1;
+	gameboy->frames = INIT_VALUE;
 	gameboy->nb_components = 0;
+	gameboy->recorder = NULL;
+	gameboy->movie = NULL;
+	gameboy->hash = NULL;
+	gameboy->fast_paths = GB_FAST_ALL;
+	for(int i = 0; i < GB_NB_RESET_MODES; ++i) {
+		gameboy->images[i] = NULL;
+	}
 	
 	for(int i = 0; i < BUS_SIZE; ++i) {
 		gameboy->bus[i] = NULL;
 	}
-	M_EXIT_IF_ERR(component_create(&gameboy->components[W_RAM], MEM_SIZE(WORK_RAM)));
-	M_EXIT_IF_ERR(component_create(&gameboy->components[REG], MEM_SIZE(REGISTERS)));
-	M_EXIT_IF_ERR(component_create(&gameboy->components[E_RAM], MEM_SIZE(EXTERN_RAM)));
-	M_EXIT_IF_ERR(component_create(&gameboy->components[V_RAM], MEM_SIZE(VIDEO_RAM)));
-	M_EXIT_IF_ERR(component_create(&gameboy->components[G_RAM], MEM_SIZE(GRAPH_RAM)));
-	M_EXIT_IF_ERR(component_create(&gameboy->components[U], MEM_SIZE(USELESS)));
+	M_EXIT_IF_ERR(arena_init(&gameboy->arena, GB_ARENA_SIZE, GB_ARENA_HUGE_PAGES));
+	arena_t* arena = &gameboy->arena;
+	M_EXIT_IF_ERR(component_create_in(&gameboy->components[W_RAM], MEM_SIZE(WORK_RAM), arena));
+	M_EXIT_IF_ERR(cpu_init_in(&gameboy->cpu, arena));
+	M_EXIT_IF_ERR(component_create_in(&gameboy->components[REG], MEM_SIZE(REGISTERS), arena));
+	M_EXIT_IF_ERR(component_create_in(&gameboy->components[G_RAM], MEM_SIZE(GRAPH_RAM), arena));
+	M_EXIT_IF_ERR(component_create_in(&gameboy->components[V_RAM], MEM_SIZE(VIDEO_RAM), arena));
+	M_EXIT_IF_ERR(component_create_in(&gameboy->components[E_RAM], MEM_SIZE(EXTERN_RAM), arena));
+	M_EXIT_IF_ERR(component_create_in(&gameboy->components[U], MEM_SIZE(USELESS), arena));
 	gameboy->nb_components = GB_NB_COMPONENTS;
 	
-	component_t echo;
-	M_EXIT_IF_ERR(component_create(&echo, MEM_SIZE(ECHO_RAM))); /////////////////////////////////////////////
+	// the echo RAM shares the memory of the work RAM
+	component_t echo = {0};
 	M_EXIT_IF_ERR(bus_plug(gameboy->bus, &gameboy->components[W_RAM], WORK_RAM_START, WORK_RAM_END));
 	M_EXIT_IF_ERR(bus_plug(gameboy->bus, &gameboy->components[REG], REGISTERS_START, REGISTERS_END));
 	M_EXIT_IF_ERR(bus_plug(gameboy->bus, &gameboy->components[E_RAM], EXTERN_RAM_START, EXTERN_RAM_END));
@@ -56,20 +172,34 @@ int gameboy_create(gameboy_t* gameboy, const char* filename) {
 	M_EXIT_IF_ERR(component_shared(&echo, &gameboy->components[W_RAM]));			
 	M_EXIT_IF_ERR(bus_plug(gameboy->bus, &echo, ECHO_RAM_START, ECHO_RAM_END));
 	
-	M_EXIT_IF_ERR(cpu_init(&gameboy->cpu));
-	
 	gameboy->boot = BOOT_INIT;		
+	#ifdef PROFILER
+		M_EXIT_IF_ERR(profiler_init(&gameboy->profiler, PROFILER_MODE, PROFILER_PERIOD));
+		profiler_set_boot(&gameboy->profiler, gameboy->boot);
+		gameboy->cpu.profiler = &gameboy->profiler;
+	#endif
 		
 	M_EXIT_IF_ERR(timer_init(&gameboy->timer, &gameboy->cpu));	
-	M_EXIT_IF_ERR(cartridge_init(&gameboy->cartridge, filename));
+	M_EXIT_IF_ERR(serial_init(&gameboy->serial, &gameboy->cpu));
+	#ifdef BLARGG
+		gameboy->serial_echo = stdout;
+	#else
+		gameboy->serial_echo = NULL;
+	#endif
+	M_EXIT_IF_ERR(cartridge_init_in(&gameboy->cartridge, filename, arena));
 	M_EXIT_IF_ERR(cartridge_plug(&gameboy->cartridge, gameboy->bus));
-	M_EXIT_IF_ERR(bootrom_init(&gameboy->bootrom));
+	M_EXIT_IF_ERR(bootrom_init_in(&gameboy->bootrom, arena));
 	M_EXIT_IF_ERR(bootrom_plug(&gameboy->bootrom, gameboy->bus));
 	M_EXIT_IF_ERR(cpu_plug(&gameboy->cpu, &gameboy->bus));
 	
 	M_EXIT_IF_ERR(lcdc_init(gameboy)); ////////////////////////////////////////////////////////////////////
 	M_EXIT_IF_ERR(lcdc_plug(&gameboy->screen, gameboy->bus));
 	M_EXIT_IF_ERR(joypad_init_and_plug(&gameboy->pad, &gameboy->cpu));
+	M_EXIT_IF_ERR(gameboy_io_plug(gameboy));
+	M_EXIT_IF_ERR(watch_init(&gameboy->watch));
+	gameboy->cpu.watch = &gameboy->watch;
+	
+	M_EXIT_IF_ERR(gameboy_image_take(gameboy, &gameboy->images[GB_RESET_POWER_ON]));
 
 	return ERR_NONE;
 }
@@ -88,32 +218,534 @@ void gameboy_free(gameboy_t* gameboy) {
 		cpu_free(&gameboy->cpu);
 		component_free(&gameboy->bootrom);
 		lcdc_free(&gameboy->screen);
+		gameboy_trace_stop(gameboy);
+		gameboy_record_stop(gameboy);
+		gameboy_movie_stop(gameboy);
+		gameboy_hash_stop(gameboy);
+		#ifdef PROFILER
+			profiler_report(&gameboy->profiler, stderr, PROFILER_REPORT_LINES);
+			profiler_free(&gameboy->profiler);
+			gameboy->cpu.profiler = NULL;
+		#endif
+		for(int i = 0; i < GB_NB_RESET_MODES; ++i) {
+			gameboy_image_free(&gameboy->images[i]);
+		}
+		arena_free(&gameboy->arena);
 		gameboy->timer.counter = 0;
 		gameboy->nb_components = 0;
 		gameboy = NULL;
 	}
 }
 
-int gameboy_run_until(gameboy_t* gameboy, uint64_t cycle) {
+/**
+ * @brief tells whether the LCD controller enters VBLANK at the given cycle
+ */
+static bit_t lcdc_vblank_starts(const lcdc_t* lcd, uint64_t cycle) {
+	return lcd->next_cycle == cycle
+		&& (cycle - lcd->on_cycle) % FRAME_TOTAL_CYCLES == LCD_HEIGHT * LINE_TOTAL_CYCLES;
+}
+
+/**
+ * @brief tells whether the LCD controller may write to memory at the given cycle
+ *        (at its next_cycle, when it is switched on, and during OAM DMA)
+ */
+static bit_t lcdc_acts(const lcdc_t* lcd, uint64_t cycle) {
+	return lcd->on && (lcd->next_cycle == cycle || lcd->next_cycle == UINT64_MAX
+					   || lcd->DMA_to <= GRAPH_RAM_END);
+}
+
+/**
+ * @brief tells whether the CPU is halted and will stay so until an interrupt
+ */
+static bit_t cpu_halted(const cpu_t* cpu) {
+	return cpu->HALT && (cpu->IF == 0 || cpu->idle_time != 0);
+}
+
+/**
+ * @brief gives the first cycle, not after the given one, at which the timer,
+ *        the serial port or the LCD controller may change the memory or
+ *        raise an interrupt (joypad events only happen between two runs)
+ */
+static uint64_t gameboy_next_event(const gameboy_t* gameboy, uint64_t cycle) {
+	uint64_t end = cycle;
+	
+	const uint64_t timer_left = timer_cycles_before_interrupt(&gameboy->timer);
+	if(timer_left < end - gameboy->cycles) {
+		end = gameboy->cycles + timer_left;
+	}
+	const uint64_t serial_left = serial_cycles_before_event(&gameboy->serial);
+	if(serial_left < end - gameboy->cycles) {
+		end = gameboy->cycles + serial_left;
+	}
+	if(gameboy->screen.on) {
+		if(lcdc_acts(&gameboy->screen, gameboy->cycles)) {
+			return gameboy->cycles;
+		}
+		if(gameboy->screen.next_cycle < end) {
+			end = gameboy->screen.next_cycle;
+		}
+	}
+	return end;
+}
+
+/**
+ * @brief gives the cycles, from the current one on, during which the CPU
+ *        may run instructions ahead of their fetch (see cpu-fusion.h):
+ *        none when tracing or watching, since both see every instruction.
+ *        The next event is kept in quiet until it is reached (or until an
+ *        I/O write, which may reschedule it, see gameboy_run())
+ */
+static uint8_t gameboy_fusion_window(const gameboy_t* gameboy, uint64_t cycle, uint64_t* quiet) {
+	if(!(gameboy->fast_paths & GB_FAST_FUSION) || gameboy->cpu.trace != NULL
+	   || gameboy->watch.kinds != 0) {
+		return 0;
+	}
+	if(*quiet <= gameboy->cycles) {
+		*quiet = gameboy_next_event(gameboy, cycle);
+	}
+	const uint64_t window = *quiet - gameboy->cycles;
+	return window < UINT8_MAX ? (uint8_t) window : UINT8_MAX;
+}
+
+/**
+ * @brief fast-forwards the gameboy by the given number of cycles, during
+ *        which only the timer counter and the serial clock change
+ */
+static int gameboy_skip(gameboy_t* gameboy, uint64_t nb_cycles) {
+	gb_phase = GB_PHASE_TIMER;
+	M_EXIT_IF_ERR(timer_cycles(&gameboy->timer, nb_cycles));
+	M_EXIT_IF_ERR(serial_cycles(&gameboy->serial, nb_cycles));
+	gameboy->cycles += nb_cycles;
+	return ERR_NONE;
+}
+
+/**
+ * @brief fast-forwards a halted gameboy, applying in bulk all the cycles
+ *        before the given one during which neither the timer, the serial
+ *        port nor the LCD controller can raise an interrupt
+ */
+static int gameboy_skip_halt(gameboy_t* gameboy, uint64_t cycle) {
+	const uint64_t end = gameboy_next_event(gameboy, cycle);
+	if(end <= gameboy->cycles) {
+		return ERR_NONE;
+	}
+	#ifdef PROFILER
+		profiler_wait(&gameboy->profiler, end - gameboy->cycles);
+	#endif
+	return gameboy_skip(gameboy, end - gameboy->cycles);
+}
+
+/**
+ * @brief fast-forwards a gameboy whose CPU is polling in an idle loop by as
+ *        many whole iterations as fit before the next timer, serial or LCD
+ *        event:
+ *        each of them would read the same values and leave the CPU in the
+ *        same state
+ */
+static int gameboy_skip_idle_loop(gameboy_t* gameboy, uint64_t cycle) {
+	const uint64_t period = gameboy->cpu.idle_loop.period;
+	const uint64_t end = gameboy_next_event(gameboy, cycle);
+	if(end <= gameboy->cycles) {
+		return ERR_NONE;
+	}
+	const uint64_t iterations = (end - gameboy->cycles) / period;
+	gameboy->cpu.nb_instructions += iterations * gameboy->cpu.idle_loop.period_instructions;
+	#ifdef PROFILER
+		M_EXIT_IF_ERR(profiler_repeat(&gameboy->profiler, iterations,
+									  gameboy->cpu.idle_loop.period_instructions));
+	#endif
+	return gameboy_skip(gameboy, iterations * period);
+}
+
+/**
+ * @brief appends the frame just completed to the recording
+ */
+static int gameboy_record_frame(gameboy_t* gameboy) {
+	uint8_t frame[LCD_HEIGHT][LCD_WIDTH];
+	gb_phase = GB_PHASE_RENDER;
+	for(size_t y = 0; y < LCD_HEIGHT; ++y) {
+		M_EXIT_IF_ERR(image_get_line_pixels(frame[y], &gameboy->screen.display, y));
+	}
+	return recorder_push(gameboy->recorder, frame);
+}
+
+/**
+ * @brief writes the serial output sent so far to serial_echo, if any, in
+ *        batches
+ */
+static int gameboy_serial_echo(gameboy_t* gameboy) {
+	if(gameboy->serial_echo == NULL) {
+		return ERR_NONE;
+	}
+	data_t bytes[SERIAL_BUFFER_SIZE];
+	size_t nb_bytes = INIT_VALUE;
+	while((nb_bytes = serial_drain(&gameboy->serial.out, bytes, sizeof(bytes))) > 0) {
+		if(fwrite(bytes, 1, nb_bytes, gameboy->serial_echo) != nb_bytes) {
+			return ERR_IO;
+		}
+	}
+	return ERR_NONE;
+}
+
+/**
+ * @brief runs the gameboy until the given cycle or until the frame counter
+ *        reaches the given value, whichever comes first
+ */
+static int gameboy_run(gameboy_t* gameboy, uint64_t cycle, uint64_t frames) {
 	M_REQUIRE_NON_NULL(gameboy);
-	while(gameboy->cycles < cycle) {	
+	// the joypad may have changed since the last run
+	cpu_idle_loop_break(&gameboy->cpu);
+	gameboy->watch.stop = FALSE;
+	uint64_t quiet = gameboy->cycles;	// next event, see gameboy_fusion_window()
+	
+	while(gameboy->cycles < cycle && gameboy->frames < frames) {	
+		if(cpu_halted(&gameboy->cpu)) {
+			if(gameboy->fast_paths & GB_FAST_HALT) {
+				M_EXIT_IF_ERR(gameboy_skip_halt(gameboy, cycle));
+			}
+		} else if((gameboy->fast_paths & GB_FAST_IDLE_LOOP) && gameboy->cpu.idle_loop.period != 0
+				  && gameboy->cpu.fused_time == 0) {
+			// (never within a superinstruction: the next event could fall before its end)
+			M_EXIT_IF_ERR(gameboy_skip_idle_loop(gameboy, cycle));
+		}
+		if(gameboy->cycles >= cycle) {
+			break;
+		}
+		if(gameboy->cpu.idle_time == 0) {
+			gameboy->cpu.fusion_window = gameboy_fusion_window(gameboy, cycle, &quiet);
+		}
+		
+		gb_phase = GB_PHASE_TIMER;
 		M_EXIT_IF_ERR(timer_cycle(&gameboy->timer));
+		if(gameboy->serial.clock != 0) {
+			// (accounted to the timer, the serial port only runs while transferring)
+			M_EXIT_IF_ERR(serial_cycle(&gameboy->serial));
+		}
+		gb_phase = GB_PHASE_CPU;
 		M_EXIT_IF_ERR(cpu_cycle(&gameboy->cpu));
+		if(gameboy->cpu.write_listener >= REGISTERS_START - 1) {
+			// (a 16-bit write at REGISTERS_START - 1 reaches the I/O registers too)
+			quiet = gameboy->cycles;
+		}
 		if(gameboy->screen.on) {
+			gb_phase = GB_PHASE_LCD;
+			const bit_t vblank = lcdc_vblank_starts(&gameboy->screen, gameboy->cycles);
 			M_EXIT_IF_ERR(lcdc_cycle(&gameboy->screen, gameboy->cycles));
+			gameboy->frames += vblank;
+			if(vblank && gameboy->recorder != NULL) {
+				M_EXIT_IF_ERR(gameboy_record_frame(gameboy));
+			}
+			if(vblank && gameboy->hash != NULL) {
+				M_EXIT_IF_ERR(state_hash_frame(gameboy->hash, gameboy));
+			}
 		}
 		
-		M_EXIT_IF_ERR(timer_bus_listener(&gameboy->timer, gameboy->cpu.write_listener));		
-		M_EXIT_IF_ERR(lcdc_bus_listener(&gameboy->screen, gameboy->cpu.write_listener));
-		M_EXIT_IF_ERR(bootrom_bus_listener(gameboy, gameboy->cpu.write_listener));
-		M_EXIT_IF_ERR(joypad_bus_listener(&gameboy->pad, gameboy->cpu.write_listener));
+		// the components see the writes of the CPU once the LCD controller ran
+		gb_phase = GB_PHASE_CPU;
+		M_EXIT_IF_ERR(cpu_io_dispatch(&gameboy->cpu));
+
+		// the timer, the serial port or the LCD controller may have changed what the idle loop polls
+		if(gameboy->cpu.idle_loop.period != 0 && !cpu_idle_loop_holds(&gameboy->cpu)) {
+			cpu_idle_loop_break(&gameboy->cpu);
+		}
 		
 		(gameboy->cycles)++;
+		if(gameboy->watch.stop) {
+			break;
+		}
+	}
+	gb_phase = GB_PHASE_NONE;
+	return gameboy_serial_echo(gameboy);
+}
+
+/**
+ * @brief applies the events of the movie played that are due, and gives
+ *        the cycle of the next one (UINT64_MAX if none)
+ */
+static uint64_t gameboy_play_events(gameboy_t* gameboy) {
+	const movie_event_t* event = NULL;
+	while((event = movie_peek(gameboy->movie)) != NULL && event->cycle <= gameboy->cycles) {
+		if(event->pressed) {
+			joypad_key_pressed(&gameboy->pad, event->key);
+		} else {
+			joypad_key_released(&gameboy->pad, event->key);
+		}
+		movie_skip(gameboy->movie);
+	}
+	return event == NULL ? UINT64_MAX : event->cycle;
+}
+
+/**
+ * @brief runs the gameboy like gameboy_run(), stopping at the cycle of
+ *        each event of the movie played to apply it
+ */
+static int gameboy_run_playing(gameboy_t* gameboy, uint64_t cycle, uint64_t frames) {
+	for(;;) {
+		const uint64_t next_event = gameboy_play_events(gameboy);
+		const uint64_t end = next_event < cycle ? next_event : cycle;
+		M_EXIT_IF_ERR(gameboy_run(gameboy, end, frames));
+		if(end == cycle || gameboy->cycles < end || gameboy->frames >= frames || gameboy->watch.stop) {
+			return ERR_NONE;
+		}
+	}
+}
+
+int gameboy_run_until(gameboy_t* gameboy, uint64_t cycle) {
+	M_REQUIRE_NON_NULL(gameboy);
+	return gameboy_run_playing(gameboy, cycle, UINT64_MAX);
+}
+
+int gameboy_run_frame(gameboy_t* gameboy, uint64_t cycle) {
+	M_REQUIRE_NON_NULL(gameboy);
+	return gameboy_run_playing(gameboy, cycle, gameboy->frames + 1);
+}
+
+int gameboy_trace_start(gameboy_t* gameboy, const char* filename, size_t nb_records) {
+	M_REQUIRE_NON_NULL(gameboy);
+	M_REQUIRE(gameboy->cpu.trace == NULL, ERR_BAD_PARAMETER, "%s", "already tracing");
+	M_EXIT_IF_ERR(trace_open(&gameboy->trace, nb_records, filename, &gameboy->cycles));
+	gameboy->cpu.trace = &gameboy->trace;
+	return ERR_NONE;
+}
+
+int gameboy_trace_stop(gameboy_t* gameboy) {
+	M_REQUIRE_NON_NULL(gameboy);
+	if(gameboy->cpu.trace == NULL) {
+		return ERR_NONE;
+	}
+	gameboy->cpu.trace = NULL;
+	return trace_close(&gameboy->trace);
+}
+
+int gameboy_record_start(gameboy_t* gameboy, const char* filename, uint32_t keyframe_interval) {
+	M_REQUIRE_NON_NULL(gameboy);
+	M_REQUIRE(gameboy->recorder == NULL, ERR_BAD_PARAMETER, "%s", "already recording");
+	recorder_t* recorder = malloc(sizeof(recorder_t));
+	if(recorder == NULL) {
+		return ERR_MEM;
+	}
+	const int err = recorder_open(recorder, filename, keyframe_interval);
+	if(err != ERR_NONE) {
+		free(recorder);
+		return err;
+	}
+	gameboy->recorder = recorder;
+	return ERR_NONE;
+}
+
+int gameboy_record_stop(gameboy_t* gameboy) {
+	M_REQUIRE_NON_NULL(gameboy);
+	if(gameboy->recorder == NULL) {
+		return ERR_NONE;
+	}
+	const int err = recorder_close(gameboy->recorder);
+	free(gameboy->recorder);
+	gameboy->recorder = NULL;
+	return err;
+}
+
+int gameboy_key(gameboy_t* gameboy, gb_key_t key, bit_t pressed) {
+	M_REQUIRE_NON_NULL(gameboy);
+	if(gameboy->movie != NULL && gameboy->movie->mode == MOVIE_RECORD) {
+		const movie_event_t event = { gameboy->cycles, key, pressed };
+		M_EXIT_IF_ERR(movie_write(gameboy->movie, &event));
+	}
+	return pressed ? joypad_key_pressed(&gameboy->pad, key) : joypad_key_released(&gameboy->pad, key);
+}
+
+int gameboy_movie_start(gameboy_t* gameboy, const char* filename, movie_mode_t mode) {
+	M_REQUIRE_NON_NULL(gameboy);
+	M_REQUIRE(gameboy->movie == NULL, ERR_BAD_PARAMETER, "%s", "already recording or playing a movie");
+	movie_t* movie = malloc(sizeof(movie_t));
+	if(movie == NULL) {
+		return ERR_MEM;
+	}
+	const int err = mode == MOVIE_PLAY ? movie_play(movie, filename) : movie_record(movie, filename);
+	if(err != ERR_NONE) {
+		free(movie);
+		return err;
+	}
+	gameboy->movie = movie;
+	return ERR_NONE;
+}
+
+int gameboy_movie_stop(gameboy_t* gameboy) {
+	M_REQUIRE_NON_NULL(gameboy);
+	if(gameboy->movie == NULL) {
+		return ERR_NONE;
+	}
+	const int err = movie_close(gameboy->movie);
+	free(gameboy->movie);
+	gameboy->movie = NULL;
+	return err;
+}
+
+int gameboy_hash_start(gameboy_t* gameboy, const char* filename) {
+	M_REQUIRE_NON_NULL(gameboy);
+	M_REQUIRE(gameboy->hash == NULL, ERR_BAD_PARAMETER, "%s", "already hashing");
+	state_hash_t* hash = malloc(sizeof(state_hash_t));
+	if(hash == NULL) {
+		return ERR_MEM;
+	}
+	const int err = state_hash_init(hash, filename);
+	if(err != ERR_NONE) {
+		free(hash);
+		return err;
+	}
+	gameboy->hash = hash;
+	gameboy->cpu.dirty = hash->dirty;
+	return ERR_NONE;
+}
+
+int gameboy_hash_stop(gameboy_t* gameboy) {
+	M_REQUIRE_NON_NULL(gameboy);
+	if(gameboy->hash == NULL) {
+		return ERR_NONE;
+	}
+	gameboy->cpu.dirty = NULL;
+	const int err = state_hash_close(gameboy->hash);
+	free(gameboy->hash);
+	gameboy->hash = NULL;
+	return err;
+}
+
+/**
+ * @brief tells whether an address is saved in a gameboy_state_t (the echo
+ *        RAM aliases the work RAM)
+ */
+static bit_t gameboy_state_saves(addr_t addr) {
+	return addr >= VIDEO_RAM_START && (addr < ECHO_RAM_START || addr > ECHO_RAM_END);
+}
+
+int gameboy_save_state(const gameboy_t* gameboy, gameboy_state_t* state) {
+	M_REQUIRE_NON_NULL(gameboy);
+	M_REQUIRE_NON_NULL(state);
 	
-		#ifdef BLARGG
-			M_EXIT_IF_ERR(blargg_bus_listener(gameboy, gameboy->cpu.write_listener));
-		#endif
-		
+	for(size_t i = 0; i < GB_STATE_MEMORY_SIZE; ++i) {
+		const addr_t addr = (addr_t) (VIDEO_RAM_START + i);
+		const data_t* byte = gameboy->bus[addr];
+		state->memory[i] = gameboy_state_saves(addr) && byte != NULL ? *byte : 0;
+	}
+	state->cpu = gameboy->cpu;
+	state->timer_counter = gameboy->timer.counter;
+	state->serial_bits = gameboy->serial.bits;
+	state->serial_clock = gameboy->serial.clock;
+	state->serial_in = gameboy->serial.in;
+	state->lcd_on = gameboy->screen.on;
+	state->lcd_next_cycle = gameboy->screen.next_cycle;
+	state->lcd_on_cycle = gameboy->screen.on_cycle;
+	state->lcd_DMA_from = gameboy->screen.DMA_from;
+	state->lcd_DMA_to = gameboy->screen.DMA_to;
+	state->lcd_window_y = gameboy->screen.window_y;
+	state->pad_intern = gameboy->pad.intern;
+	state->pad_old_state = gameboy->pad.old_state;
+	memcpy(state->pad_keys_state, gameboy->pad.keys_state, sizeof(state->pad_keys_state));
+	state->boot = gameboy->boot;
+	state->cycles = gameboy->cycles;
+	state->frames = gameboy->frames;
+	return ERR_NONE;
+}
+
+/**
+ * @brief restores everything of a state but its memory
+ */
+static void gameboy_load_registers(gameboy_t* gameboy, const gameboy_state_t* state) {
+	// the registers of the CPU, not what it is plugged to
+	cpu_t cpu = state->cpu;
+	cpu.bus = gameboy->cpu.bus;
+	cpu.high_ram = gameboy->cpu.high_ram;
+	cpu.io = gameboy->cpu.io;
+	cpu.trace = gameboy->cpu.trace;
+	cpu.watch = gameboy->cpu.watch;
+	cpu.dirty = gameboy->cpu.dirty;
+	cpu.fusion_counts = gameboy->cpu.fusion_counts;
+	cpu.coverage = gameboy->cpu.coverage;
+	#ifdef PROFILER
+		cpu.profiler = gameboy->cpu.profiler;
+	#endif
+	gameboy->cpu = cpu;
+	cpu_idle_loop_break(&gameboy->cpu);
+	
+	gameboy->timer.counter = state->timer_counter;
+	gameboy->serial.bits = state->serial_bits;
+	gameboy->serial.clock = state->serial_clock;
+	gameboy->serial.in = state->serial_in;
+	gameboy->screen.on = state->lcd_on;
+	gameboy->screen.next_cycle = state->lcd_next_cycle;
+	gameboy->screen.on_cycle = state->lcd_on_cycle;
+	gameboy->screen.DMA_from = state->lcd_DMA_from;
+	gameboy->screen.DMA_to = state->lcd_DMA_to;
+	gameboy->screen.window_y = state->lcd_window_y;
+	gameboy->pad.intern = state->pad_intern;
+	gameboy->pad.old_state = state->pad_old_state;
+	memcpy(gameboy->pad.keys_state, state->pad_keys_state, sizeof(gameboy->pad.keys_state));
+	gameboy->cycles = state->cycles;
+	gameboy->frames = state->frames;
+	
+	// every page may differ from the last hashed ones
+	if(gameboy->hash != NULL) {
+		memset(gameboy->hash->dirty, TRUE, sizeof(gameboy->hash->dirty));
+	}
+}
+
+int gameboy_load_state(gameboy_t* gameboy, const gameboy_state_t* state) {
+	M_REQUIRE_NON_NULL(gameboy);
+	M_REQUIRE_NON_NULL(state);
+	
+	// the boot ROM mapping first, the memory is then written through the bus
+	if(state->boot && !gameboy->boot) {
+		M_EXIT_IF_ERR(bootrom_plug(&gameboy->bootrom, gameboy->bus));
+	} else if(!state->boot && gameboy->boot) {
+		M_EXIT_IF_ERR(bus_unplug(gameboy->bus, &gameboy->bootrom));
+		M_EXIT_IF_ERR(cartridge_plug(&gameboy->cartridge, gameboy->bus));
+	}
+	gameboy->boot = state->boot;
+	#ifdef PROFILER
+		profiler_set_boot(&gameboy->profiler, gameboy->boot);
+	#endif
+	
+	for(size_t i = 0; i < GB_STATE_MEMORY_SIZE; ++i) {
+		const addr_t addr = (addr_t) (VIDEO_RAM_START + i);
+		data_t* byte = gameboy->bus[addr];
+		if(gameboy_state_saves(addr) && byte != NULL) {
+			*byte = state->memory[i];
+		}
+	}
+	gameboy_load_registers(gameboy, state);
+	return ERR_NONE;
+}
+
+/**
+ * @brief builds the image of the post-boot state, from the power-on state
+ *        (see bootrom_skip()), and restores it
+ */
+static int gameboy_boot(gameboy_t* gameboy) {
+	M_EXIT_IF_ERR(gameboy_reset(gameboy, GB_RESET_POWER_ON));
+	M_EXIT_IF_ERR(bootrom_skip(gameboy));
+	M_EXIT_IF_ERR(gameboy_image_take(gameboy, &gameboy->images[GB_RESET_POST_BOOT]));
+	return gameboy_reset(gameboy, GB_RESET_POST_BOOT);
+}
+
+int gameboy_reset(gameboy_t* gameboy, gb_reset_mode_t mode) {
+	M_REQUIRE_NON_NULL(gameboy);
+	M_REQUIRE(mode < GB_NB_RESET_MODES, ERR_BAD_PARAMETER, "mode %d", mode);
+	
+	const gameboy_image_t* image = gameboy->images[mode];
+	if(image == NULL) {
+		M_REQUIRE(mode == GB_RESET_POST_BOOT, ERR_BAD_PARAMETER, "%s", "gameboy not created");
+		return gameboy_boot(gameboy);
 	}
+	memcpy(gameboy->bus, image->boot_bus, sizeof(image->boot_bus));
+	gameboy->bootrom = image->bootrom;
+	gameboy->boot = image->state.boot;
+	#ifdef PROFILER
+		profiler_set_boot(&gameboy->profiler, gameboy->boot);
+	#endif
+	memcpy(gameboy->arena.base, image->arena, gameboy->arena.used);
+	gameboy_load_registers(gameboy, &image->state);
+	// the serial output not drained yet is dropped
+	atomic_store(&gameboy->serial.out.head, INIT_VALUE);
+	atomic_store(&gameboy->serial.out.tail, INIT_VALUE);
+	atomic_store(&gameboy->serial.out.lost, INIT_VALUE);
 	return ERR_NONE;
 }
@@ -8,16 +8,26 @@
  * @date 2019
  */
 
+#include <signal.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 
+#include "arena.h"
 #include "bus.h"
 #include "component.h"
 #include "cpu.h"
 #include "cartridge.h"
 #include "timer.h"
+#include "serial.h"
 #include "lcdc.h"
 #include "joypad.h"
+#include "io.h"
+#include "watch.h"
+#include "recorder.h"
+#include "movie.h"
+#include "state-hash.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -25,24 +35,88 @@ extern "C" {
 
 #define GB_NB_COMPONENTS 6
 
+/*
+ * Fast paths of gameboy_run_until() and gameboy_run_frame() (to be or-ed):
+ * they must not change the emulated behavior, only its speed (see gbdiff.c
+ * to check it)
+ */
+#define GB_FAST_HALT      0x1   // apply the cycles of a halted CPU in bulk
+#define GB_FAST_IDLE_LOOP 0x2   // apply the iterations of an idle loop in bulk
+#define GB_FAST_FUSION    0x4   // run hot sequences of instructions as one (see cpu-fusion.h), opt-in
+#define GB_FAST_ALL       (GB_FAST_HALT | GB_FAST_IDLE_LOOP)  // enabled by default
+
+/*
+ * lcdc_init() (provided library) finds the CPU and the screen at fixed
+ * offsets of the gameboy: the CPU is kept in a block of fixed size right
+ * after the bus, directly followed by the screen.
+ */
+#define GB_CPU_OFFSET 0x80000
+#define GB_CPU_BLOCK_SIZE 0xE0
+
+/**
+ * @brief States restored by gameboy_reset()
+ */
+typedef enum {
+	GB_RESET_POWER_ON,      // as created: the boot ROM about to start
+	GB_RESET_POST_BOOT,     // the boot ROM just unmapped, the cartridge about to start
+	GB_NB_RESET_MODES
+} gb_reset_mode_t;
+
 /**
  * @brief Game Boy data structure.
  *        Regroups everything needed to simulate the Game Boy.
  */
 typedef struct gameboy_{ // maybe ALL the components are pointers ?
 	bus_t bus;
-	cpu_t cpu;
+	union {
+		cpu_t cpu;
+		uint8_t cpu_block[GB_CPU_BLOCK_SIZE];
+	};
+	lcdc_t screen;
+	joypad_t pad;
 	uint64_t cycles;
 	gbtimer_t timer;	
+	serial_t serial;
+	FILE* serial_echo;      // gets the serial output at the end of each run (stdout with -DBLARGG), NULL to let the host drain it
 	cartridge_t cartridge;	
 	component_t components[GB_NB_COMPONENTS];
 	int nb_components;
 	component_t bootrom;
 	bit_t boot;
-	lcdc_t screen;
-	joypad_t pad;
+	uint64_t frames;
+	io_table_t io;
+	trace_t trace;
+	watch_table_t watch;
+	recorder_t* recorder;   // NULL when not recording
+	movie_t* movie;         // NULL when the inputs are neither recorded nor played
+	state_hash_t* hash;     // NULL when the state is not hashed
+	uint8_t fast_paths;     // GB_FAST_* enabled (GB_FAST_ALL by default)
+	arena_t arena;          // memories of the components, the CPU, the boot ROM and the cartridge
+	struct gameboy_image_* images[GB_NB_RESET_MODES];  // restored by gameboy_reset(), NULL until taken
+#ifdef PROFILER
+	profiler_t profiler;
+#endif
 } gameboy_t;
 
+_Static_assert(sizeof(cpu_t) <= GB_CPU_BLOCK_SIZE, "cpu_t does not fit in its block");
+_Static_assert(offsetof(gameboy_t, cpu) == GB_CPU_OFFSET
+			   && offsetof(gameboy_t, screen) == GB_CPU_OFFSET + GB_CPU_BLOCK_SIZE,
+			   "gameboy_t layout does not match lcdc_init()");
+
+/**
+ * @brief Parts of the emulation, as seen by a sampling profiler (see gbbench.c)
+ */
+typedef enum {
+	GB_PHASE_NONE, GB_PHASE_CPU, GB_PHASE_TIMER, GB_PHASE_LCD, GB_PHASE_BUS,
+	GB_PHASE_RENDER, GB_NB_PHASES
+} gb_phase_t;
+
+/**
+ * @brief Part of the emulation the calling thread is running (a gb_phase_t),
+ *        may be read from a signal handler
+ */
+extern _Thread_local volatile sig_atomic_t gb_phase;
+
 // Number of Game Boy cycles per second (= 2^20)
 #define GB_CYCLES_PER_S  (((uint64_t) 1) << 20)
 
@@ -61,10 +135,109 @@ int gameboy_create(gameboy_t* gameboy, const char* filename);
 void gameboy_free(gameboy_t* gameboy);
 
 /**
- * @brief Runs a gamefor for/until a given cycle
+ * @brief Runs a gamefor for/until a given cycle (applying the events of
+ *        the movie played, if any, at their cycles)
  */
 int gameboy_run_until(gameboy_t* gameboy, uint64_t cycle);
 
+/**
+ * @brief Runs a game until the next VBLANK starts (the frame is then
+ *        complete in screen.display), or at most until a given cycle
+ *
+ * @param gameboy pointer to gameboy to run
+ * @param cycle cycle not to go beyond
+ * @return error code
+ */
+int gameboy_run_frame(gameboy_t* gameboy, uint64_t cycle);
+
+/**
+ * @brief Starts tracing the instructions executed by the CPU (see trace.h);
+ *        the trace is stopped by gameboy_free()
+ *
+ * @param gameboy pointer to gameboy to trace
+ * @param filename file to write the trace to, NULL to only keep the last
+ *        records in memory (see trace_save())
+ * @param nb_records size of the ring buffer, in records
+ * @return error code
+ */
+int gameboy_trace_start(gameboy_t* gameboy, const char* filename, size_t nb_records);
+
+/**
+ * @brief Stops tracing, writing the records left to the trace file
+ *
+ * @param gameboy pointer to traced gameboy
+ * @return error code
+ */
+int gameboy_trace_stop(gameboy_t* gameboy);
+
+/**
+ * @brief Starts recording every frame displayed (see recorder.h); the
+ *        recording is stopped by gameboy_free()
+ *
+ * @param gameboy pointer to gameboy to record
+ * @param filename file to write the recording to
+ * @param keyframe_interval number of frames between two keyframes
+ * @return error code
+ */
+int gameboy_record_start(gameboy_t* gameboy, const char* filename, uint32_t keyframe_interval);
+
+/**
+ * @brief Stops recording, writing the frames left and the seek index
+ *
+ * @param gameboy pointer to recorded gameboy
+ * @return error code
+ */
+int gameboy_record_stop(gameboy_t* gameboy);
+
+/**
+ * @brief Presses or releases a key at the current cycle (recording it in
+ *        the movie recorded, if any)
+ *
+ * @param gameboy pointer to gameboy
+ * @param key key pressed or released
+ * @param pressed whether the key is pressed
+ * @return error code
+ */
+int gameboy_key(gameboy_t* gameboy, gb_key_t key, bit_t pressed);
+
+/**
+ * @brief Starts recording the key events into a movie, or playing one back
+ *        (see movie.h); the movie is stopped by gameboy_free()
+ *
+ * @param gameboy pointer to gameboy
+ * @param filename movie file
+ * @param mode MOVIE_RECORD or MOVIE_PLAY
+ * @return error code
+ */
+int gameboy_movie_start(gameboy_t* gameboy, const char* filename, movie_mode_t mode);
+
+/**
+ * @brief Stops recording or playing the movie
+ *
+ * @param gameboy pointer to gameboy
+ * @return error code
+ */
+int gameboy_movie_stop(gameboy_t* gameboy);
+
+/**
+ * @brief Starts hashing the state of the gameboy at every VBLANK (see
+ *        state-hash.h, the last hash is in hash->last); the hashing is
+ *        stopped by gameboy_free()
+ *
+ * @param gameboy pointer to gameboy to hash
+ * @param filename file to write the hashes to, NULL for none
+ * @return error code
+ */
+int gameboy_hash_start(gameboy_t* gameboy, const char* filename);
+
+/**
+ * @brief Stops hashing the state
+ *
+ * @param gameboy pointer to hashed gameboy
+ * @return error code
+ */
+int gameboy_hash_stop(gameboy_t* gameboy);
+
 /**
  * @brief Adresses of the GameBoy
  *
@@ -104,6 +277,75 @@ int gameboy_run_until(gameboy_t* gameboy, uint64_t cycle);
 #define REGS_LCDC_END   0xFF4C
 #define REG_BOOT_ROM_DISABLE  0xFF50
 
+#define GB_STATE_MEMORY_SIZE (BUS_SIZE - VIDEO_RAM_START)
+
+/**
+ * @brief Snapshot of the emulated state of a gameboy (see
+ *        gameboy_save_state()): the writable memories (video RAM to IE,
+ *        the echo RAM aside), the CPU registers, the timer, the serial
+ *        transfer in progress, the LCD controller registers, the joypad,
+ *        the boot ROM mapping and the counters. The pixels shown
+ *        (screen.display), the serial output not drained yet, the trace,
+ *        recorder, movie and state hash are not part of it.
+ */
+typedef struct {
+	data_t memory[GB_STATE_MEMORY_SIZE];
+	cpu_t cpu;
+	uint16_t timer_counter;
+	uint8_t serial_bits;
+	uint8_t serial_clock;
+	data_t serial_in;
+	bit_t lcd_on;
+	uint64_t lcd_next_cycle;
+	uint64_t lcd_on_cycle;
+	addr_t lcd_DMA_from;
+	addr_t lcd_DMA_to;
+	data_t lcd_window_y;
+	data_t pad_intern;
+	uint8_t pad_old_state;
+	uint8_t pad_keys_state[NB_GB_KEY_ROWS];
+	bit_t boot;
+	uint64_t cycles;
+	uint64_t frames;
+} gameboy_state_t;
+
+/**
+ * @brief Saves the emulated state of a gameboy
+ *
+ * @param gameboy pointer to gameboy to save
+ * @param state (output) snapshot of its state
+ * @return error code
+ */
+int gameboy_save_state(const gameboy_t* gameboy, gameboy_state_t* state);
+
+/**
+ * @brief Restores a state saved by gameboy_save_state() from a gameboy of
+ *        the same cartridge (the pixels shown are those of the current
+ *        state until the next frame is drawn)
+ *
+ * @param gameboy pointer to gameboy to restore
+ * @param state snapshot to restore
+ * @return error code
+ */
+int gameboy_load_state(gameboy_t* gameboy, const gameboy_state_t* state);
+
+/**
+ * @brief Restores the power-on or the post-boot state of a gameboy in
+ *        place: a copy of its arena (every memory, the cartridge included)
+ *        and of its registers, taken when it was created, respectively
+ *        built the first time it is reset to its post-boot state (without
+ *        running the boot ROM, see bootrom_skip()). What is attached to it
+ *        (trace, watchpoints, recorder, movie, state hash, fast paths,
+ *        coverage bitmap) is kept, the serial output not drained yet is
+ *        dropped, and the pixels shown are those of the current state until
+ *        the next frame is drawn.
+ *
+ * @param gameboy pointer to gameboy to reset
+ * @param mode state to restore
+ * @return error code
+ */
+int gameboy_reset(gameboy_t* gameboy, gb_reset_mode_t mode);
+
 
 #ifdef __cplusplus
 }
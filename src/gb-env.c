@@ -0,0 +1,499 @@
+/**
+ * @file gb-env.c
+ * @brief Vectorized environment: steps many gameboys of the same cartridge
+ *        per call, across a pool of threads, for agent training
+ *
+ * @date 2020
+ */
+
+#include "gb-env.h"
+#include "error.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define INIT_VALUE 0
+#define TRUE 1
+#define FALSE 0
+
+// ---------------------------------------------------------------------
+/**
+ * @brief Writes the last frame shown by a gameboy as an observation
+ */
+static int gb_env_capture(const gb_env_t* env, const gameboy_t* gb, uint8_t* obs) {
+	if(env->obs == GB_OBS_FULL) {
+		for(size_t y = 0; y < LCD_HEIGHT; ++y) {
+			M_EXIT_IF_ERR(image_get_line_pixels(obs + y * LCD_WIDTH, &gb->screen.display, y));
+		}
+		return ERR_NONE;
+	}
+
+	uint8_t line[LCD_WIDTH];
+	for(size_t y = 0; y < LCD_HEIGHT; y += 2) {
+		M_EXIT_IF_ERR(image_get_line_pixels(line, &gb->screen.display, y));
+		uint8_t* out = obs + (y / 2) * (LCD_WIDTH / 2);
+		for(size_t x = 0; x < LCD_WIDTH / 2; ++x) {
+			out[x] = line[2 * x];
+		}
+	}
+	return ERR_NONE;
+}
+
+// ---------------------------------------------------------------------
+/**
+ * @brief Puts a gameboy back in the start state (its group with it)
+ */
+static int gb_env_restart(gb_env_t* env, size_t index) {
+	M_EXIT_IF_ERR(gameboy_load_state(&env->gameboys[index], env->start));
+	env->keys[index] = env->start_keys;
+	env->episode_frames[index] = INIT_VALUE;
+	env->fresh[index] = TRUE;
+	memcpy(env->last_obs + index * env->obs_size, env->start_obs, env->obs_size);
+	return ERR_NONE;
+}
+
+// ---------------------------------------------------------------------
+/**
+ * @brief Steps one gameboy (see gb_env_step())
+ */
+static int gb_env_run(gb_env_t* env, size_t index, uint8_t action, uint32_t nb_frames,
+					  uint8_t* obs, gb_env_info_t* info) {
+	gameboy_t* gb = &env->gameboys[index];
+	const uint8_t changed = action ^ env->keys[index];
+	for(int key = 0; key < NB_GB_KEYS; ++key) {
+		if(changed & (1 << key)) {
+			M_EXIT_IF_ERR(gameboy_key(gb, (gb_key_t) key, (action >> key) & 1));
+		}
+	}
+	env->keys[index] = action;
+
+	env->fresh[index] = FALSE;
+	uint8_t* last_obs = env->last_obs + index * env->obs_size;
+	int done = FALSE;
+	for(uint32_t f = 0; f < nb_frames && !done; ++f) {
+		const uint64_t frames = gb->frames;
+		M_EXIT_IF_ERR(gameboy_run_frame(gb, gb->cycles + FRAME_TOTAL_CYCLES));
+		if(gb->frames != frames) {
+			M_EXIT_IF_ERR(gb_env_capture(env, gb, last_obs));
+		}
+		++env->episode_frames[index];
+		done = env->max_episode_frames != 0 && env->episode_frames[index] >= env->max_episode_frames;
+	}
+	if(done) {
+		M_EXIT_IF_ERR(gb_env_restart(env, index));
+	}
+	if(env->lockstep) {
+		// (see gb_env_merge_converged())
+		M_EXIT_IF_ERR(state_hash_frame(gb->hash, gb));
+	}
+	if(obs != NULL) {
+		memcpy(obs, last_obs, env->obs_size);
+	}
+	if(info != NULL) {
+		info->episode_frames = env->episode_frames[index];
+		info->cycles = gb->cycles;
+		info->done = done;
+	}
+	return ERR_NONE;
+}
+
+// ---------------------------------------------------------------------
+/**
+ * @brief Copies the state of its leader to a gameboy, which leaves the
+ *        group to lead its own
+ */
+static int gb_env_materialize(gb_env_t* env, size_t index) {
+	const size_t leader = env->leader[index];
+	if(leader == index) {
+		return ERR_NONE;
+	}
+	M_EXIT_IF_ERR(gameboy_save_state(&env->gameboys[leader], env->transfer));
+	M_EXIT_IF_ERR(gameboy_load_state(&env->gameboys[index], env->transfer));
+	env->keys[index] = env->keys[leader];
+	env->episode_frames[index] = env->episode_frames[leader];
+	env->fresh[index] = env->fresh[leader];
+	memcpy(env->last_obs + index * env->obs_size, env->last_obs + leader * env->obs_size, env->obs_size);
+	env->leader[index] = index;
+	return ERR_NONE;
+}
+
+// ---------------------------------------------------------------------
+/**
+ * @brief Takes a gameboy out of its group, which is handed over to its
+ *        next gameboy when it is the leader
+ */
+static int gb_env_detach(gb_env_t* env, size_t index) {
+	if(env->leader[index] != index) {
+		env->leader[index] = index;
+		return ERR_NONE;
+	}
+	size_t next = index + 1;
+	while(next < env->nb_envs && env->leader[next] != index) {
+		++next;
+	}
+	if(next == env->nb_envs) {
+		return ERR_NONE;
+	}
+	M_EXIT_IF_ERR(gb_env_materialize(env, next));
+	for(size_t i = next + 1; i < env->nb_envs; ++i) {
+		if(env->leader[i] == index) {
+			env->leader[i] = next;
+		}
+	}
+	return ERR_NONE;
+}
+
+// ---------------------------------------------------------------------
+/**
+ * @brief Gathers the gameboys in the start state into one group
+ */
+static void gb_env_merge_fresh(gb_env_t* env) {
+	if(!env->lockstep) {
+		return;
+	}
+	size_t first = env->nb_envs;
+	for(size_t i = 0; i < env->nb_envs; ++i) {
+		if(!env->fresh[i]) {
+			continue;
+		}
+		if(first == env->nb_envs && env->leader[i] == i) {
+			first = i;
+		} else if(first != env->nb_envs) {
+			env->leader[i] = first;
+		}
+	}
+}
+
+// ---------------------------------------------------------------------
+/**
+ * @brief Tells whether two leaders run in the current step ended it in the
+ *        same state, and would run the same from now on
+ */
+static int gb_env_same_state(const gb_env_t* env, size_t a, size_t b) {
+	const gameboy_t* gb_a = &env->gameboys[a];
+	const gameboy_t* gb_b = &env->gameboys[b];
+	// (the hashes first, then the states as hashed, as hashes may collide;
+	// a CPU which ran instructions ahead is not in the state hashed)
+	return gb_a->hash->last == gb_b->hash->last
+		   && gb_a->cpu.fused_time == 0 && gb_b->cpu.fused_time == 0
+		   && env->keys[a] == env->keys[b]
+		   && env->episode_frames[a] == env->episode_frames[b]
+		   && env->fresh[a] == env->fresh[b]
+		   && !memcmp(env->last_obs + a * env->obs_size, env->last_obs + b * env->obs_size, env->obs_size)
+		   && state_hash_same(gb_a, gb_b);
+}
+
+// ---------------------------------------------------------------------
+/**
+ * @brief Gathers the groups whose leaders ended the current step in the
+ *        same state into one, that of the first leader: gameboys split by
+ *        different actions run together again once their states converge
+ *        (the game ignored the keys, or reached the same state through
+ *        them)
+ */
+static void gb_env_merge_converged(gb_env_t* env) {
+	if(!env->lockstep) {
+		return;
+	}
+	for(size_t i = 1; i < env->step.nb_leaders; ++i) {
+		const size_t b = env->order[i];
+		for(size_t j = 0; j < i; ++j) {
+			const size_t a = env->order[j];
+			if(env->leader[a] != a || !gb_env_same_state(env, a, b)) {
+				continue;
+			}
+			for(size_t k = b; k < env->nb_envs; ++k) {
+				if(env->leader[k] == b) {
+					env->leader[k] = a;
+				}
+			}
+			break;
+		}
+	}
+}
+
+// ---------------------------------------------------------------------
+/**
+ * @brief Tells whether two gameboys are given the same action by a step of
+ *        the first n (those not stepped all are)
+ */
+static int gb_env_same_action(const uint8_t* actions, size_t n, size_t a, size_t b) {
+	return (a < n) == (b < n) && (a >= n || actions[a] == actions[b]);
+}
+
+// ---------------------------------------------------------------------
+/**
+ * @brief Splits the groups for a step: a gameboy given another action
+ *        than its leader follows the first gameboy of its group given the
+ *        same action, or leaves the group
+ */
+static int gb_env_regroup(gb_env_t* env, size_t n, const uint8_t* actions) {
+	memcpy(env->origin, env->leader, env->nb_envs * sizeof(size_t));
+	for(size_t i = 0; i < env->nb_envs; ++i) {
+		const size_t leader = env->origin[i];
+		if(leader == i || (env->lockstep && gb_env_same_action(actions, n, i, leader))) {
+			continue;
+		}
+		size_t next = i;
+		for(size_t j = leader + 1; env->lockstep && j < i; ++j) {
+			if(env->origin[j] == leader && env->leader[j] == j && gb_env_same_action(actions, n, i, j)) {
+				next = j;
+				break;
+			}
+		}
+		if(next != i) {
+			env->leader[i] = next;
+		} else {
+			M_EXIT_IF_ERR(gb_env_materialize(env, i));
+		}
+	}
+	return ERR_NONE;
+}
+
+// ---------------------------------------------------------------------
+/**
+ * @brief Runs the gameboys of the current step not taken yet (with the
+ *        lock held, released while running), keeping the first error of
+ *        the step in step.err
+ */
+static void gb_env_work(gb_env_t* env) {
+	while(env->next < env->step.nb_leaders) {
+		const size_t i = env->order[env->next++];
+		pthread_mutex_unlock(&env->lock);
+
+		uint8_t* obs = env->step.obs == NULL ? NULL : env->step.obs + i * env->obs_size;
+		gb_env_info_t* info = env->step.info == NULL ? NULL : &env->step.info[i];
+		const int run_err = gb_env_run(env, i, env->step.actions[i], env->step.nb_frames, obs, info);
+		if(info != NULL) {
+			info->err = run_err;
+		}
+
+		pthread_mutex_lock(&env->lock);
+		if(env->step.err == ERR_NONE) {
+			env->step.err = run_err;
+		}
+		if(++env->nb_done == env->step.nb_leaders) {
+			pthread_cond_broadcast(&env->idle);
+		}
+	}
+}
+
+// ---------------------------------------------------------------------
+static void* gb_env_worker(void* arg) {
+	gb_env_t* env = arg;
+	pthread_mutex_lock(&env->lock);
+	uint64_t generation = env->generation;
+	for(;;) {
+		while(!env->stop && env->generation == generation) {
+			pthread_cond_wait(&env->work, &env->lock);
+		}
+		if(env->stop) {
+			pthread_mutex_unlock(&env->lock);
+			return NULL;
+		}
+		generation = env->generation;
+		gb_env_work(env);
+	}
+}
+
+// ======================================================================
+int gb_env_create(gb_env_t* env, const char* filename, size_t nb_envs, gb_obs_t obs, size_t nb_threads) {
+	M_REQUIRE_NON_NULL(env);
+	M_REQUIRE_NON_NULL(filename);
+	M_REQUIRE(nb_envs > 0, ERR_BAD_PARAMETER, "%s", "no gameboy");
+	M_REQUIRE(obs == GB_OBS_FULL || obs == GB_OBS_HALF, ERR_BAD_PARAMETER, "observation %d", obs);
+
+	memset(env, 0, sizeof(*env));
+	env->obs = obs;
+	env->obs_size = gb_env_obs_size(obs);
+	env->gameboys = calloc(nb_envs, sizeof(gameboy_t));
+	env->start = malloc(sizeof(gameboy_state_t));
+	env->start_obs = calloc(1, env->obs_size);
+	env->last_obs = calloc(nb_envs, env->obs_size);
+	env->keys = calloc(nb_envs, sizeof(uint8_t));
+	env->episode_frames = calloc(nb_envs, sizeof(uint64_t));
+	env->lockstep = TRUE;
+	env->leader = calloc(nb_envs, sizeof(size_t));
+	env->origin = calloc(nb_envs, sizeof(size_t));
+	env->fresh = calloc(nb_envs, sizeof(uint8_t));
+	env->order = calloc(nb_envs, sizeof(size_t));
+	env->transfer = malloc(sizeof(gameboy_state_t));
+	if(env->gameboys == NULL || env->start == NULL || env->start_obs == NULL || env->last_obs == NULL
+	   || env->keys == NULL || env->episode_frames == NULL || env->leader == NULL
+	   || env->origin == NULL || env->fresh == NULL || env->order == NULL || env->transfer == NULL) {
+		gb_env_free(env);
+		return ERR_MEM;
+	}
+
+	int err = ERR_NONE;
+	for(size_t i = 0; i < nb_envs && err == ERR_NONE; ++i) {
+		err = gameboy_create(&env->gameboys[i], filename);
+		// a gameboy partly created is freed too
+		++env->nb_envs;
+		if(err == ERR_NONE) {
+			// the serial output of the ROM is not echoed (on stdout with -DBLARGG)
+			env->gameboys[i].serial_echo = NULL;
+			err = gameboy_hash_start(&env->gameboys[i], NULL);
+		}
+	}
+	if(err == ERR_NONE) {
+		err = gb_env_set_start(env, 0);
+	}
+	if(err != ERR_NONE) {
+		gb_env_free(env);
+		return err;
+	}
+
+	if(nb_threads == 0) {
+		const long nb_cores = sysconf(_SC_NPROCESSORS_ONLN);
+		nb_threads = nb_cores > 0 ? (size_t) nb_cores : 1;
+	}
+	if(nb_threads > nb_envs) {
+		nb_threads = nb_envs;
+	}
+	pthread_mutex_init(&env->lock, NULL);
+	pthread_cond_init(&env->work, NULL);
+	pthread_cond_init(&env->idle, NULL);
+	// the thread calling gb_env_step() is one of them
+	env->threads = calloc(nb_threads, sizeof(pthread_t));
+	while(env->threads != NULL && env->nb_threads + 1 < nb_threads
+		  && pthread_create(&env->threads[env->nb_threads], NULL, gb_env_worker, env) == 0) {
+		++env->nb_threads;
+	}
+	return ERR_NONE;
+}
+
+// ======================================================================
+int gb_env_step(gb_env_t* env, size_t n, const uint8_t* actions, uint32_t nb_frames,
+				uint8_t* obs_out, gb_env_info_t* info_out) {
+	M_REQUIRE_NON_NULL(env);
+	M_REQUIRE_NON_NULL(actions);
+	M_REQUIRE(n <= env->nb_envs, ERR_BAD_PARAMETER, "%zu gameboys out of %zu", n, env->nb_envs);
+
+	M_EXIT_IF_ERR(gb_env_regroup(env, n, actions));
+	size_t nb_leaders = INIT_VALUE;
+	for(size_t i = 0; i < n; ++i) {
+		if(env->leader[i] == i) {
+			env->order[nb_leaders++] = i;
+		}
+	}
+
+	pthread_mutex_lock(&env->lock);
+	env->step.n = n;
+	env->step.nb_leaders = nb_leaders;
+	env->step.actions = actions;
+	env->step.nb_frames = nb_frames;
+	env->step.obs = obs_out;
+	env->step.info = info_out;
+	env->step.err = ERR_NONE;
+	env->next = INIT_VALUE;
+	env->nb_done = INIT_VALUE;
+	++env->generation;
+	pthread_cond_broadcast(&env->work);
+
+	gb_env_work(env);
+	while(env->nb_done < nb_leaders) {
+		pthread_cond_wait(&env->idle, &env->lock);
+	}
+	const int err = env->step.err;
+	pthread_mutex_unlock(&env->lock);
+
+	// the other gameboys of the groups share the results of their leader
+	for(size_t i = 0; i < n; ++i) {
+		const size_t leader = env->leader[i];
+		if(leader == i) {
+			continue;
+		}
+		env->keys[i] = env->keys[leader];
+		env->episode_frames[i] = env->episode_frames[leader];
+		env->fresh[i] = env->fresh[leader];
+		memcpy(env->last_obs + i * env->obs_size, env->last_obs + leader * env->obs_size, env->obs_size);
+		if(obs_out != NULL) {
+			memcpy(obs_out + i * env->obs_size, obs_out + leader * env->obs_size, env->obs_size);
+		}
+		if(info_out != NULL) {
+			info_out[i] = info_out[leader];
+		}
+	}
+	if(err == ERR_NONE) {
+		// (the state hash of a gameboy which failed is not up to date)
+		gb_env_merge_converged(env);
+	}
+	gb_env_merge_fresh(env);
+	return err;
+}
+
+// ======================================================================
+int gb_env_set_start(gb_env_t* env, size_t index) {
+	M_REQUIRE_NON_NULL(env);
+	M_REQUIRE(index < env->nb_envs, ERR_BAD_PARAMETER, "gameboy %zu out of %zu", index, env->nb_envs);
+	const size_t leader = env->leader[index];
+	M_EXIT_IF_ERR(gameboy_save_state(&env->gameboys[leader], env->start));
+	memcpy(env->start_obs, env->last_obs + leader * env->obs_size, env->obs_size);
+	env->start_keys = env->keys[leader];
+	for(size_t i = 0; i < env->nb_envs; ++i) {
+		env->fresh[i] = env->leader[i] == leader;
+		if(env->fresh[i]) {
+			memcpy(env->last_obs + i * env->obs_size, env->start_obs, env->obs_size);
+		}
+	}
+	return ERR_NONE;
+}
+
+// ======================================================================
+int gb_env_reset(gb_env_t* env, size_t index, uint8_t* obs_out) {
+	M_REQUIRE_NON_NULL(env);
+	M_REQUIRE(index < env->nb_envs, ERR_BAD_PARAMETER, "gameboy %zu out of %zu", index, env->nb_envs);
+	M_EXIT_IF_ERR(gb_env_detach(env, index));
+	M_EXIT_IF_ERR(gb_env_restart(env, index));
+	if(obs_out != NULL) {
+		memcpy(obs_out, env->start_obs, env->obs_size);
+	}
+	gb_env_merge_fresh(env);
+	return ERR_NONE;
+}
+
+// ======================================================================
+int gb_env_sync(gb_env_t* env) {
+	M_REQUIRE_NON_NULL(env);
+	for(size_t i = 0; i < env->nb_envs; ++i) {
+		M_EXIT_IF_ERR(gb_env_materialize(env, i));
+	}
+	return ERR_NONE;
+}
+
+// ======================================================================
+void gb_env_free(gb_env_t* env) {
+	if(env == NULL) {
+		return;
+	}
+	if(env->threads != NULL) {
+		pthread_mutex_lock(&env->lock);
+		env->stop = TRUE;
+		pthread_cond_broadcast(&env->work);
+		pthread_mutex_unlock(&env->lock);
+		for(size_t i = 0; i < env->nb_threads; ++i) {
+			pthread_join(env->threads[i], NULL);
+		}
+		free(env->threads);
+		pthread_mutex_destroy(&env->lock);
+		pthread_cond_destroy(&env->work);
+		pthread_cond_destroy(&env->idle);
+	}
+	for(size_t i = 0; i < env->nb_envs; ++i) {
+		gameboy_free(&env->gameboys[i]);
+	}
+	free(env->gameboys);
+	free(env->start);
+	free(env->start_obs);
+	free(env->last_obs);
+	free(env->keys);
+	free(env->episode_frames);
+	free(env->leader);
+	free(env->origin);
+	free(env->fresh);
+	free(env->order);
+	free(env->transfer);
+	memset(env, 0, sizeof(*env));
+}
@@ -0,0 +1,184 @@
+#pragma once
+
+/**
+ * @file gb-env.h
+ * @brief Vectorized environment: steps many gameboys of the same cartridge
+ *        per call, across a pool of threads, for agent training
+ *
+ * Each call of gb_env_step() applies one joypad state per gameboy, runs
+ * every gameboy the given number of frames and writes their observations
+ * (the last frame completed, at its VBLANK, as colors 0 to 3, full size or
+ * halved) into one contiguous array of the caller, without allocating.
+ *
+ * Every gameboy starts from a shared start state (see gb_env_set_start()),
+ * to which it is reset by gb_env_reset() or, when max_episode_frames is
+ * set, automatically at the end of each episode.
+ *
+ * Gameboys in the same state given the same action run the same
+ * instructions: they are run in lockstep, as one group whose leader (its
+ * first gameboy) alone is run, its results being copied to the others. A
+ * gameboy given another action than its leader leaves the group: the state
+ * of the leader is copied to it first (gameboy_load_state()), then it runs
+ * on its own, leading the gameboys of its old group given the same action.
+ * Gameboys reset to the start state join the same group again, as do
+ * groups whose states converge again (their state hashes, see
+ * state-hash.h, are compared after each step). Only the gameboy_t of
+ * leaders are up to date (see gb_env_sync()).
+ *
+ * The groups only save the work of gameboys in the same state: gameboys in
+ * different states are each run by the usual interpreter, the CPU of each
+ * one executing its own instruction through its own bus, there is no
+ * interpreter running several of them in parallel lanes (see gbenvbench.c).
+ *
+ * @date 2020
+ */
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gameboy.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Observations written by gb_env_step()
+ */
+typedef enum {
+	GB_OBS_FULL,    // LCD_WIDTH x LCD_HEIGHT
+	GB_OBS_HALF     // LCD_WIDTH/2 x LCD_HEIGHT/2 (top-left pixel of each 2x2 block)
+} gb_obs_t;
+
+/**
+ * @brief Information about one gameboy after a step
+ */
+typedef struct {
+	uint64_t episode_frames;    // frames since the last reset
+	uint64_t cycles;
+	int done;                   // the episode ended during the step (and was reset)
+	int err;                    // error code of the step
+} gb_env_info_t;
+
+/**
+ * @brief Type to represent a vector of environments
+ */
+typedef struct {
+	gameboy_t* gameboys;
+	size_t nb_envs;
+	gb_obs_t obs;
+	size_t obs_size;                // bytes of one observation
+	uint64_t max_episode_frames;    // 0 for no automatic reset
+	gameboy_state_t* start;         // state the gameboys are reset to
+	uint8_t* start_obs;             // observation of the start state
+	uint8_t* last_obs;              // per gameboy, observation of its last frame
+	uint8_t start_keys;             // keys pressed in the start state
+	uint8_t* keys;                  // keys pressed, one bit per gb_key_t, per gameboy
+	uint64_t* episode_frames;       // per gameboy
+
+	// lockstep groups
+	int lockstep;                   // 1 (default) to run groups, 0 to run every gameboy
+	size_t* leader;                 // per gameboy, leader of its group (not after it)
+	size_t* origin;                 // per gameboy, leader before the current step
+	uint8_t* fresh;                 // per gameboy, in the start state
+	size_t* order;                  // leaders to run in the current step
+	gameboy_state_t* transfer;      // state copied to a gameboy leaving its group
+
+	// pool: the threads work on the current step, numbered by generation
+	pthread_t* threads;
+	size_t nb_threads;
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	pthread_cond_t idle;
+	uint64_t generation;
+	size_t next;                    // next gameboy of the step to run
+	size_t nb_done;                 // gameboys of the step run
+	int stop;
+	struct {
+		size_t n;
+		size_t nb_leaders;
+		const uint8_t* actions;
+		uint32_t nb_frames;
+		uint8_t* obs;
+		gb_env_info_t* info;
+		int err;                    // first error of a gameboy of the step
+	} step;
+} gb_env_t;
+
+/**
+ * @brief Observation size, in bytes, for a kind of observation
+ */
+#define gb_env_obs_size(obs) \
+	((obs) == GB_OBS_HALF ? (LCD_WIDTH / 2) * (LCD_HEIGHT / 2) : LCD_WIDTH * LCD_HEIGHT)
+
+/**
+ * @brief Creates the gameboys and the thread pool; the start state is the
+ *        state of the gameboys once created, they are all in one group
+ *
+ * @param env environments to create
+ * @param filename cartridge of every gameboy
+ * @param nb_envs number of gameboys
+ * @param obs kind of observations
+ * @param nb_threads threads of the pool (0 for one per core)
+ * @return error code
+ */
+int gb_env_create(gb_env_t* env, const char* filename, size_t nb_envs, gb_obs_t obs, size_t nb_threads);
+
+/**
+ * @brief Steps the first n gameboys: sets their keys to actions[i] (bit k
+ *        for gb_key_t k), runs them nb_frames frames each (a frame lasts
+ *        at most FRAME_TOTAL_CYCLES cycles when the LCD is off) and writes
+ *        their observations, gb_env_info_t and obs_size bytes each
+ *
+ * @param env environments to step
+ * @param n number of gameboys to step
+ * @param actions keys pressed, n bytes
+ * @param nb_frames frames to run
+ * @param obs_out (output) observations, n * obs_size bytes (may be NULL)
+ * @param info_out (output) information, n of them (may be NULL)
+ * @return error code (the first error of a gameboy, whether or not
+ *         info_out is given)
+ */
+int gb_env_step(gb_env_t* env, size_t n, const uint8_t* actions, uint32_t nb_frames,
+				uint8_t* obs_out, gb_env_info_t* info_out);
+
+/**
+ * @brief Makes the current state of a gameboy the start state of all of
+ *        them (for instance after skipping the title screens)
+ *
+ * @param env environments
+ * @param index gameboy whose state to take
+ * @return error code
+ */
+int gb_env_set_start(gb_env_t* env, size_t index);
+
+/**
+ * @brief Resets a gameboy to the start state
+ *
+ * @param env environments
+ * @param index gameboy to reset
+ * @param obs_out (output) its observation, obs_size bytes (may be NULL)
+ * @return error code
+ */
+int gb_env_reset(gb_env_t* env, size_t index, uint8_t* obs_out);
+
+/**
+ * @brief Brings the gameboy_t of every gameboy up to date (copying the
+ *        state of their leader), to use them directly
+ *
+ * @param env environments
+ * @return error code
+ */
+int gb_env_sync(gb_env_t* env);
+
+/**
+ * @brief Stops the thread pool and frees the gameboys
+ *
+ * @param env environments to free
+ */
+void gb_env_free(gb_env_t* env);
+
+#ifdef __cplusplus
+}
+#endif
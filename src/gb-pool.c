@@ -0,0 +1,115 @@
+/**
+ * @file gb-pool.c
+ * @brief Pool of gameboys of the same cartridge, created once, that jobs
+ *        check out and return, reset in place
+ *
+ * @date 2020
+ */
+
+#include "gb-pool.h"
+#include "error.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// ---------------------------------------------------------------------
+/**
+ * @brief Keeps the first of two error codes
+ */
+static int gb_pool_first_err(int err, int next) {
+	return err != ERR_NONE ? err : next;
+}
+
+// ======================================================================
+int gb_pool_create(gb_pool_t* pool, const char* filename, size_t nb_gameboys, gb_reset_mode_t mode) {
+	M_REQUIRE_NON_NULL(pool);
+	M_REQUIRE_NON_NULL(filename);
+	M_REQUIRE(nb_gameboys > 0, ERR_BAD_PARAMETER, "%s", "no gameboy");
+	M_REQUIRE(mode < GB_NB_RESET_MODES, ERR_BAD_PARAMETER, "mode %d", mode);
+
+	memset(pool, 0, sizeof(*pool));
+	pool->mode = mode;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->returned, NULL);
+	pool->gameboys = calloc(nb_gameboys, sizeof(gameboy_t));
+	pool->available = calloc(nb_gameboys, sizeof(size_t));
+	if(pool->gameboys == NULL || pool->available == NULL) {
+		gb_pool_free(pool);
+		return ERR_MEM;
+	}
+
+	int err = ERR_NONE;
+	for(size_t i = 0; i < nb_gameboys && err == ERR_NONE; ++i) {
+		err = gameboy_create(&pool->gameboys[i], filename);
+		// a gameboy partly created is freed too
+		++pool->nb_gameboys;
+		if(err == ERR_NONE && mode != GB_RESET_POWER_ON) {
+			err = gameboy_reset(&pool->gameboys[i], mode);
+		}
+	}
+	if(err != ERR_NONE) {
+		gb_pool_free(pool);
+		return err;
+	}
+	// the first gameboys are checked out first
+	for(size_t i = 0; i < nb_gameboys; ++i) {
+		pool->available[i] = nb_gameboys - 1 - i;
+	}
+	pool->nb_available = nb_gameboys;
+	return ERR_NONE;
+}
+
+// ======================================================================
+int gb_pool_acquire(gb_pool_t* pool, gameboy_t** gameboy) {
+	M_REQUIRE_NON_NULL(pool);
+	M_REQUIRE_NON_NULL(gameboy);
+
+	pthread_mutex_lock(&pool->lock);
+	while(pool->nb_available == 0) {
+		pthread_cond_wait(&pool->returned, &pool->lock);
+	}
+	*gameboy = &pool->gameboys[pool->available[--pool->nb_available]];
+	pthread_mutex_unlock(&pool->lock);
+	return ERR_NONE;
+}
+
+// ======================================================================
+int gb_pool_release(gb_pool_t* pool, gameboy_t* gameboy) {
+	M_REQUIRE_NON_NULL(pool);
+	M_REQUIRE_NON_NULL(gameboy);
+	M_REQUIRE(gameboy >= pool->gameboys && gameboy < pool->gameboys + pool->nb_gameboys,
+			  ERR_BAD_PARAMETER, "%s", "gameboy not of the pool");
+
+	// detached and reset by the thread returning it, the pool not locked,
+	// up to the end whatever fails
+	int err = gameboy_trace_stop(gameboy);
+	err = gb_pool_first_err(err, gameboy_record_stop(gameboy));
+	err = gb_pool_first_err(err, gameboy_movie_stop(gameboy));
+	err = gb_pool_first_err(err, gameboy_hash_stop(gameboy));
+	err = gb_pool_first_err(err, watch_init(&gameboy->watch));
+	err = gb_pool_first_err(err, gameboy_reset(gameboy, pool->mode));
+	gameboy->fast_paths = GB_FAST_ALL;
+	gameboy->cpu.fusion_counts = NULL;
+	gameboy->cpu.coverage = NULL;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->available[pool->nb_available++] = (size_t) (gameboy - pool->gameboys);
+	pthread_cond_signal(&pool->returned);
+	pthread_mutex_unlock(&pool->lock);
+	return err;
+}
+
+// ======================================================================
+void gb_pool_free(gb_pool_t* pool) {
+	if(pool == NULL) {
+		return;
+	}
+	for(size_t i = 0; i < pool->nb_gameboys; ++i) {
+		gameboy_free(&pool->gameboys[i]);
+	}
+	free(pool->gameboys);
+	free(pool->available);
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->returned);
+	memset(pool, 0, sizeof(*pool));
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+/**
+ * @file gb-pool.h
+ * @brief Pool of gameboys of the same cartridge, created once, that jobs
+ *        check out and return, reset in place (see gameboy_reset()) rather
+ *        than freed and created again
+ *
+ * A gameboy checked out is in the state of the pool (power-on or
+ * post-boot), with nothing attached to it. Once returned, its trace,
+ * recorder, movie and state hash are stopped, its watchpoints, fusion
+ * counters and coverage bitmap removed, its default fast paths set again and it is reset. The pool may be used from many
+ * threads at once.
+ *
+ * @date 2020
+ */
+
+#include <pthread.h>
+#include <stddef.h>
+
+#include "gameboy.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Type to represent a pool of gameboys
+ */
+typedef struct {
+	gameboy_t* gameboys;
+	size_t nb_gameboys;
+	gb_reset_mode_t mode;       // state of the gameboys checked out
+	size_t* available;          // indexes of the gameboys not checked out (a stack)
+	size_t nb_available;
+	pthread_mutex_t lock;
+	pthread_cond_t returned;
+} gb_pool_t;
+
+/**
+ * @brief Creates the gameboys of a pool, in the given state
+ *
+ * @param pool pool to create
+ * @param filename cartridge of every gameboy
+ * @param nb_gameboys number of gameboys
+ * @param mode state of the gameboys checked out
+ * @return error code
+ */
+int gb_pool_create(gb_pool_t* pool, const char* filename, size_t nb_gameboys, gb_reset_mode_t mode);
+
+/**
+ * @brief Checks a gameboy out of a pool, waiting for one to be returned if
+ *        they are all checked out
+ *
+ * @param pool pool to check out from
+ * @param gameboy (output) the gameboy checked out
+ * @return error code
+ */
+int gb_pool_acquire(gb_pool_t* pool, gameboy_t** gameboy);
+
+/**
+ * @brief Returns a gameboy to its pool, detaching everything from it and
+ *        resetting it
+ *
+ * @param pool pool the gameboy was checked out from
+ * @param gameboy gameboy to return
+ * @return error code (of its reset: the gameboy is returned anyway)
+ */
+int gb_pool_release(gb_pool_t* pool, gameboy_t* gameboy);
+
+/**
+ * @brief Frees the gameboys of a pool (none may be checked out)
+ *
+ * @param pool pool to free
+ */
+void gb_pool_free(gb_pool_t* pool);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,305 @@
+/**
+ * @file gbbench.c
+ * @brief Headless throughput benchmark of the Game Boy emulator
+ *
+ * Runs ROMs for fixed numbers of cycles, without any display, and prints
+ * one JSON document on stdout with, for each ROM: emulated MHz, frames/s,
+ * ns per guest instruction, allocations per frame and the split of the
+ * CPU time across CPU/timer/LCD/bus/render (sampled, see gb_phase), and
+ * how many times each superinstruction ran (see cpu-fusion.h).
+ *
+ * Usage: gbbench [--fusion] [ROM[:MCYCLES] ...]
+ *        (without ROM, the bundled games and Blargg ROMs are run)
+ *   --fusion   runs the superinstructions too (GB_FAST_FUSION, opt-in)
+ *
+ * @date 2020
+ */
+
+#include "error.h"
+#include "cpu-fusion.h"
+#include "gameboy.h"
+#include "image.h"
+#include "lcdc.h"
+#include "util.h"
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MILLION 1000000
+#define BILLION 1000000000
+#define SAMPLING_PERIOD_NS 1000000
+#define DEFAULT_MCYCLES 20
+
+#define BLARGG_DIR "../provided/tests/data/blargg_roms/"
+
+// default suite: ROM and millions of cycles (the Blargg ones are those of run_blargg.sh)
+static const char* const default_suite[] = {
+	"../data/tetris.gb:20",
+	"../data/flappyboy.gb:20",
+	BLARGG_DIR "01-special.gb:5",
+	BLARGG_DIR "02-interrupts.gb:5",
+	BLARGG_DIR "03-op sp,hl.gb:5",
+	BLARGG_DIR "04-op r,imm.gb:7",
+	BLARGG_DIR "05-op rp.gb:7",
+	BLARGG_DIR "06-ld r,r.gb:5",
+	BLARGG_DIR "07-jr,jp,call,ret,rst.gb:4",
+	BLARGG_DIR "08-misc instrs.gb:5",
+	BLARGG_DIR "09-op r,r.gb:15",
+	BLARGG_DIR "10-bit ops.gb:20",
+	BLARGG_DIR "11-op a,(hl).gb:25",
+	BLARGG_DIR "instr_timing.gb:5",
+};
+
+static const char* const phase_names[GB_NB_PHASES] = {
+	"other", "cpu", "timer", "lcd", "bus", "render"
+};
+
+static gameboy_t gb;
+static uint8_t frame[LCD_HEIGHT][LCD_WIDTH];
+
+static volatile sig_atomic_t samples[GB_NB_PHASES];
+static uint64_t nb_allocations;
+static uint64_t fusion_counts[CPU_NB_FUSIONS];
+
+// ======================================================================
+/*
+ * Allocation counting: gbbench is linked with -Wl,--wrap=malloc (etc.)
+ */
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t nmemb, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+void* __wrap_malloc(size_t size)
+{
+	++nb_allocations;
+	return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t nmemb, size_t size)
+{
+	++nb_allocations;
+	return __real_calloc(nmemb, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size)
+{
+	++nb_allocations;
+	return __real_realloc(ptr, size);
+}
+
+// ======================================================================
+static void sample(int sig _unused)
+{
+	const sig_atomic_t phase = gb_phase;
+	if(phase >= 0 && phase < GB_NB_PHASES) {
+		++samples[phase];
+	}
+}
+
+// ======================================================================
+static int start_sampling(timer_t* timer)
+{
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = sample;
+	action.sa_flags = SA_RESTART;
+	if(sigaction(SIGPROF, &action, NULL) != 0) {
+		return ERR_IO;
+	}
+
+	struct sigevent event;
+	memset(&event, 0, sizeof(event));
+	event.sigev_notify = SIGEV_SIGNAL;
+	event.sigev_signo = SIGPROF;
+	if(timer_create(CLOCK_PROCESS_CPUTIME_ID, &event, timer) != 0) {
+		return ERR_IO;
+	}
+
+	const struct itimerspec period = {
+		{ 0, SAMPLING_PERIOD_NS }, { 0, SAMPLING_PERIOD_NS }
+	};
+	return timer_settime(*timer, 0, &period, NULL) == 0 ? ERR_NONE : ERR_IO;
+}
+
+// ======================================================================
+static double now(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + (double) t.tv_nsec / BILLION;
+}
+
+// ======================================================================
+static int capture_frame(void)
+{
+	for(size_t y = 0; y < LCD_HEIGHT; y++) {
+		M_EXIT_IF_ERR(image_get_line_pixels(frame[y], &gb.screen.display, y));
+	}
+	return ERR_NONE;
+}
+
+// ======================================================================
+static void print_json_string(const char* s)
+{
+	putchar('"');
+	for(; *s != '\0'; ++s) {
+		if(*s == '"' || *s == '\\') {
+			putchar('\\');
+		}
+		putchar(*s);
+	}
+	putchar('"');
+}
+
+// ======================================================================
+/**
+ * @brief Runs one ROM for the given number of cycles and prints its results
+ *        as a JSON object (stdout, where Blargg ROMs write, is silenced
+ *        while the ROM runs)
+ */
+static int bench_rom(const char* rom, uint64_t nb_cycles, uint8_t fast_paths, int first)
+{
+	M_EXIT_IF_ERR(gameboy_create(&gb, rom));
+	gb.fast_paths = fast_paths;
+	memset(fusion_counts, 0, sizeof(fusion_counts));
+	gb.cpu.fusion_counts = fusion_counts;
+
+	fflush(stdout);
+	const int saved_stdout = dup(STDOUT_FILENO);
+	const int null = open("/dev/null", O_WRONLY);
+	if(saved_stdout < 0 || null < 0) {
+		gameboy_free(&gb);
+		return ERR_IO;
+	}
+	dup2(null, STDOUT_FILENO);
+	close(null);
+
+	for(int i = 0; i < GB_NB_PHASES; ++i) {
+		samples[i] = 0;
+	}
+	nb_allocations = 0;
+	const uint64_t first_cycle = gb.cycles;
+	const uint64_t end = first_cycle + nb_cycles;
+
+	int err = ERR_NONE;
+	const double start = now();
+	while(err == ERR_NONE && gb.cycles < end) {
+		const uint64_t frames = gb.frames;
+		err = gameboy_run_frame(&gb, end);
+		if(err == ERR_NONE && gb.frames != frames) {
+			gb_phase = GB_PHASE_RENDER;
+			err = capture_frame();
+			gb_phase = GB_PHASE_NONE;
+		}
+	}
+	const double seconds = now() - start;
+
+	fflush(stdout);
+	dup2(saved_stdout, STDOUT_FILENO);
+	close(saved_stdout);
+
+	const uint64_t cycles = gb.cycles - first_cycle;
+	const uint64_t frames = gb.frames;
+	const uint64_t instructions = gb.cpu.nb_instructions;
+	gameboy_free(&gb);
+	M_EXIT_IF_ERR(err);
+
+	uint64_t nb_samples = 0;
+	for(int i = 0; i < GB_NB_PHASES; ++i) {
+		nb_samples += (uint64_t) samples[i];
+	}
+
+	printf("%s\n    {\n      \"rom\": ", first ? "" : ",");
+	print_json_string(rom);
+	printf(",\n      \"cycles\": %" PRIu64 ",\n", cycles);
+	printf("      \"frames\": %" PRIu64 ",\n", frames);
+	printf("      \"instructions\": %" PRIu64 ",\n", instructions);
+	printf("      \"seconds\": %.6f,\n", seconds);
+	printf("      \"emulated_mhz\": %.3f,\n", cycles / seconds / MILLION);
+	printf("      \"frames_per_s\": %.2f,\n", frames / seconds);
+	printf("      \"ns_per_instruction\": %.3f,\n",
+		   instructions == 0 ? 0.0 : seconds * BILLION / instructions);
+	printf("      \"allocations\": %" PRIu64 ",\n", nb_allocations);
+	printf("      \"allocations_per_frame\": %.3f,\n",
+		   frames == 0 ? 0.0 : (double) nb_allocations / frames);
+	printf("      \"samples\": %" PRIu64 ",\n", nb_samples);
+	printf("      \"time_split\": {");
+	for(int i = 0; i < GB_NB_PHASES; ++i) {
+		printf("%s\"%s\": %.4f", i == 0 ? " " : ", ", phase_names[i],
+			   nb_samples == 0 ? 0.0 : (double) samples[i] / nb_samples);
+	}
+	printf(" },\n");
+	uint64_t nb_fused = 0;
+	printf("      \"fusions\": {");
+	for(int i = FUSION_NONE + 1; i < CPU_NB_FUSIONS; ++i) {
+		printf("%s\"%s\": %" PRIu64, i == FUSION_NONE + 1 ? " " : ", ", cpu_fusion_names[i],
+			   fusion_counts[i]);
+		nb_fused += fusion_counts[i] * cpu_fusion_lengths[i];
+	}
+	printf(" },\n");
+	printf("      \"fused_instructions\": %.4f\n    }",
+		   instructions == 0 ? 0.0 : (double) nb_fused / instructions);
+	return ERR_NONE;
+}
+
+// ======================================================================
+int main(int argc, char *argv[])
+{
+	uint8_t fast_paths = GB_FAST_ALL;
+	int arg = 1;
+	if(arg < argc && !strcmp(argv[arg], "--fusion")) {
+		fast_paths |= GB_FAST_FUSION;
+		++arg;
+	}
+	const char* const* suite = default_suite;
+	int nb_roms = sizeof(default_suite) / sizeof(default_suite[0]);
+	if(argc > arg) {
+		suite = (const char* const*) argv + arg;
+		nb_roms = argc - arg;
+	}
+
+	timer_t timer;
+	if(start_sampling(&timer) != ERR_NONE) {
+		fputs("gbbench: cannot start the sampling timer\n", stderr);
+		return 1;
+	}
+
+	int status = 0;
+	int first = 1;
+	printf("{\n  \"benchmark\": \"gbbench\",\n  \"cycles_per_s\": %" PRIu64 ",\n  \"fusion\": %s,"
+		   "\n  \"runs\": [", GB_CYCLES_PER_S, fast_paths & GB_FAST_FUSION ? "true" : "false");
+	for(int i = 0; i < nb_roms; ++i) {
+		// ROM[:MCYCLES] (ROM names may contain ':', only the last one counts)
+		char rom[FILENAME_MAX];
+		strncpy(rom, suite[i], sizeof(rom) - 1);
+		rom[sizeof(rom) - 1] = '\0';
+		uint64_t mcycles = DEFAULT_MCYCLES;
+		char* colon = strrchr(rom, ':');
+		if(colon != NULL) {
+			char* end = NULL;
+			const unsigned long long n = strtoull(colon + 1, &end, 10);
+			if(end != colon + 1 && *end == '\0') {
+				mcycles = n;
+				*colon = '\0';
+			}
+		}
+
+		const int err = bench_rom(rom, mcycles * MILLION, fast_paths, first);
+		if(err != ERR_NONE) {
+			fprintf(stderr, "gbbench: %s: %s\n", rom, ERR_MESSAGES[err - ERR_NONE]);
+			status = 1;
+		} else {
+			first = 0;
+		}
+	}
+	printf("\n  ]\n}\n");
+
+	timer_delete(timer);
+	return status;
+}
@@ -0,0 +1,431 @@
+/**
+ * @file gbblargg.c
+ * @brief In-process runner of the Blargg test ROMs: runs them concurrently,
+ *        one gameboy per ROM, and stops each one as soon as its verdict is
+ *        known, then prints a TAP (or JUnit) report
+ *
+ * A ROM is over as soon as it printed "Passed" on its serial port (whose
+ * output is collected each time the ROM starts a transfer), or
+ * "Failed" and the end of that line, or when it reported a result through
+ * the memory signature protocol of the newer Blargg ROMs (DE B0 61 at
+ * 0xA001 and a result other than 0x80 at 0xA000, 0 for a pass, the message
+ * at 0xA004). Otherwise it fails when its cycle limit is reached.
+ *
+ * Usage: gbblargg [options] [ROM|DIR ...]
+ *        (without ROM, every .gb of the Blargg ROM directory is run)
+ *   --jobs N       number of threads (default: number of cores)
+ *   --mcycles N    cycle limit of each ROM, in millions (default 60)
+ *   --junit FILE   also writes a JUnit XML report to FILE
+ *   --skip-boot    starts each ROM in the post-boot state (see bootrom_skip())
+ *
+ * Exit status: 0 when all the ROMs pass, 1 when some fail, 2 on error.
+ *
+ * @date 2020
+ */
+
+#include "error.h"
+#include "gameboy.h"
+#include "harness.h"
+
+#include <dirent.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define INIT_VALUE 0
+#define MILLION 1000000
+#define BILLION 1000000000
+#define DEFAULT_MCYCLES 60
+#define OUTPUT_SIZE 1024
+
+#define BLARGG_DIR "../provided/tests/data/blargg_roms"
+
+#define SIGNATURE_START 0xA000
+#define SIGNATURE_MESSAGE 0xA004
+#define SIGNATURE_RUNNING 0x80
+
+static const data_t signature[] = { 0xDE, 0xB0, 0x61 };
+
+/**
+ * @brief Verdict of one ROM
+ */
+typedef enum {
+	VERDICT_PENDING,
+	VERDICT_PASSED,
+	VERDICT_FAILED,
+	VERDICT_TIMEOUT,
+	VERDICT_ERROR
+} verdict_t;
+
+/**
+ * @brief One ROM to run, and its results
+ */
+typedef struct {
+	char path[FILENAME_MAX];
+	char output[OUTPUT_SIZE];   // serial output, or signature message
+	size_t length;
+	verdict_t verdict;
+	int err;
+	uint64_t cycles;
+	double seconds;
+} job_t;
+
+/**
+ * @brief ROMs run by the threads (see harness_run_jobs())
+ */
+typedef struct {
+	job_t* jobs;
+	size_t nb_jobs;
+	uint64_t nb_cycles;
+	int skip_boot;
+} suite_t;
+
+// ======================================================================
+static double now(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + (double) t.tv_nsec / BILLION;
+}
+
+// ======================================================================
+/**
+ * @brief Collects the serial output drained so far and looks for its verdict
+ */
+static void serial_collect(job_t* job, serial_buffer_t* buffer)
+{
+	data_t bytes[SERIAL_BUFFER_SIZE];
+	const size_t nb_bytes = serial_drain(buffer, bytes, sizeof(bytes));
+	for(size_t i = 0; i < nb_bytes && job->verdict == VERDICT_PENDING; ++i) {
+		if(job->length + 1 < OUTPUT_SIZE) {
+			job->output[job->length++] = (char) bytes[i];
+			job->output[job->length] = '\0';
+		}
+		if(strstr(job->output, "Passed") != NULL) {
+			job->verdict = VERDICT_PASSED;
+		} else {
+			const char* failed = strstr(job->output, "Failed");
+			if(failed != NULL && (bytes[i] == '\n' || job->length + 1 == OUTPUT_SIZE)) {
+				job->verdict = VERDICT_FAILED;
+			}
+		}
+	}
+}
+
+// ======================================================================
+/**
+ * @brief Stops the run when a transfer starts, its byte being then in the
+ *        output buffer of the serial port
+ */
+static watch_action_t serial_started(void* data, const cpu_t* cpu,
+									 watch_kind_t kind, addr_t addr, data_t value)
+{
+	(void) data; (void) cpu; (void) kind; (void) addr;
+	return bit_get(value, SC_TRANSFER) ? WATCH_BREAK : WATCH_CONTINUE;
+}
+
+// ======================================================================
+/**
+ * @brief Checks the memory signature protocol on the writes of its result
+ */
+static watch_action_t signature_written(void* data, const cpu_t* cpu,
+										watch_kind_t kind, addr_t addr, data_t value)
+{
+	(void) kind;
+	job_t* job = data;
+	bus_t* bus = cpu->bus;
+	for(size_t i = 0; i < sizeof(signature); ++i) {
+		const data_t* byte = (*bus)[SIGNATURE_START + 1 + i];
+		if(byte == NULL || *byte != signature[i]) {
+			return WATCH_CONTINUE;
+		}
+	}
+	const data_t* result = (*bus)[SIGNATURE_START];
+	const data_t code = addr == SIGNATURE_START ? value : (result == NULL ? SIGNATURE_RUNNING : *result);
+	if(code == SIGNATURE_RUNNING) {
+		return WATCH_CONTINUE;
+	}
+
+	// the message of the signature replaces a partial serial output
+	size_t length = INIT_VALUE;
+	for(addr_t a = SIGNATURE_MESSAGE; length + 1 < OUTPUT_SIZE; ++a, ++length) {
+		const data_t* c = (*bus)[a];
+		if(c == NULL || *c == '\0') {
+			break;
+		}
+		job->output[length] = (char) *c;
+	}
+	if(length > 0 || job->length == 0) {
+		job->output[length] = '\0';
+		job->length = length;
+	}
+	job->verdict = code == 0 ? VERDICT_PASSED : VERDICT_FAILED;
+	return WATCH_BREAK;
+}
+
+// ======================================================================
+static int run_job(job_t* job, uint64_t nb_cycles, int skip_boot)
+{
+	gameboy_t* gb = calloc(1, sizeof(gameboy_t));
+	if(gb == NULL) {
+		return ERR_MEM;
+	}
+	int err = gameboy_create(gb, job->path);
+	if(err != ERR_NONE) {
+		free(gb);
+		return err;
+	}
+	if(skip_boot) {
+		err = gameboy_reset(gb, GB_RESET_POST_BOOT);
+	}
+	// the serial output is drained here rather than printed
+	gb->serial_echo = NULL;
+	if(err == ERR_NONE) {
+		err = watch_add(&gb->watch, REG_SC, REG_SC, WATCH_WRITE, serial_started, NULL, NULL);
+	}
+	if(err == ERR_NONE) {
+		err = watch_add(&gb->watch, SIGNATURE_START, SIGNATURE_MESSAGE - 1, WATCH_WRITE,
+						signature_written, job, NULL);
+	}
+
+	const uint64_t end = gb->cycles + nb_cycles;
+	while(err == ERR_NONE && job->verdict == VERDICT_PENDING && gb->cycles < end) {
+		err = gameboy_run_until(gb, end);
+		if(job->verdict == VERDICT_PENDING) {
+			serial_collect(job, &gb->serial.out);
+		}
+	}
+	if(err == ERR_NONE && job->verdict == VERDICT_PENDING) {
+		job->verdict = VERDICT_TIMEOUT;
+	}
+	job->cycles = gb->cycles;
+	gameboy_free(gb);
+	free(gb);
+	return err;
+}
+
+// ======================================================================
+static void run_suite_job(void* data, size_t i)
+{
+	suite_t* suite = data;
+	job_t* job = &suite->jobs[i];
+	const double start = now();
+	job->err = run_job(job, suite->nb_cycles, suite->skip_boot);
+	job->seconds = now() - start;
+	if(job->err != ERR_NONE) {
+		job->verdict = VERDICT_ERROR;
+	}
+}
+
+// ======================================================================
+static int add_job(suite_t* suite, const char* path)
+{
+	job_t* jobs = realloc(suite->jobs, (suite->nb_jobs + 1) * sizeof(job_t));
+	if(jobs == NULL) {
+		return ERR_MEM;
+	}
+	suite->jobs = jobs;
+	job_t* job = &jobs[suite->nb_jobs++];
+	memset(job, 0, sizeof(*job));
+	strncpy(job->path, path, sizeof(job->path) - 1);
+	return ERR_NONE;
+}
+
+// ======================================================================
+static int compare_jobs(const void* a, const void* b)
+{
+	return strcmp(((const job_t*) a)->path, ((const job_t*) b)->path);
+}
+
+// ======================================================================
+/**
+ * @brief Adds a ROM, or every .gb of a directory (in name order)
+ */
+static int add_path(suite_t* suite, const char* path)
+{
+	DIR* dir = opendir(path);
+	if(dir == NULL) {
+		return add_job(suite, path);
+	}
+	const size_t first = suite->nb_jobs;
+	int err = ERR_NONE;
+	const struct dirent* entry = NULL;
+	while(err == ERR_NONE && (entry = readdir(dir)) != NULL) {
+		const size_t length = strlen(entry->d_name);
+		if(length > 3 && !strcmp(entry->d_name + length - 3, ".gb")) {
+			char rom[FILENAME_MAX];
+			snprintf(rom, sizeof(rom), "%s/%s", path, entry->d_name);
+			err = add_job(suite, rom);
+		}
+	}
+	closedir(dir);
+	qsort(suite->jobs + first, suite->nb_jobs - first, sizeof(job_t), compare_jobs);
+	return err;
+}
+
+// ======================================================================
+static const char* rom_name(const job_t* job)
+{
+	const char* slash = strrchr(job->path, '/');
+	return slash == NULL ? job->path : slash + 1;
+}
+
+// ======================================================================
+/**
+ * @brief Describes why a ROM did not pass, on one line
+ */
+static void print_failure(FILE* out, const job_t* job, const char* prefix)
+{
+	switch(job->verdict) {
+	case VERDICT_ERROR:
+		fprintf(out, "%serror: %s", prefix, ERR_MESSAGES[job->err - ERR_NONE]);
+		break;
+	case VERDICT_TIMEOUT:
+		fprintf(out, "%sno verdict after %" PRIu64 " cycles", prefix, job->cycles);
+		break;
+	default:
+		fputs(prefix, out);
+		for(size_t i = 0; i < job->length; ++i) {
+			fputc(job->output[i] == '\n' ? ' ' : job->output[i], out);
+		}
+		break;
+	}
+}
+
+// ======================================================================
+static void print_tap(FILE* out, const suite_t* suite)
+{
+	fprintf(out, "TAP version 13\n1..%zu\n", suite->nb_jobs);
+	for(size_t i = 0; i < suite->nb_jobs; ++i) {
+		const job_t* job = &suite->jobs[i];
+		const int passed = job->verdict == VERDICT_PASSED;
+		fprintf(out, "%s %zu - %s # %.3f s, %" PRIu64 " cycles\n", passed ? "ok" : "not ok",
+				i + 1, rom_name(job), job->seconds, job->cycles);
+		if(!passed) {
+			print_failure(out, job, "# ");
+			fputc('\n', out);
+		}
+	}
+}
+
+// ======================================================================
+static void print_xml_escaped(FILE* out, const char* s)
+{
+	for(; *s != '\0'; ++s) {
+		switch(*s) {
+		case '&': fputs("&amp;", out); break;
+		case '<': fputs("&lt;", out); break;
+		case '>': fputs("&gt;", out); break;
+		case '"': fputs("&quot;", out); break;
+		default:
+			fputc((unsigned char) *s < ' ' ? ' ' : *s, out);
+			break;
+		}
+	}
+}
+
+// ======================================================================
+static int write_junit(const char* filename, const suite_t* suite, double seconds)
+{
+	FILE* out = fopen(filename, "w");
+	if(out == NULL) {
+		return ERR_IO;
+	}
+	size_t nb_failures = INIT_VALUE, nb_errors = INIT_VALUE;
+	for(size_t i = 0; i < suite->nb_jobs; ++i) {
+		nb_failures += suite->jobs[i].verdict == VERDICT_FAILED || suite->jobs[i].verdict == VERDICT_TIMEOUT;
+		nb_errors += suite->jobs[i].verdict == VERDICT_ERROR;
+	}
+	fprintf(out, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+	fprintf(out, "<testsuite name=\"blargg\" tests=\"%zu\" failures=\"%zu\" errors=\"%zu\" time=\"%.3f\">\n",
+			suite->nb_jobs, nb_failures, nb_errors, seconds);
+	for(size_t i = 0; i < suite->nb_jobs; ++i) {
+		const job_t* job = &suite->jobs[i];
+		fputs("  <testcase classname=\"blargg\" name=\"", out);
+		print_xml_escaped(out, rom_name(job));
+		fprintf(out, "\" time=\"%.3f\"", job->seconds);
+		if(job->verdict == VERDICT_PASSED) {
+			fputs("/>\n", out);
+			continue;
+		}
+		fprintf(out, ">\n    <%s message=\"", job->verdict == VERDICT_ERROR ? "error" : "failure");
+		char message[OUTPUT_SIZE + 64];
+		FILE* m = fmemopen(message, sizeof(message), "w");
+		if(m != NULL) {
+			print_failure(m, job, "");
+			fclose(m);
+			print_xml_escaped(out, message);
+		}
+		fprintf(out, "\"/>\n  </testcase>\n");
+	}
+	fprintf(out, "</testsuite>\n");
+	return fclose(out) == 0 ? ERR_NONE : ERR_IO;
+}
+
+// ======================================================================
+int main(int argc, char *argv[])
+{
+	suite_t suite;
+	memset(&suite, 0, sizeof(suite));
+	suite.nb_cycles = (uint64_t) DEFAULT_MCYCLES * MILLION;
+	long nb_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	const char* junit = NULL;
+
+	int err = ERR_NONE;
+	int nb_paths = INIT_VALUE;
+	for(int i = 1; i < argc && err == ERR_NONE; ++i) {
+		if(!strcmp(argv[i], "--jobs") && i + 1 < argc) {
+			nb_threads = strtol(argv[++i], NULL, 10);
+		} else if(!strcmp(argv[i], "--mcycles") && i + 1 < argc) {
+			suite.nb_cycles = strtoull(argv[++i], NULL, 10) * MILLION;
+		} else if(!strcmp(argv[i], "--junit") && i + 1 < argc) {
+			junit = argv[++i];
+		} else if(!strcmp(argv[i], "--skip-boot")) {
+			suite.skip_boot = 1;
+		} else if(argv[i][0] == '-') {
+			fprintf(stderr, "usage: %s [--jobs N] [--mcycles N] [--junit FILE] [--skip-boot] [ROM|DIR ...]\n",
+					argv[0]);
+			return 2;
+		} else {
+			err = add_path(&suite, argv[i]);
+			++nb_paths;
+		}
+	}
+	if(err == ERR_NONE && nb_paths == 0) {
+		err = add_path(&suite, BLARGG_DIR);
+	}
+	if(err != ERR_NONE || suite.nb_jobs == 0) {
+		fprintf(stderr, "%s: no ROM to run\n", argv[0]);
+		free(suite.jobs);
+		return 2;
+	}
+
+	FILE* report = harness_report();
+	if(report == NULL) {
+		fprintf(stderr, "%s: cannot redirect stdout\n", argv[0]);
+		free(suite.jobs);
+		return 2;
+	}
+	const double start = now();
+	const long nb_started = harness_run_jobs(suite.nb_jobs, nb_threads, run_suite_job, &suite);
+	const double seconds = now() - start;
+
+	int status = 0;
+	for(size_t i = 0; i < suite.nb_jobs; ++i) {
+		if(suite.jobs[i].verdict != VERDICT_PASSED) {
+			status = 1;
+		}
+	}
+	print_tap(report, &suite);
+	fprintf(report, "# %zu ROMs in %.3f s on %ld threads\n", suite.nb_jobs, seconds, nb_started);
+	if(junit != NULL && write_junit(junit, &suite, seconds) != ERR_NONE) {
+		fprintf(stderr, "%s: cannot write %s\n", argv[0], junit);
+		status = 2;
+	}
+	fclose(report);
+	free(suite.jobs);
+	return status;
+}
@@ -0,0 +1,468 @@
+/**
+ * @file gbdiff.c
+ * @brief Differential validator: runs two gameboys with different fast
+ *        paths side by side and stops at the first divergence of their
+ *        states, printing a diff of them
+ *
+ * The states are compared through their state hashes (see state-hash.h),
+ * at a configurable granularity; the full diff is only built on a mismatch.
+ * With --skip-boot, the second gameboy starts in the post-boot state built
+ * by bootrom_skip(), the first one runs the boot ROM, and they are compared
+ * first right after it.
+ *
+ * With --checkpoints, the first gameboy alone runs the ROM and is compared
+ * along the way with the states recorded in a file, one line per
+ * checkpoint (see checkpoint_line(), # starts a comment), such as those
+ * written by --record: a change can then be checked against the states of
+ * a tree which does not have it.
+ *
+ * Usage: gbdiff [options] [ROM[:MCYCLES] ...]
+ *        (without ROM, the bundled games and Blargg ROMs are run)
+ *
+ * Exit status: 0 when all the ROMs match, 1 on a divergence, 2 on error.
+ *
+ * @date 2020
+ */
+
+#include "error.h"
+#include "gameboy.h"
+#include "harness.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MILLION 1000000
+#define DEFAULT_MCYCLES 20
+#define MAX_MEMORY_DIFFS 32
+#define LINE_SIZE 128
+// every fast path, the opt-in fusion included
+#define FAST_PATHS_ALL (GB_FAST_ALL | GB_FAST_FUSION)
+
+#define BLARGG_DIR "../provided/tests/data/blargg_roms/"
+
+// default suite: ROM and millions of cycles (the Blargg ones are those of run_blargg.sh)
+static const char* const default_suite[] = {
+	"../data/tetris.gb:20",
+	"../data/flappyboy.gb:20",
+	BLARGG_DIR "01-special.gb:5",
+	BLARGG_DIR "02-interrupts.gb:5",
+	BLARGG_DIR "03-op sp,hl.gb:5",
+	BLARGG_DIR "04-op r,imm.gb:7",
+	BLARGG_DIR "05-op rp.gb:7",
+	BLARGG_DIR "06-ld r,r.gb:5",
+	BLARGG_DIR "07-jr,jp,call,ret,rst.gb:4",
+	BLARGG_DIR "08-misc instrs.gb:5",
+	BLARGG_DIR "09-op r,r.gb:15",
+	BLARGG_DIR "10-bit ops.gb:20",
+	BLARGG_DIR "11-op a,(hl).gb:25",
+	BLARGG_DIR "instr_timing.gb:5",
+};
+
+/**
+ * @brief When the states are compared
+ */
+typedef enum {
+	STEP_INSTRUCTION,   // after each instruction (of the first gameboy)
+	STEP_LINE,          // every LINE_TOTAL_CYCLES cycles
+	STEP_FRAME,         // at each VBLANK (of the first gameboy)
+	STEP_CYCLES         // every given number of cycles
+} step_t;
+
+typedef struct {
+	uint8_t fast_paths[2];
+	step_t step;
+	uint64_t step_cycles;
+	const char* movie;          // NULL for no input
+	int skip_boot;              // the second gameboy skips the boot ROM
+	const char* checkpoints;    // states the first gameboy is compared with (NULL for none)
+	FILE* record;               // where the states of the first gameboy are written (NULL for none)
+	FILE* report;
+} options_t;
+
+static gameboy_t gb[2];
+
+// ======================================================================
+static void usage(const char* pgm)
+{
+	fprintf(stderr, "usage:   %s [options] [ROM[:MCYCLES] ...]\n", pgm);
+	fprintf(stderr, "options: --a PATHS       fast paths of the first gameboy (default: none)\n");
+	fprintf(stderr, "         --b PATHS       fast paths of the second gameboy (default: all)\n");
+	fprintf(stderr, "                         PATHS: none, all (fusion included), or halt,idle,fusion\n");
+	fprintf(stderr, "         --step S        compare at each instruction, line, frame (default)\n");
+	fprintf(stderr, "                         or every S cycles\n");
+	fprintf(stderr, "         --movie FILE    key events to play on both (see movie.h)\n");
+	fprintf(stderr, "         --skip-boot     the second gameboy skips the boot ROM\n");
+	fprintf(stderr, "         --checkpoints FILE\n");
+	fprintf(stderr, "                         compare the first gameboy alone with the states\n");
+	fprintf(stderr, "                         of FILE (ROMs required)\n");
+	fprintf(stderr, "         --record FILE   write the states of the first gameboy at each\n");
+	fprintf(stderr, "                         comparison to FILE\n");
+}
+
+// ======================================================================
+/**
+ * @brief Parses none, all or a comma-separated list of fast paths
+ */
+static int parse_fast_paths(const char* s, uint8_t* paths)
+{
+	if(!strcmp(s, "none")) {
+		*paths = 0;
+		return 1;
+	}
+	if(!strcmp(s, "all")) {
+		*paths = FAST_PATHS_ALL;
+		return 1;
+	}
+	*paths = 0;
+	while(*s != '\0') {
+		const size_t length = strcspn(s, ",");
+		if(length == strlen("halt") && !strncmp(s, "halt", length)) {
+			*paths |= GB_FAST_HALT;
+		} else if(length == strlen("idle") && !strncmp(s, "idle", length)) {
+			*paths |= GB_FAST_IDLE_LOOP;
+		} else if(length == strlen("fusion") && !strncmp(s, "fusion", length)) {
+			*paths |= GB_FAST_FUSION;
+		} else {
+			return 0;
+		}
+		s += length + (s[length] == ',' ? 1 : 0);
+	}
+	return 1;
+}
+
+// ======================================================================
+static int parse_step(const char* s, options_t* options)
+{
+	if(!strcmp(s, "instruction")) {
+		options->step = STEP_INSTRUCTION;
+	} else if(!strcmp(s, "line")) {
+		options->step = STEP_LINE;
+	} else if(!strcmp(s, "frame")) {
+		options->step = STEP_FRAME;
+	} else {
+		char* end = NULL;
+		options->step = STEP_CYCLES;
+		options->step_cycles = strtoull(s, &end, 10);
+		return *end == '\0' && options->step_cycles != 0;
+	}
+	return 1;
+}
+
+// ======================================================================
+static data_t read_byte(const gameboy_t* g, addr_t addr)
+{
+	return g->bus[addr] != NULL ? *g->bus[addr] : 0;
+}
+
+// ======================================================================
+#define print_diff(out, name, format, a, b) \
+	fprintf(out, "  %-12s " format "  " format "%s\n", name, a, b, (a) != (b) ? "  <==" : "")
+
+/**
+ * @brief Prints the states of both gameboys, marking the differences
+ */
+static void print_state_diff(FILE* out)
+{
+	const cpu_t* a = &gb[0].cpu;
+	const cpu_t* b = &gb[1].cpu;
+	fprintf(out, "  %-12s %-18s  %s\n", "", "a", "b");
+	print_diff(out, "cycles", "%-18" PRIu64, gb[0].cycles, gb[1].cycles);
+	print_diff(out, "frames", "%-18" PRIu64, gb[0].frames, gb[1].frames);
+	print_diff(out, "instructions", "%-18" PRIu64, a->nb_instructions, b->nb_instructions);
+	print_diff(out, "AF", "%04" PRIX16 "              ", a->AF, b->AF);
+	print_diff(out, "BC", "%04" PRIX16 "              ", a->BC, b->BC);
+	print_diff(out, "DE", "%04" PRIX16 "              ", a->DE, b->DE);
+	print_diff(out, "HL", "%04" PRIX16 "              ", a->HL, b->HL);
+	print_diff(out, "SP", "%04" PRIX16 "              ", a->SP, b->SP);
+	print_diff(out, "PC", "%04" PRIX16 "              ", a->PC, b->PC);
+	print_diff(out, "IME", "%-18d", a->IME, b->IME);
+	print_diff(out, "IE", "%02" PRIX8 "                ", a->IE, b->IE);
+	print_diff(out, "IF", "%02" PRIX8 "                ", a->IF, b->IF);
+	print_diff(out, "HALT", "%-18d", a->HALT, b->HALT);
+	print_diff(out, "idle_time", "%-18d", a->idle_time, b->idle_time);
+	print_diff(out, "timer", "%04" PRIX16 "              ", gb[0].timer.counter, gb[1].timer.counter);
+	print_diff(out, "boot", "%-18d", gb[0].boot, gb[1].boot);
+	print_diff(out, "lcd on", "%-18d", gb[0].screen.on, gb[1].screen.on);
+	print_diff(out, "lcd next", "%-18" PRIu64, gb[0].screen.next_cycle, gb[1].screen.next_cycle);
+	print_diff(out, "lcd on_cycle", "%-18" PRIu64, gb[0].screen.on_cycle, gb[1].screen.on_cycle);
+	print_diff(out, "DMA from", "%04" PRIX16 "              ", gb[0].screen.DMA_from, gb[1].screen.DMA_from);
+	print_diff(out, "DMA to", "%04" PRIX16 "              ", gb[0].screen.DMA_to, gb[1].screen.DMA_to);
+	print_diff(out, "window_y", "%-18d", gb[0].screen.window_y, gb[1].screen.window_y);
+	print_diff(out, "joypad", "%02" PRIX8 "                ", gb[0].pad.intern, gb[1].pad.intern);
+
+	int nb_diffs = 0;
+	for(uint32_t addr = VIDEO_RAM_START; addr <= UINT16_MAX; ++addr) {
+		if(addr == ECHO_RAM_START) {
+			addr = ECHO_RAM_END;
+			continue;
+		}
+		const data_t va = read_byte(&gb[0], (addr_t) addr);
+		const data_t vb = read_byte(&gb[1], (addr_t) addr);
+		if(va != vb) {
+			if(nb_diffs < MAX_MEMORY_DIFFS) {
+				fprintf(out, "  [%04" PRIX32 "]       %02" PRIX8 "                  %02" PRIX8 "\n", addr, va, vb);
+			}
+			++nb_diffs;
+		}
+	}
+	if(nb_diffs > MAX_MEMORY_DIFFS) {
+		fprintf(out, "  ... %d bytes differ\n", nb_diffs);
+	}
+}
+
+// ======================================================================
+/**
+ * @brief Formats the checkpoint of a gameboy: its cycle, the registers of
+ *        its CPU and a hash (FNV-1a) of the memory compared by
+ *        print_state_diff()
+ */
+static void checkpoint_line(const gameboy_t* g, char* line, size_t size)
+{
+	uint64_t hash = 0xCBF29CE484222325ULL;
+	for(uint32_t addr = VIDEO_RAM_START; addr <= UINT16_MAX; ++addr) {
+		if(addr == ECHO_RAM_START) {
+			addr = ECHO_RAM_END;
+			continue;
+		}
+		hash = (hash ^ read_byte(g, (addr_t) addr)) * 0x100000001B3ULL;
+	}
+	const cpu_t* cpu = &g->cpu;
+	snprintf(line, size, "%" PRIu64 " %04" PRIX16 " %04" PRIX16 " %04" PRIX16 " %04" PRIX16
+			 " %04" PRIX16 " %04" PRIX16 " %02" PRIX8 " %02" PRIX8 " %d %d %016" PRIx64,
+			 g->cycles, cpu->PC, cpu->SP, cpu->AF, cpu->BC, cpu->DE, cpu->HL,
+			 cpu->IE, cpu->IF, cpu->IME, cpu->HALT, hash);
+}
+
+// ======================================================================
+static int start(gameboy_t* g, const char* rom, uint8_t fast_paths, const char* movie)
+{
+	memset(g, 0, sizeof(*g));
+	M_EXIT_IF_ERR(gameboy_create(g, rom));
+	g->fast_paths = fast_paths;
+	M_EXIT_IF_ERR(gameboy_hash_start(g, NULL));
+	if(movie != NULL) {
+		M_EXIT_IF_ERR(gameboy_movie_start(g, movie, MOVIE_PLAY));
+	}
+	return ERR_NONE;
+}
+
+// ======================================================================
+/**
+ * @brief Runs the first gameboy to its next comparison point and the
+ *        second one to the same cycle
+ */
+static int step(const options_t* options, uint64_t end)
+{
+	switch(options->step) {
+	case STEP_INSTRUCTION: {
+		const uint64_t nb_instructions = gb[0].cpu.nb_instructions;
+		while(gb[0].cycles < end && gb[0].cpu.nb_instructions == nb_instructions) {
+			M_EXIT_IF_ERR(gameboy_run_until(&gb[0], gb[0].cycles + 1));
+		}
+		break;
+	}
+	case STEP_LINE:
+		M_EXIT_IF_ERR(gameboy_run_until(&gb[0], gb[0].cycles + LINE_TOTAL_CYCLES < end
+										? gb[0].cycles + LINE_TOTAL_CYCLES : end));
+		break;
+	case STEP_FRAME:
+		M_EXIT_IF_ERR(gameboy_run_frame(&gb[0], end));
+		break;
+	case STEP_CYCLES:
+		M_EXIT_IF_ERR(gameboy_run_until(&gb[0], gb[0].cycles + options->step_cycles < end
+										? gb[0].cycles + options->step_cycles : end));
+		break;
+	}
+	return gameboy_run_until(&gb[1], gb[0].cycles);
+}
+
+// ======================================================================
+/**
+ * @brief Hashes the states of both gameboys, tells whether they differ
+ */
+static int compare(int* diverged)
+{
+	M_EXIT_IF_ERR(state_hash_frame(gb[0].hash, &gb[0]));
+	M_EXIT_IF_ERR(state_hash_frame(gb[1].hash, &gb[1]));
+	*diverged = gb[0].hash->last != gb[1].hash->last;
+	return ERR_NONE;
+}
+
+// ======================================================================
+/**
+ * @brief Runs one ROM on both gameboys, returns 1 if they diverged
+ */
+static int diff_rom(const char* spec, const options_t* options)
+{
+	char rom[FILENAME_MAX];
+	strncpy(rom, spec, sizeof(rom) - 1);
+	rom[sizeof(rom) - 1] = '\0';
+	uint64_t mcycles = DEFAULT_MCYCLES;
+	char* colon = strrchr(rom, ':');
+	if(colon != NULL) {
+		*colon = '\0';
+		mcycles = strtoull(colon + 1, NULL, 10);
+	}
+	const uint64_t end = mcycles * MILLION;
+
+	int err = start(&gb[0], rom, options->fast_paths[0], options->movie);
+	if(err == ERR_NONE) {
+		err = start(&gb[1], rom, options->fast_paths[1], options->movie);
+	}
+	uint64_t nb_comparisons = 0;
+	int diverged = 0;
+	if(err == ERR_NONE && options->skip_boot) {
+		err = gameboy_reset(&gb[1], GB_RESET_POST_BOOT);
+		if(err == ERR_NONE) {
+			err = gameboy_run_until(&gb[0], gb[1].cycles);
+		}
+		if(err == ERR_NONE) {
+			err = compare(&diverged);
+			++nb_comparisons;
+		}
+	}
+	while(err == ERR_NONE && !diverged && gb[0].cycles < end) {
+		err = step(options, end);
+		if(err == ERR_NONE) {
+			err = compare(&diverged);
+		}
+		++nb_comparisons;
+		if(err == ERR_NONE && options->record != NULL) {
+			char line[LINE_SIZE];
+			checkpoint_line(&gb[0], line, sizeof(line));
+			fprintf(options->record, "%s\n", line);
+		}
+	}
+
+	if(err != ERR_NONE) {
+		fprintf(options->report, "%s: error: %s\n", rom, ERR_MESSAGES[err - ERR_NONE]);
+	} else if(diverged) {
+		fprintf(options->report, "%s: DIVERGED at cycle %" PRIu64 " (comparison %" PRIu64 ")\n",
+				rom, gb[0].cycles, nb_comparisons);
+		print_state_diff(options->report);
+	} else {
+		fprintf(options->report, "%s: identical over %" PRIu64 " cycles, %" PRIu64 " frames, %"
+				PRIu64 " comparisons\n", rom, gb[0].cycles, gb[0].frames, nb_comparisons);
+	}
+	gameboy_free(&gb[0]);
+	gameboy_free(&gb[1]);
+	return err != ERR_NONE ? 2 : diverged;
+}
+
+// ======================================================================
+/**
+ * @brief Runs one ROM on the first gameboy up to each checkpoint, returns 1
+ *        if it differs from one of them
+ */
+static int check_rom(const char* rom, const options_t* options)
+{
+	FILE* file = fopen(options->checkpoints, "r");
+	if(file == NULL) {
+		fprintf(options->report, "%s: error: cannot open %s\n", rom, options->checkpoints);
+		return 2;
+	}
+	int err = start(&gb[0], rom, options->fast_paths[0], options->movie);
+	char expected[LINE_SIZE];
+	char actual[LINE_SIZE] = "";
+	uint64_t nb_checkpoints = 0;
+	int diverged = 0;
+	while(err == ERR_NONE && !diverged && fgets(expected, sizeof(expected), file) != NULL) {
+		expected[strcspn(expected, "\r\n")] = '\0';
+		if(expected[0] == '#' || expected[0] == '\0') {
+			continue;
+		}
+		err = gameboy_run_until(&gb[0], strtoull(expected, NULL, 10));
+		if(err == ERR_NONE) {
+			checkpoint_line(&gb[0], actual, sizeof(actual));
+			diverged = strcmp(expected, actual) != 0;
+		}
+		++nb_checkpoints;
+	}
+	fclose(file);
+
+	if(err != ERR_NONE) {
+		fprintf(options->report, "%s: error: %s\n", rom, ERR_MESSAGES[err - ERR_NONE]);
+	} else if(diverged) {
+		fprintf(options->report, "%s: DIVERGED at cycle %" PRIu64 " (checkpoint %" PRIu64 ")\n"
+				"  expected %s\n  actual   %s\n", rom, gb[0].cycles, nb_checkpoints, expected, actual);
+	} else {
+		fprintf(options->report, "%s: identical over %" PRIu64 " cycles, %" PRIu64 " checkpoints\n",
+				rom, gb[0].cycles, nb_checkpoints);
+	}
+	gameboy_free(&gb[0]);
+	return err != ERR_NONE ? 2 : diverged;
+}
+
+// ======================================================================
+int main(int argc, char *argv[])
+{
+	options_t options = { { 0, FAST_PATHS_ALL }, STEP_FRAME, 0, NULL, 0, NULL, NULL, NULL };
+	const char** roms = calloc((size_t) argc, sizeof(char*));
+	size_t nb_roms = 0;
+	if(roms == NULL) {
+		return 2;
+	}
+
+	for(int i = 1; i < argc; ++i) {
+		const int has_value = i + 1 < argc;
+		int ok = 1;
+		if(!strcmp(argv[i], "--a") && has_value) {
+			ok = parse_fast_paths(argv[++i], &options.fast_paths[0]);
+		} else if(!strcmp(argv[i], "--b") && has_value) {
+			ok = parse_fast_paths(argv[++i], &options.fast_paths[1]);
+		} else if(!strcmp(argv[i], "--step") && has_value) {
+			ok = parse_step(argv[++i], &options);
+		} else if(!strcmp(argv[i], "--movie") && has_value) {
+			options.movie = argv[++i];
+		} else if(!strcmp(argv[i], "--skip-boot")) {
+			options.skip_boot = 1;
+		} else if(!strcmp(argv[i], "--checkpoints") && has_value) {
+			options.checkpoints = argv[++i];
+		} else if(!strcmp(argv[i], "--record") && has_value && options.record == NULL) {
+			options.record = fopen(argv[++i], "w");
+			ok = options.record != NULL;
+		} else if(argv[i][0] != '-') {
+			roms[nb_roms++] = argv[i];
+		} else {
+			ok = 0;
+		}
+		if(!ok) {
+			usage(argv[0]);
+			free(roms);
+			return 2;
+		}
+	}
+	if(nb_roms == 0 && options.checkpoints != NULL) {
+		usage(argv[0]);
+		free(roms);
+		return 2;
+	}
+	if(nb_roms == 0) {
+		free(roms);
+		roms = NULL;
+	}
+
+	options.report = harness_report();
+	if(options.report == NULL) {
+		fprintf(stderr, "%s: cannot redirect stdout\n", argv[0]);
+		free(roms);
+		return 2;
+	}
+	setvbuf(options.report, NULL, _IOLBF, 0);
+
+	int status = 0;
+	const size_t nb = roms != NULL ? nb_roms : sizeof(default_suite) / sizeof(default_suite[0]);
+	for(size_t i = 0; i < nb && status != 2; ++i) {
+		const char* rom = roms != NULL ? roms[i] : default_suite[i];
+		const int result = options.checkpoints != NULL ? check_rom(rom, &options) : diff_rom(rom, &options);
+		status = result > status ? result : status;
+	}
+	free(roms);
+	fclose(options.report);
+	if(options.record != NULL && fclose(options.record) != 0) {
+		status = 2;
+	}
+	return status;
+}
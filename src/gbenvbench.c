@@ -0,0 +1,271 @@
+/**
+ * @file gbenvbench.c
+ * @brief Throughput benchmark of the vectorized environment (see gb-env.h):
+ *        how much the lockstep groups save when the actions of the gameboys
+ *        are the same, partly the same, or independent
+ *
+ * Steps the gameboys of a ROM with the lockstep groups off, then on, in
+ * three input modes:
+ *   - same: every gameboy is given the same random action at each step;
+ *   - explore: every gameboy is given the action of the first one, but for
+ *     one in EXPLORE_RATE which is given a random action (as an agent which
+ *     explores around a policy); the groups split at the different actions
+ *     and join again when the states of their gameboys converge (see
+ *     gb_env_step());
+ *   - diverge: each gameboy is given its own random actions.
+ * The actions are drawn from a fixed seed, so that both runs of a mode step
+ * the same; their observations are checked to be equal.
+ *
+ * Prints one JSON document on stdout with, for each run: the frames run
+ * per second (all the gameboys together), the groups run per step and the
+ * speedup of the lockstep groups (what the ROM prints on stdout is dropped).
+ *
+ * Usage: gbenvbench [options] [ROM]   (default DEFAULT_ROM)
+ *   --envs N       gameboys (default DEFAULT_ENVS)
+ *   --steps N      steps per run (default DEFAULT_STEPS)
+ *   --frames N     frames per step (default DEFAULT_FRAMES)
+ *   --episode N    frames per episode (default 0: no automatic reset)
+ *   --keys LIST    keys of the actions, one action per key and one without
+ *                  any (default DEFAULT_KEYS; r, l, u, d, a, b, s(elect),
+ *                  t (start))
+ *   --threads N    threads of the pool (default 1: the throughput per core)
+ *
+ * @date 2020
+ */
+
+#include "error.h"
+#include "gb-env.h"
+#include "harness.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define INIT_VALUE 0
+#define TRUE 1
+#define FALSE 0
+#define BILLION 1000000000
+#define DEFAULT_ROM "../data/tetris.gb"
+#define DEFAULT_ENVS 16
+#define DEFAULT_STEPS 300
+#define DEFAULT_FRAMES 4
+#define DEFAULT_KEYS "rldab"
+#define MAX_ACTIONS (NB_GB_KEYS + 1)
+#define SEED 0x2545F4914F6CDD1DULL
+#define EXPLORE_RATE 10
+
+/**
+ * @brief Input modes (see the top of the file)
+ */
+typedef enum {
+	INPUTS_SAME,
+	INPUTS_EXPLORE,
+	INPUTS_DIVERGE,
+	NB_INPUTS
+} inputs_t;
+
+static const char* const INPUTS_NAMES[NB_INPUTS] = { "same", "explore", "diverge" };
+
+/**
+ * @brief Options of the benchmark
+ */
+typedef struct {
+	const char* rom;
+	size_t nb_envs;
+	uint32_t nb_steps;
+	uint32_t nb_frames;
+	uint64_t episode_frames;
+	size_t nb_threads;
+	uint8_t actions[MAX_ACTIONS];
+	size_t nb_actions;
+} options_t;
+
+/**
+ * @brief Results of one run
+ */
+typedef struct {
+	double seconds;
+	double groups;          // groups run per step, on average
+	uint64_t obs_hash;      // hash of every observation of the run
+	int err;
+} run_t;
+
+// ======================================================================
+static double now(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + (double) t.tv_nsec / BILLION;
+}
+
+// ======================================================================
+static void print_json_string(FILE* report, const char* s)
+{
+	fputc('"', report);
+	for(; *s != '\0'; ++s) {
+		if(*s == '"' || *s == '\\') {
+			fputc('\\', report);
+		}
+		fputc(*s, report);
+	}
+	fputc('"', report);
+}
+
+// ======================================================================
+/**
+ * @brief Next pseudo-random number (xorshift64*)
+ */
+static uint64_t next_random(uint64_t* state)
+{
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 0x2545F4914F6CDD1DULL;
+}
+
+// ======================================================================
+/**
+ * @brief Parses the keys of the actions: one action per key, and the
+ *        action without any key
+ */
+static int parse_keys(const char* s, options_t* options)
+{
+	static const char names[NB_GB_KEYS + 1] = "rludabst";
+	options->nb_actions = 1;
+	options->actions[0] = 0;
+	for(; *s != '\0'; ++s) {
+		const char* key = strchr(names, *s);
+		if(key == NULL || options->nb_actions == MAX_ACTIONS) {
+			return FALSE;
+		}
+		options->actions[options->nb_actions++] = (uint8_t) (1 << (key - names));
+	}
+	return TRUE;
+}
+
+// ======================================================================
+/**
+ * @brief Steps the gameboys of a new environment
+ *
+ * @param inputs how the actions of the gameboys are drawn
+ * @param lockstep whether the groups are used
+ */
+static run_t bench_run(const options_t* options, inputs_t inputs, int lockstep)
+{
+	run_t run = { 0.0, 0.0, 0x84222325CBF29CE4ULL, ERR_NONE };
+	gb_env_t env;
+	run.err = gb_env_create(&env, options->rom, options->nb_envs, GB_OBS_HALF, options->nb_threads);
+	if(run.err != ERR_NONE) {
+		return run;
+	}
+	env.lockstep = lockstep;
+	env.max_episode_frames = options->episode_frames;
+
+	const size_t n = options->nb_envs;
+	uint8_t* actions = calloc(n, sizeof(uint8_t));
+	uint8_t* obs = calloc(n, env.obs_size);
+	if(actions == NULL || obs == NULL) {
+		run.err = ERR_MEM;
+	}
+
+	uint64_t random = SEED;
+	uint64_t nb_groups = INIT_VALUE;
+	double seconds = 0.0;
+	for(uint32_t step = 0; step < options->nb_steps && run.err == ERR_NONE; ++step) {
+		for(size_t i = 0; i < n; ++i) {
+			if(i == 0 || inputs == INPUTS_DIVERGE
+			   || (inputs == INPUTS_EXPLORE && next_random(&random) % EXPLORE_RATE == 0)) {
+				actions[i] = options->actions[next_random(&random) % options->nb_actions];
+			} else {
+				actions[i] = actions[0];
+			}
+		}
+		const double start = now();
+		run.err = gb_env_step(&env, n, actions, options->nb_frames, obs, NULL);
+		seconds += now() - start;
+
+		nb_groups += env.step.nb_leaders;
+		for(size_t i = 0; i < n * env.obs_size; ++i) {
+			run.obs_hash = (run.obs_hash ^ obs[i]) * 0x100000001B3ULL;
+		}
+	}
+	run.seconds = seconds;
+	run.groups = options->nb_steps == 0 ? 0.0 : (double) nb_groups / options->nb_steps;
+
+	free(actions);
+	free(obs);
+	gb_env_free(&env);
+	return run;
+}
+
+// ======================================================================
+int main(int argc, char *argv[])
+{
+	options_t options = { DEFAULT_ROM, DEFAULT_ENVS, DEFAULT_STEPS, DEFAULT_FRAMES, 0, 1, { 0 }, 0 };
+	parse_keys(DEFAULT_KEYS, &options);
+	for(int i = 1; i < argc; ++i) {
+		const int has_value = i + 1 < argc;
+		int ok = TRUE;
+		if(!strcmp(argv[i], "--envs") && has_value) {
+			options.nb_envs = (size_t) strtoul(argv[++i], NULL, 10);
+			ok = options.nb_envs > 0;
+		} else if(!strcmp(argv[i], "--steps") && has_value) {
+			options.nb_steps = (uint32_t) strtoul(argv[++i], NULL, 10);
+		} else if(!strcmp(argv[i], "--frames") && has_value) {
+			options.nb_frames = (uint32_t) strtoul(argv[++i], NULL, 10);
+		} else if(!strcmp(argv[i], "--episode") && has_value) {
+			options.episode_frames = strtoull(argv[++i], NULL, 10);
+		} else if(!strcmp(argv[i], "--keys") && has_value) {
+			ok = parse_keys(argv[++i], &options);
+		} else if(!strcmp(argv[i], "--threads") && has_value) {
+			options.nb_threads = (size_t) strtoul(argv[++i], NULL, 10);
+		} else if(argv[i][0] != '-') {
+			options.rom = argv[i];
+		} else {
+			ok = FALSE;
+		}
+		if(!ok) {
+			fprintf(stderr, "usage: %s [--envs N] [--steps N] [--frames N] [--episode N] "
+					"[--keys LIST] [--threads N] [ROM]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	FILE* report = harness_report();
+	if(report == NULL) {
+		fprintf(stderr, "%s: cannot redirect stdout\n", argv[0]);
+		return 2;
+	}
+
+	int status = 0;
+	fprintf(report, "{\n  \"benchmark\": \"gbenvbench\",\n  \"rom\": ");
+	print_json_string(report, options.rom);
+	fprintf(report, ",\n  \"envs\": %zu,\n  \"steps\": %" PRIu32 ",\n  \"frames_per_step\": %" PRIu32
+		",\n  \"runs\": [", options.nb_envs, options.nb_steps, options.nb_frames);
+	size_t nb_printed = INIT_VALUE;
+	for(inputs_t inputs = INPUTS_SAME; inputs < NB_INPUTS; ++inputs) {
+		const run_t off = bench_run(&options, inputs, FALSE);
+		const run_t on = bench_run(&options, inputs, TRUE);
+		const int err = off.err != ERR_NONE ? off.err : on.err;
+		if(err != ERR_NONE) {
+			fprintf(stderr, "%s: %s: %s\n", argv[0], INPUTS_NAMES[inputs], ERR_MESSAGES[err - ERR_NONE]);
+			status = 1;
+			continue;
+		}
+		const double frames = (double) options.nb_envs * options.nb_steps * options.nb_frames;
+		fprintf(report, "%s\n    {\n      \"inputs\": \"%s\",\n", nb_printed++ > 0 ? "," : "", INPUTS_NAMES[inputs]);
+		fprintf(report, "      \"frames_per_s\": { \"lockstep_off\": %.1f, \"lockstep_on\": %.1f },\n",
+			frames / off.seconds, frames / on.seconds);
+		fprintf(report, "      \"groups_per_step\": %.2f,\n", on.groups);
+		fprintf(report, "      \"speedup\": %.2f,\n", off.seconds / on.seconds);
+		fprintf(report, "      \"identical\": %s\n    }", off.obs_hash == on.obs_hash ? "true" : "false");
+		if(off.obs_hash != on.obs_hash) {
+			status = 1;
+		}
+	}
+	fprintf(report, "\n  ]\n}\n");
+	fclose(report);
+	return status;
+}
@@ -0,0 +1,278 @@
+/**
+ * @file gbfuzz.c
+ * @brief Coverage-guided fuzzing harness of the emulator core
+ *
+ * Every input is run on the same gameboy, for a bounded number of frames,
+ * from a post-boot state restored in place: the process is reused from one
+ * input to the next, without creating nor freeing anything. An input is
+ * either:
+ *   - a joypad input sequence for the ROM (by default): byte i holds the
+ *     keys pressed during frame i (bit k for the gb_key_t k), the last one
+ *     being held until the end;
+ *   - a ROM image (--rom-input), which replaces the cartridge: the guest
+ *     code is then the input itself, which reaches the unknown opcodes
+ *     (ERR_INSTR, which ends the input) and every region of the memory map.
+ *     Its post-boot state, whose video RAM holds the logo of the
+ *     cartridge, is built for each input: from the power-on state, see
+ *     bootrom_skip(), as if its logo and header checksum were valid.
+ *
+ * The feedback is the coverage of the guest code: the CPU counts the edges
+ * between the instructions it fetches in a bitmap of CPU_COVERAGE_SIZE
+ * counters (see cpu_t), cleared before each input.
+ *
+ * Builds:
+ *   - by default, a driver replaying the inputs given, which prints for
+ *     each one the edges covered and the error which ended it, if any;
+ *   - with CC=afl-clang-fast, AFL++ persistent mode: the inputs are read
+ *     from shared memory and the guest edges are added to the AFL++ map;
+ *       afl-fuzz -i SEEDS -o OUT -- ./gbfuzz [options]
+ *   - with -DGBFUZZ_LIBFUZZER, libFuzzer (make gbfuzz-libfuzzer, with
+ *     clang), the bitmap being its extra counters; the options below are
+ *     given along with those of libFuzzer, which ignores them.
+ *
+ * Usage: gbfuzz [options] [INPUT ...]
+ *   --rom=FILE     ROM run, or created then replaced by the inputs
+ *                  (default DEFAULT_ROM)
+ *   --frames=N     frames run per input (default DEFAULT_FRAMES)
+ *   --rom-input    the inputs are ROM images
+ *
+ * @date 2020
+ */
+
+#include "error.h"
+#include "gameboy.h"
+#include "bootrom.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INIT_VALUE 0
+#define TRUE 1
+#define FALSE 0
+#define DEFAULT_ROM "../data/tetris.gb"
+#define DEFAULT_FRAMES 300
+#define AFL_LOOP_COUNT 10000    // inputs run by a process before AFL++ forks a new one
+
+/**
+ * @brief Options of the harness
+ */
+typedef struct {
+	const char* rom;
+	uint32_t nb_frames;
+	bit_t rom_input;
+} options_t;
+
+static options_t options = { DEFAULT_ROM, DEFAULT_FRAMES, FALSE };
+static gameboy_t gameboy;
+
+#ifdef GBFUZZ_LIBFUZZER
+// read by libFuzzer after each input, along with its own counters
+__attribute__((section("__libfuzzer_extra_counters")))
+#endif
+static uint8_t coverage[CPU_COVERAGE_SIZE];
+
+// ---------------------------------------------------------------------
+/**
+ * @brief Takes an option into account
+ *
+ * @return whether it is one of the harness
+ */
+static bit_t fuzz_option(const char* arg)
+{
+	if(!strncmp(arg, "--rom=", strlen("--rom="))) {
+		options.rom = arg + strlen("--rom=");
+	} else if(!strncmp(arg, "--frames=", strlen("--frames="))) {
+		options.nb_frames = (uint32_t) strtoul(arg + strlen("--frames="), NULL, 10);
+	} else if(!strcmp(arg, "--rom-input")) {
+		options.rom_input = TRUE;
+	} else {
+		return FALSE;
+	}
+	return TRUE;
+}
+
+// ---------------------------------------------------------------------
+/**
+ * @brief Creates the gameboy reused by every input, and builds the
+ *        post-boot state of the ROM
+ */
+static int fuzz_setup(void)
+{
+	M_EXIT_IF_ERR(gameboy_create(&gameboy, options.rom));
+	gameboy.serial_echo = NULL;
+	gameboy.cpu.coverage = coverage;
+	// every fast path is fuzzed, the opt-in fusion included
+	gameboy.fast_paths = GB_FAST_ALL | GB_FAST_FUSION;
+	return gameboy_reset(&gameboy, GB_RESET_POST_BOOT);
+}
+
+// ---------------------------------------------------------------------
+/**
+ * @brief Runs one input
+ *
+ * @return error code (ERR_NOT_IMPLEMENTED for a ROM image not run, of a
+ *         cartridge type other than 0)
+ */
+static int fuzz_run(const uint8_t* data, size_t size)
+{
+	memset(coverage, 0, sizeof(coverage));
+	if(options.rom_input) {
+		// (not the post-boot state of the ROM given to create the gameboy)
+		M_EXIT_IF_ERR(gameboy_reset(&gameboy, GB_RESET_POWER_ON));
+		M_EXIT_IF_ERR(cartridge_init_from_buffer(&gameboy.cartridge.c, data, size));
+		M_EXIT_IF_ERR(bootrom_skip(&gameboy));
+	} else {
+		M_EXIT_IF_ERR(gameboy_reset(&gameboy, GB_RESET_POST_BOOT));
+	}
+	gameboy.cpu.coverage_prev = INIT_VALUE;
+
+	uint8_t keys = INIT_VALUE;
+	for(uint32_t frame = 0; frame < options.nb_frames; ++frame) {
+		if(!options.rom_input && frame < size) {
+			for(int key = 0; key < NB_GB_KEYS; ++key) {
+				if(bit_get((uint8_t) (keys ^ data[frame]), key)) {
+					M_EXIT_IF_ERR(gameboy_key(&gameboy, (gb_key_t) key, bit_get(data[frame], key)));
+				}
+			}
+			keys = data[frame];
+		}
+		// (bounded even when the LCD is off)
+		M_EXIT_IF_ERR(gameboy_run_frame(&gameboy, gameboy.cycles + FRAME_TOTAL_CYCLES));
+	}
+	return ERR_NONE;
+}
+
+#ifdef GBFUZZ_LIBFUZZER
+
+// ======================================================================
+int LLVMFuzzerInitialize(int* argc, char*** argv)
+{
+	for(int i = 1; i < *argc; ++i) {
+		fuzz_option((*argv)[i]);
+	}
+	if(fuzz_setup() != ERR_NONE) {
+		fprintf(stderr, "gbfuzz: cannot create a gameboy from %s\n", options.rom);
+		exit(2);
+	}
+	return 0;
+}
+
+// ======================================================================
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+	// the ROM images not run are kept out of the corpus
+	return fuzz_run(data, size) == ERR_NOT_IMPLEMENTED ? -1 : 0;
+}
+
+#else
+
+#ifdef __AFL_FUZZ_TESTCASE_LEN
+__AFL_FUZZ_INIT();
+
+// map of AFL++ (see afl-compiler-rt)
+extern uint8_t* __afl_area_ptr;
+extern uint32_t __afl_map_size;
+
+// ---------------------------------------------------------------------
+/**
+ * @brief Adds the guest edges of the last input to the map of AFL++
+ */
+static void fuzz_afl_add(void)
+{
+	for(size_t i = 0; i < CPU_COVERAGE_SIZE; ++i) {
+		if(coverage[i] != 0) {
+			__afl_area_ptr[i % __afl_map_size] += coverage[i];
+		}
+	}
+}
+#endif
+
+// ---------------------------------------------------------------------
+/**
+ * @brief Reads a whole input file
+ *
+ * @param path input file
+ * @param size (output) size of the input
+ * @return the input (to be freed), NULL on error
+ */
+static uint8_t* read_input(const char* path, size_t* size)
+{
+	FILE* file = fopen(path, "rb");
+	if(file == NULL) {
+		return NULL;
+	}
+	uint8_t* data = NULL;
+	long length = -1;
+	if(fseek(file, 0, SEEK_END) == 0 && (length = ftell(file)) >= 0 && fseek(file, 0, SEEK_SET) == 0) {
+		data = malloc(length == 0 ? 1 : (size_t) length);
+	}
+	if(data != NULL && fread(data, 1, (size_t) length, file) != (size_t) length) {
+		free(data);
+		data = NULL;
+	}
+	fclose(file);
+	*size = (size_t) length;
+	return data;
+}
+
+// ======================================================================
+int main(int argc, char *argv[])
+{
+	int nb_inputs = INIT_VALUE;
+	for(int i = 1; i < argc; ++i) {
+		if(argv[i][0] != '-') {
+			++nb_inputs;
+		} else if(!fuzz_option(argv[i])) {
+			fprintf(stderr, "usage: %s [--rom=FILE] [--frames=N] [--rom-input] [INPUT ...]\n", argv[0]);
+			return 2;
+		}
+	}
+	if(fuzz_setup() != ERR_NONE) {
+		fprintf(stderr, "%s: cannot create a gameboy from %s\n", argv[0], options.rom);
+		return 2;
+	}
+
+	int status = 0;
+#ifdef __AFL_FUZZ_TESTCASE_LEN
+	(void) nb_inputs;
+	__AFL_INIT();
+	const uint8_t* data = __AFL_FUZZ_TESTCASE_BUF;
+	while(__AFL_LOOP(AFL_LOOP_COUNT)) {
+		fuzz_run(data, (size_t) __AFL_FUZZ_TESTCASE_LEN);
+		fuzz_afl_add();
+	}
+#else
+	if(nb_inputs == 0) {
+		fprintf(stderr, "%s: no input to run\n", argv[0]);
+		status = 2;
+	}
+	for(int i = 1; i < argc; ++i) {
+		if(argv[i][0] == '-') {
+			continue;
+		}
+		size_t size = INIT_VALUE;
+		uint8_t* data = read_input(argv[i], &size);
+		if(data == NULL) {
+			fprintf(stderr, "%s: cannot read %s\n", argv[0], argv[i]);
+			status = 2;
+			continue;
+		}
+		const int err = fuzz_run(data, size);
+		free(data);
+
+		size_t nb_edges = INIT_VALUE;
+		for(size_t e = 0; e < CPU_COVERAGE_SIZE; ++e) {
+			nb_edges += coverage[e] != 0;
+		}
+		printf("%s: %zu edges, %" PRIu64 " cycles, %s\n", argv[i], nb_edges, gameboy.cycles,
+			   err == ERR_NONE ? "ok" : ERR_MESSAGES[err - ERR_NONE]);
+	}
+#endif
+
+	gameboy_free(&gameboy);
+	return status;
+}
+
+#endif
@@ -0,0 +1,431 @@
+/**
+ * @file gbgolden.c
+ * @brief Golden-frame regression harness: runs ROMs (with their input
+ *        movies), captures screen.display at given frames and compares it
+ *        with stored golden images, writing a diff image on mismatch
+ *
+ * The cases are read from a manifest, one per line:
+ *
+ *     FRAME,FRAME,...  MOVIE|-  ROM
+ *
+ * (the ROM is the rest of the line, paths are relative to the directory of
+ * the manifest; # starts a comment). The golden image of frame F of ROM
+ * R.gb is R-F.pgm in that directory (grey levels as gbplay --format pgm).
+ * On mismatch, R-F.actual.pgm and R-F.diff.ppm (differing pixels in red
+ * over the dimmed golden image) are written to the output directory.
+ *
+ * The frames are compared 8 bytes at a time (word XOR and a count of the
+ * non-zero bytes, which the compiler vectorizes); the cases run
+ * concurrently, one gameboy per case.
+ *
+ * Usage: gbgolden [options] MANIFEST
+ *   --update       (re)writes the golden images instead of comparing
+ *   --jobs N       number of threads (default: number of cores)
+ *   --output DIR   where mismatches are written (default: the current one)
+ *
+ * Exit status: 0 when all the frames match, 1 on a mismatch, 2 on error.
+ *
+ * @date 2020
+ */
+
+#include "error.h"
+#include "gameboy.h"
+#include "harness.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define INIT_VALUE 0
+#define LINE_SIZE 1024
+#define MAX_FRAMES 32
+// frames without VBLANK (LCD off) tolerated before giving up
+#define MAX_FRAME_DELAY 64
+
+#define GREY_SCALE(x) (255 - 85 * (x))
+#define FRAME_SIZE (LCD_WIDTH * LCD_HEIGHT)
+
+#define BYTES_LOW  0x7F7F7F7F7F7F7F7FULL
+#define BYTES_HIGH 0x8080808080808080ULL
+
+typedef uint8_t frame_t[FRAME_SIZE];
+
+/**
+ * @brief Outcome of one frame
+ */
+typedef enum {
+	FRAME_PENDING,
+	FRAME_MATCH,
+	FRAME_DIFF,
+	FRAME_MISSING,   // no golden image
+	FRAME_UPDATED,
+	FRAME_ERROR
+} frame_status_t;
+
+/**
+ * @brief One manifest line, and its results
+ */
+typedef struct {
+	char rom[FILENAME_MAX];
+	char movie[FILENAME_MAX];       // empty for none
+	char name[FILENAME_MAX];        // ROM file name without .gb
+	uint64_t frames[MAX_FRAMES];    // increasing
+	frame_status_t status[MAX_FRAMES];
+	size_t nb_diffs[MAX_FRAMES];    // differing pixels
+	size_t nb_frames;
+	int err;
+} golden_case_t;
+
+/**
+ * @brief Cases run by the threads (see harness_run_jobs())
+ */
+typedef struct {
+	golden_case_t* cases;
+	size_t nb_cases;
+	char dir[FILENAME_MAX];         // of the manifest
+	const char* output;
+	int update;
+} golden_suite_t;
+
+// ======================================================================
+/**
+ * @brief Counts the differing bytes of two buffers, a word at a time
+ *        (the size is a multiple of 8)
+ */
+static size_t count_diffs(const uint8_t* a, const uint8_t* b, size_t size)
+{
+	size_t count = INIT_VALUE;
+	for(size_t i = 0; i < size; i += sizeof(uint64_t)) {
+		uint64_t x = 0, y = 0;
+		memcpy(&x, a + i, sizeof(x));
+		memcpy(&y, b + i, sizeof(y));
+		const uint64_t d = x ^ y;
+		// high bit of each byte set iff the byte is not 0
+		const uint64_t nonzero = (((d & BYTES_LOW) + BYTES_LOW) | d) & BYTES_HIGH;
+		count += (size_t) __builtin_popcountll(nonzero);
+	}
+	return count;
+}
+
+// ======================================================================
+static int capture_frame(const gameboy_t* gb, frame_t frame)
+{
+	for(size_t y = 0; y < LCD_HEIGHT; ++y) {
+		uint8_t* line = frame + y * LCD_WIDTH;
+		M_EXIT_IF_ERR(image_get_line_pixels(line, &gb->screen.display, y));
+		for(size_t x = 0; x < LCD_WIDTH; ++x) {
+			line[x] = (uint8_t) GREY_SCALE(line[x]);
+		}
+	}
+	return ERR_NONE;
+}
+
+// ======================================================================
+static int read_pgm(const char* filename, frame_t frame)
+{
+	FILE* file = fopen(filename, "rb");
+	if(file == NULL) {
+		return ERR_IO;
+	}
+	int width = INIT_VALUE, height = INIT_VALUE, max = INIT_VALUE;
+	int err = ERR_NONE;
+	if(fscanf(file, "P5 %d %d %d", &width, &height, &max) != 3 || fgetc(file) == EOF
+	   || width != LCD_WIDTH || height != LCD_HEIGHT || max != 255
+	   || fread(frame, 1, FRAME_SIZE, file) != FRAME_SIZE) {
+		err = ERR_IO;
+	}
+	fclose(file);
+	return err;
+}
+
+// ======================================================================
+static int write_pgm(const char* filename, const frame_t frame)
+{
+	FILE* file = fopen(filename, "wb");
+	if(file == NULL) {
+		return ERR_IO;
+	}
+	fprintf(file, "P5\n%d %d\n255\n", LCD_WIDTH, LCD_HEIGHT);
+	const int ok = fwrite(frame, 1, FRAME_SIZE, file) == FRAME_SIZE;
+	return fclose(file) == 0 && ok ? ERR_NONE : ERR_IO;
+}
+
+// ======================================================================
+static int write_diff(const char* filename, const frame_t golden, const frame_t actual)
+{
+	FILE* file = fopen(filename, "wb");
+	if(file == NULL) {
+		return ERR_IO;
+	}
+	fprintf(file, "P6\n%d %d\n255\n", LCD_WIDTH, LCD_HEIGHT);
+	for(size_t i = 0; i < FRAME_SIZE; ++i) {
+		const uint8_t dim = (uint8_t) (golden[i] / 4);
+		const uint8_t rgb[3] = { golden[i] == actual[i] ? dim : 255,
+								 golden[i] == actual[i] ? dim : 0,
+								 golden[i] == actual[i] ? dim : 0
+							   };
+		fwrite(rgb, 1, sizeof(rgb), file);
+	}
+	return fclose(file) == 0 ? ERR_NONE : ERR_IO;
+}
+
+// ======================================================================
+/**
+ * @brief Compares (or updates) the golden image of one frame
+ */
+static int check_frame(const golden_suite_t* suite, golden_case_t* c, size_t i, const frame_t actual)
+{
+	char golden_name[FILENAME_MAX];
+	if(snprintf(golden_name, sizeof(golden_name), "%s%s-%" PRIu64 ".pgm", suite->dir, c->name,
+				c->frames[i]) >= (int) sizeof(golden_name)) {
+		return ERR_BAD_PARAMETER;
+	}
+	if(suite->update) {
+		M_EXIT_IF_ERR(write_pgm(golden_name, actual));
+		c->status[i] = FRAME_UPDATED;
+		return ERR_NONE;
+	}
+
+	frame_t golden;
+	if(read_pgm(golden_name, golden) != ERR_NONE) {
+		c->status[i] = FRAME_MISSING;
+		return ERR_NONE;
+	}
+	c->nb_diffs[i] = count_diffs(golden, actual, FRAME_SIZE);
+	if(c->nb_diffs[i] == 0) {
+		c->status[i] = FRAME_MATCH;
+		return ERR_NONE;
+	}
+
+	c->status[i] = FRAME_DIFF;
+	char name[FILENAME_MAX];
+	if(snprintf(name, sizeof(name), "%s/%s-%" PRIu64 ".actual.pgm", suite->output, c->name,
+				c->frames[i]) >= (int) sizeof(name)) {
+		return ERR_BAD_PARAMETER;
+	}
+	M_EXIT_IF_ERR(write_pgm(name, actual));
+	if(snprintf(name, sizeof(name), "%s/%s-%" PRIu64 ".diff.ppm", suite->output, c->name,
+				c->frames[i]) >= (int) sizeof(name)) {
+		return ERR_BAD_PARAMETER;
+	}
+	return write_diff(name, golden, actual);
+}
+
+// ======================================================================
+static int run_case(const golden_suite_t* suite, golden_case_t* c)
+{
+	gameboy_t* gb = calloc(1, sizeof(gameboy_t));
+	if(gb == NULL) {
+		return ERR_MEM;
+	}
+	int err = gameboy_create(gb, c->rom);
+	if(err != ERR_NONE) {
+		free(gb);
+		return err;
+	}
+	if(c->movie[0] != '\0') {
+		err = gameboy_movie_start(gb, c->movie, MOVIE_PLAY);
+	}
+
+	frame_t frame;
+	size_t next = INIT_VALUE;
+	uint64_t deadline = gb->cycles + MAX_FRAME_DELAY * FRAME_TOTAL_CYCLES;
+	while(err == ERR_NONE && next < c->nb_frames) {
+		const uint64_t frames = gb->frames;
+		err = gameboy_run_frame(gb, deadline);
+		if(err != ERR_NONE) {
+			break;
+		}
+		if(gb->frames == frames) {
+			if(gb->cycles >= deadline) {
+				err = ERR_BAD_PARAMETER;
+			}
+			continue;
+		}
+		deadline = gb->cycles + MAX_FRAME_DELAY * FRAME_TOTAL_CYCLES;
+		if(gb->frames == c->frames[next]) {
+			err = capture_frame(gb, frame);
+			if(err == ERR_NONE) {
+				err = check_frame(suite, c, next, frame);
+			}
+			++next;
+		}
+	}
+	gameboy_free(gb);
+	free(gb);
+	return err;
+}
+
+// ======================================================================
+static void run_job(void* data, size_t job)
+{
+	golden_suite_t* suite = data;
+	golden_case_t* c = &suite->cases[job];
+	c->err = run_case(suite, c);
+	if(c->err != ERR_NONE) {
+		for(size_t i = 0; i < c->nb_frames; ++i) {
+			if(c->status[i] == FRAME_PENDING) {
+				c->status[i] = FRAME_ERROR;
+			}
+		}
+	}
+}
+
+// ======================================================================
+/**
+ * @brief Parses one manifest line into a case, returns ERR_IO if malformed
+ */
+static int parse_case(const golden_suite_t* suite, const char* line, golden_case_t* c)
+{
+	memset(c, 0, sizeof(*c));
+	char frames[LINE_SIZE];
+	char movie[LINE_SIZE];
+	int end = INIT_VALUE;
+	if(sscanf(line, "%1023s %1023s %n", frames, movie, &end) != 2 || line[end] == '\0') {
+		return ERR_IO;
+	}
+
+	char rom[LINE_SIZE];
+	strncpy(rom, line + end, sizeof(rom) - 1);
+	rom[sizeof(rom) - 1] = '\0';
+	rom[strcspn(rom, "\r\n")] = '\0';
+	if(snprintf(c->rom, sizeof(c->rom), "%s%s", suite->dir, rom) >= (int) sizeof(c->rom)
+	   || (strcmp(movie, "-") && snprintf(c->movie, sizeof(c->movie), "%s%s", suite->dir, movie)
+		   >= (int) sizeof(c->movie))) {
+		return ERR_IO;
+	}
+	const char* slash = strrchr(rom, '/');
+	strncpy(c->name, slash == NULL ? rom : slash + 1, sizeof(c->name) - 1);
+	char* dot = strrchr(c->name, '.');
+	if(dot != NULL) {
+		*dot = '\0';
+	}
+
+	for(char* f = strtok(frames, ","); f != NULL; f = strtok(NULL, ",")) {
+		char* f_end = NULL;
+		const uint64_t frame = strtoull(f, &f_end, 10);
+		if(*f_end != '\0' || frame == 0 || c->nb_frames == MAX_FRAMES
+		   || (c->nb_frames > 0 && frame <= c->frames[c->nb_frames - 1])) {
+			return ERR_IO;
+		}
+		c->frames[c->nb_frames++] = frame;
+	}
+	return c->nb_frames > 0 ? ERR_NONE : ERR_IO;
+}
+
+// ======================================================================
+static int read_manifest(golden_suite_t* suite, const char* filename)
+{
+	const char* slash = strrchr(filename, '/');
+	const size_t dir_length = slash == NULL ? 0 : (size_t) (slash - filename) + 1;
+	if(dir_length >= sizeof(suite->dir)) {
+		return ERR_BAD_PARAMETER;
+	}
+	memcpy(suite->dir, filename, dir_length);
+	suite->dir[dir_length] = '\0';
+
+	FILE* file = fopen(filename, "r");
+	if(file == NULL) {
+		return ERR_IO;
+	}
+	char line[LINE_SIZE];
+	int err = ERR_NONE;
+	while(err == ERR_NONE && fgets(line, sizeof(line), file) != NULL) {
+		const char* start = line + strspn(line, " \t");
+		if(*start == '#' || *start == '\n' || *start == '\0') {
+			continue;
+		}
+		golden_case_t* cases = realloc(suite->cases, (suite->nb_cases + 1) * sizeof(golden_case_t));
+		if(cases == NULL) {
+			err = ERR_MEM;
+			break;
+		}
+		suite->cases = cases;
+		err = parse_case(suite, start, &cases[suite->nb_cases]);
+		++suite->nb_cases;
+	}
+	fclose(file);
+	return err;
+}
+
+// ======================================================================
+static const char* status_name(frame_status_t status)
+{
+	switch(status) {
+	case FRAME_MATCH:
+		return "ok";
+	case FRAME_DIFF:
+		return "DIFF";
+	case FRAME_MISSING:
+		return "MISSING";
+	case FRAME_UPDATED:
+		return "updated";
+	default:
+		return "ERROR";
+	}
+}
+
+// ======================================================================
+int main(int argc, char *argv[])
+{
+	golden_suite_t suite;
+	memset(&suite, 0, sizeof(suite));
+	suite.output = ".";
+	long nb_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	const char* manifest = NULL;
+
+	for(int i = 1; i < argc; ++i) {
+		if(!strcmp(argv[i], "--update")) {
+			suite.update = 1;
+		} else if(!strcmp(argv[i], "--jobs") && i + 1 < argc) {
+			nb_threads = strtol(argv[++i], NULL, 10);
+		} else if(!strcmp(argv[i], "--output") && i + 1 < argc) {
+			suite.output = argv[++i];
+		} else if(argv[i][0] != '-' && manifest == NULL) {
+			manifest = argv[i];
+		} else {
+			manifest = NULL;
+			break;
+		}
+	}
+	if(manifest == NULL) {
+		fprintf(stderr, "usage: %s [--update] [--jobs N] [--output DIR] MANIFEST\n", argv[0]);
+		return 2;
+	}
+	if(read_manifest(&suite, manifest) != ERR_NONE || suite.nb_cases == 0) {
+		fprintf(stderr, "%s: cannot read %s\n", argv[0], manifest);
+		free(suite.cases);
+		return 2;
+	}
+
+	FILE* report = harness_report();
+	if(report == NULL) {
+		fprintf(stderr, "%s: cannot redirect stdout\n", argv[0]);
+		free(suite.cases);
+		return 2;
+	}
+	harness_run_jobs(suite.nb_cases, nb_threads, run_job, &suite);
+
+	int status = 0;
+	for(size_t i = 0; i < suite.nb_cases; ++i) {
+		const golden_case_t* c = &suite.cases[i];
+		for(size_t f = 0; f < c->nb_frames; ++f) {
+			fprintf(report, "%s frame %" PRIu64 ": %s", c->name, c->frames[f], status_name(c->status[f]));
+			if(c->status[f] == FRAME_DIFF) {
+				fprintf(report, " (%zu pixels)", c->nb_diffs[f]);
+			}
+			if(c->status[f] == FRAME_ERROR) {
+				fprintf(report, " (%s)", ERR_MESSAGES[c->err - ERR_NONE]);
+			}
+			fputc('\n', report);
+			if(c->status[f] != FRAME_MATCH && c->status[f] != FRAME_UPDATED) {
+				status = c->status[f] == FRAME_ERROR ? 2 : (status == 2 ? 2 : 1);
+			}
+		}
+	}
+	fclose(report);
+	free(suite.cases);
+	return status;
+}
@@ -0,0 +1,100 @@
+/**
+ * @file gbhashcmp.c
+ * @brief Compares the state hashes of two runs and reports the first frame
+ *        at which they diverge
+ *
+ * Usage: gbhashcmp HASH_FILE HASH_FILE
+ *
+ * Exit status: 0 when the common frames match, 1 when they diverge, 2 on
+ * error.
+ *
+ * @date 2020
+ */
+
+#include "state-hash.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#define LINE_SIZE 128
+
+/**
+ * @brief State hash of one frame
+ */
+typedef struct {
+	uint64_t frame;
+	uint64_t cycle;
+	uint64_t hash;
+} frame_hash_t;
+
+// ======================================================================
+static FILE* open_hashes(const char* pgm, const char* filename)
+{
+	char line[LINE_SIZE];
+	FILE* file = fopen(filename, "r");
+	if(file == NULL) {
+		fprintf(stderr, "%s: cannot open %s\n", pgm, filename);
+		return NULL;
+	}
+	if(fgets(line, sizeof(line), file) == NULL
+	   || strncmp(line, STATE_HASH_MAGIC, strlen(STATE_HASH_MAGIC)) != 0) {
+		fprintf(stderr, "%s: %s is not a state hash file\n", pgm, filename);
+		fclose(file);
+		return NULL;
+	}
+	return file;
+}
+
+// ======================================================================
+/**
+ * @brief Reads the next frame hash, returns 0 at the end of the file
+ */
+static int read_hash(FILE* file, frame_hash_t* h)
+{
+	return fscanf(file, "%" SCNu64 " %" SCNu64 " %" SCNx64, &h->frame, &h->cycle, &h->hash) == 3;
+}
+
+// ======================================================================
+int main(int argc, char *argv[])
+{
+	if(argc != 3) {
+		fprintf(stderr, "usage: %s HASH_FILE HASH_FILE\n", argv[0]);
+		return 2;
+	}
+	FILE* files[2] = { open_hashes(argv[0], argv[1]), open_hashes(argv[0], argv[2]) };
+	if(files[0] == NULL || files[1] == NULL) {
+		if(files[0] != NULL) fclose(files[0]);
+		if(files[1] != NULL) fclose(files[1]);
+		return 2;
+	}
+
+	frame_hash_t a, b;
+	uint64_t nb_frames = 0;
+	int status = 0;
+	int more_a = 0, more_b = 0;
+	while((more_a = read_hash(files[0], &a)) && (more_b = read_hash(files[1], &b))) {
+		if(a.frame != b.frame || a.cycle != b.cycle || a.hash != b.hash) {
+			printf("first divergence after %" PRIu64 " matching frames:\n", nb_frames);
+			printf("  %s: frame %" PRIu64 " cycle %" PRIu64 " hash %016" PRIX64 "\n",
+				   argv[1], a.frame, a.cycle, a.hash);
+			printf("  %s: frame %" PRIu64 " cycle %" PRIu64 " hash %016" PRIX64 "\n",
+				   argv[2], b.frame, b.cycle, b.hash);
+			status = 1;
+			break;
+		}
+		++nb_frames;
+	}
+	if(status == 0) {
+		printf("%" PRIu64 " frames match", nb_frames);
+		if(more_a) {
+			printf(" (%s has more frames)", argv[1]);
+		} else if(read_hash(files[1], &b)) {
+			printf(" (%s has more frames)", argv[2]);
+		}
+		putchar('\n');
+	}
+	fclose(files[0]);
+	fclose(files[1]);
+	return status;
+}
@@ -0,0 +1,333 @@
+/**
+ * @file gbheadless.c
+ * @brief Runs a ROM without any display and writes its frames to a file
+ *        or a pipe, as fast as possible or at a fixed rate
+ *
+ * No GTK is linked in, so no display server is needed. Each iteration runs
+ * the gameboy for at most one frame period and writes its screen: each
+ * completed frame (at VBLANK), or the display as it is while the LCD
+ * controller is off, so that the stream keeps one frame per period.
+ *
+ * Usage: gbheadless [options] ROM
+ *   --output F     file, - for stdout (default) or pattern of one file per
+ *                  frame, with one integer conversion (e.g. frame%05d.pgm)
+ *   --format F     raw8 (one grey byte per pixel, default), raw2 (2 bits
+ *                  per pixel, 4 pixels per byte) or pgm (a P5 image per frame)
+ *   --frames N     stops after N frames (default: never)
+ *   --fps N        writes N frames per second (default: as fast as possible)
+ *   --trace FILE   writes a binary trace of the instructions (see gbtrace)
+ *   --record FILE  records every frame, compressed (see gbplay)
+ *   --movie FILE   records the key events, by cycle (see movie.h)
+ *   --play FILE    plays the key events of a movie back
+ *   --hash FILE    writes a hash of the state at each frame (see gbhashcmp)
+ *
+ * @date 2020
+ */
+
+#include "error.h"
+#include "gameboy.h"
+#include "image.h"
+#include "lcdc.h"
+#include "util.h"
+
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define GREY_SCALE(x) (255 - 85 * x)
+#define PIXELS_PER_BYTE 4
+#define BITS_PER_PIXEL 2
+#define BILLION 1000000000
+
+// conversion of the pattern of --output: flags and width, then its type
+#define PATTERN_FLAGS "-+ #0123456789"
+#define PATTERN_CONVERSIONS "diouxX"
+#define PATTERN_LENGTH "ll"     // inserted, the frame index being an unsigned long long
+
+/**
+ * @brief Formats of the frames written
+ */
+typedef enum {
+	FORMAT_RAW8,	// one grey byte per pixel
+	FORMAT_RAW2,	// 2 bits per pixel (color index), 4 pixels per byte, first one in the MSBs
+	FORMAT_PGM		// binary PGM image (P5) per frame
+} frame_format_t;
+
+static const char* const format_names[] = { "raw8", "raw2", "pgm" };
+#define NB_FORMATS (sizeof(format_names) / sizeof(format_names[0]))
+
+typedef struct {
+	frame_format_t format;
+	const char* output;		// "-" for stdout, a file, or a pattern (e.g. frame%05d.pgm) for one file per frame
+	char pattern[FILENAME_MAX];	// output with the conversion of an unsigned long long (see parse_pattern())
+	uint64_t nb_frames;		// 0 for no limit
+	unsigned long fps;		// 0 for as fast as possible
+} headless_options_t;
+
+static gameboy_t gb;
+
+// ======================================================================
+/**
+ * @brief Checks that the pattern of the frame files has exactly one
+ *        integer conversion (flags and width, no length: "%%" aside), and
+ *        rewrites it for a frame index given as an unsigned long long
+ *
+ * @param output pattern given by --output
+ * @param pattern (output) pattern to format the file names with
+ * @return error code
+ */
+static int parse_pattern(const char* output, char pattern[FILENAME_MAX])
+{
+	// (the pattern written is the output with PATTERN_LENGTH inserted once)
+	if(strlen(output) + strlen(PATTERN_LENGTH) >= FILENAME_MAX) {
+		return ERR_BAD_PARAMETER;
+	}
+	size_t length = 0;
+	int nb_conversions = 0;
+	for(const char* c = output; *c != '\0'; ++c) {
+		pattern[length++] = *c;
+		if(*c != '%') {
+			continue;
+		}
+		if(c[1] == '%') {
+			pattern[length++] = *++c;
+			continue;
+		}
+		while(c[1] != '\0' && strchr(PATTERN_FLAGS, c[1]) != NULL) {
+			pattern[length++] = *++c;
+		}
+		if(nb_conversions > 0 || c[1] == '\0' || strchr(PATTERN_CONVERSIONS, c[1]) == NULL) {
+			return ERR_BAD_PARAMETER;
+		}
+		memcpy(pattern + length, PATTERN_LENGTH, strlen(PATTERN_LENGTH));
+		length += strlen(PATTERN_LENGTH);
+		++c;
+		// (the index is never negative: a signed conversion prints it unsigned)
+		pattern[length++] = *c == 'd' || *c == 'i' ? 'u' : *c;
+		++nb_conversions;
+	}
+	pattern[length] = '\0';
+	return nb_conversions == 1 ? ERR_NONE : ERR_BAD_PARAMETER;
+}
+
+// ======================================================================
+static int capture_frame(uint8_t frame[LCD_HEIGHT][LCD_WIDTH])
+{
+	for(size_t y = 0; y < LCD_HEIGHT; y++) {
+		M_EXIT_IF_ERR(image_get_line_pixels(frame[y], &gb.screen.display, y));
+	}
+	return ERR_NONE;
+}
+
+// ======================================================================
+static int write_frame(FILE* output, frame_format_t format, uint8_t frame[LCD_HEIGHT][LCD_WIDTH])
+{
+	if(format == FORMAT_PGM) {
+		fprintf(output, "P5\n%d %d\n255\n", LCD_WIDTH, LCD_HEIGHT);
+	}
+	for(int y = 0; y < LCD_HEIGHT; y++) {
+		uint8_t line[LCD_WIDTH];
+		size_t size = LCD_WIDTH;
+		if(format == FORMAT_RAW2) {
+			size = LCD_WIDTH / PIXELS_PER_BYTE;
+			for(size_t i = 0; i < size; i++) {
+				line[i] = 0;
+				for(int p = 0; p < PIXELS_PER_BYTE; p++) {
+					line[i] = (uint8_t) (line[i] << BITS_PER_PIXEL | frame[y][i * PIXELS_PER_BYTE + p]);
+				}
+			}
+		} else {
+			for(int x = 0; x < LCD_WIDTH; x++) {
+				line[x] = (uint8_t) GREY_SCALE(frame[y][x]);
+			}
+		}
+		if(fwrite(line, 1, size, output) != size) {
+			return ERR_IO;
+		}
+	}
+	return ERR_NONE;
+}
+
+// ======================================================================
+static int output_frame(const headless_options_t* options, FILE* stream, uint64_t index,
+						uint8_t frame[LCD_HEIGHT][LCD_WIDTH])
+{
+	if(stream != NULL) {
+		return write_frame(stream, options->format, frame);
+	}
+	char filename[FILENAME_MAX];
+	const int length = snprintf(filename, sizeof(filename), options->pattern, (unsigned long long) index);
+	if(length < 0 || (size_t) length >= sizeof(filename)) {
+		return ERR_BAD_PARAMETER;
+	}
+	FILE* file = fopen(filename, "wb");
+	if(file == NULL) {
+		return ERR_IO;
+	}
+	const int err = write_frame(file, options->format, frame);
+	return fclose(file) == 0 ? err : ERR_IO;
+}
+
+// ======================================================================
+/**
+ * @brief Runs the gameboy and writes one frame per frame period: each
+ *        completed one (at VBLANK), or the display as it is while the LCD
+ *        controller is off, so that the stream keeps its rate
+ */
+static int headless_run(const headless_options_t* options)
+{
+	FILE* stream = NULL;
+	if(!strcmp(options->output, "-")) {
+		// the frames keep stdout for themselves, anything else printed goes to stderr
+		const int fd = dup(STDOUT_FILENO);
+		stream = fd < 0 ? NULL : fdopen(fd, "wb");
+		if(stream == NULL || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+			return ERR_IO;
+		}
+	} else if(strchr(options->output, '%') == NULL) {
+		stream = fopen(options->output, "wb");
+		if(stream == NULL) {
+			return ERR_IO;
+		}
+	}
+	// a closed pipe ends the run (with an error) instead of killing it
+	signal(SIGPIPE, SIG_IGN);
+
+	uint8_t frame[LCD_HEIGHT][LCD_WIDTH];
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	int err = ERR_NONE;
+	for(uint64_t i = 0; err == ERR_NONE && (options->nb_frames == 0 || i < options->nb_frames); i++) {
+		err = gameboy_run_frame(&gb, gb.cycles + FRAME_TOTAL_CYCLES);
+		if(err == ERR_NONE) {
+			err = capture_frame(frame);
+		}
+		if(err == ERR_NONE) {
+			err = output_frame(options, stream, i, frame);
+		}
+		if(options->fps != 0) {
+			deadline.tv_nsec += (long) (BILLION / options->fps);
+			deadline.tv_sec += deadline.tv_nsec / BILLION;
+			deadline.tv_nsec %= BILLION;
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+		}
+	}
+
+	if(stream != NULL && fclose(stream) != 0 && err == ERR_NONE) {
+		err = ERR_IO;
+	}
+	return err;
+}
+
+// ======================================================================
+static void error(const char* pgm, const char* msg)
+{
+	fprintf(stderr, "ERROR: %s\n", msg);
+	fprintf(stderr, "usage:    %s [options] input_file\n", pgm);
+	fprintf(stderr, "options:  --output F   file, - for stdout (default) or pattern such as frame%%05d.pgm\n");
+	fprintf(stderr, "          --format F   raw8 (grey bytes, default), raw2 (2 bits per pixel) or pgm\n");
+	fprintf(stderr, "          --frames N   stop after N frames (default: never)\n");
+	fprintf(stderr, "          --fps N      write N frames per second (default: as fast as possible)\n");
+	fprintf(stderr, "          --trace FILE write a binary trace of the instructions (see gbtrace)\n");
+	fprintf(stderr, "          --record FILE record every frame, compressed (see gbplay)\n");
+	fprintf(stderr, "          --movie FILE record the key events, by cycle (see movie.h)\n");
+	fprintf(stderr, "          --play FILE  play the key events of a movie back\n");
+	fprintf(stderr, "          --hash FILE  write a hash of the state at each frame (see gbhashcmp)\n");
+	fprintf(stderr, "examples: %s --frames 600 game.gb > game.raw\n", pgm);
+	fprintf(stderr, "          %s --play game.movie --frames 3600 game.gb > game.raw\n", pgm);
+	fprintf(stderr, "          %s --format pgm --frames 600 --output 'f%%04d.pgm' game.gb\n", pgm);
+}
+
+// ======================================================================
+int main(int argc, char *argv[])
+{
+	const char* filename = NULL;
+	const char* trace_filename = NULL;
+	const char* record_filename = NULL;
+	const char* movie_filename = NULL;
+	const char* hash_filename = NULL;
+	movie_mode_t movie_mode = MOVIE_RECORD;
+	headless_options_t options = { FORMAT_RAW8, "-", "", 0, 0 };
+	for(int i = 1; i < argc; ++i) {
+		if(!strcmp(argv[i], "--output") && i + 1 < argc) {
+			options.output = argv[++i];
+		} else if(!strcmp(argv[i], "--frames") && i + 1 < argc) {
+			options.nb_frames = strtoull(argv[++i], NULL, 10);
+		} else if(!strcmp(argv[i], "--fps") && i + 1 < argc) {
+			options.fps = strtoul(argv[++i], NULL, 10);
+		} else if(!strcmp(argv[i], "--format") && i + 1 < argc) {
+			++i;
+			size_t f = 0;
+			while(f < NB_FORMATS && strcmp(argv[i], format_names[f])) ++f;
+			if(f == NB_FORMATS) {
+				error(argv[0], "unknown format");
+				return 1;
+			}
+			options.format = (frame_format_t) f;
+		} else if(!strcmp(argv[i], "--trace") && i + 1 < argc) {
+			trace_filename = argv[++i];
+		} else if(!strcmp(argv[i], "--record") && i + 1 < argc) {
+			record_filename = argv[++i];
+		} else if(!strcmp(argv[i], "--movie") && i + 1 < argc) {
+			movie_filename = argv[++i];
+			movie_mode = MOVIE_RECORD;
+		} else if(!strcmp(argv[i], "--play") && i + 1 < argc) {
+			movie_filename = argv[++i];
+			movie_mode = MOVIE_PLAY;
+		} else if(!strcmp(argv[i], "--hash") && i + 1 < argc) {
+			hash_filename = argv[++i];
+		} else if(argv[i][0] == '-') {
+			error(argv[0], "unknown option");
+			return 1;
+		} else {
+			filename = argv[i];
+		}
+	}
+	if(filename == NULL) {
+		error(argv[0], "please provide input_file");
+		return 1;
+	}
+	if(strchr(options.output, '%') != NULL && parse_pattern(options.output, options.pattern) != ERR_NONE) {
+		error(argv[0], "the --output pattern needs exactly one integer conversion, such as %05d");
+		return 1;
+	}
+
+	zero_init_var(gb);
+	int err = gameboy_create(&gb, filename);
+	if(err == ERR_NONE && trace_filename != NULL) {
+		err = gameboy_trace_start(&gb, trace_filename, TRACE_DEFAULT_RECORDS);
+		if(err != ERR_NONE) {
+			fprintf(stderr, "%s: cannot write the trace file\n", argv[0]);
+		}
+	}
+	if(err == ERR_NONE && record_filename != NULL) {
+		err = gameboy_record_start(&gb, record_filename, RECORDER_DEFAULT_KEYFRAMES);
+		if(err != ERR_NONE) {
+			fprintf(stderr, "%s: cannot write the recording\n", argv[0]);
+		}
+	}
+	if(err == ERR_NONE && movie_filename != NULL) {
+		err = gameboy_movie_start(&gb, movie_filename, movie_mode);
+		if(err != ERR_NONE) {
+			fprintf(stderr, "%s: cannot %s the movie\n", argv[0], movie_mode == MOVIE_PLAY ? "read" : "write");
+		}
+	}
+	if(err == ERR_NONE && hash_filename != NULL) {
+		err = gameboy_hash_start(&gb, hash_filename);
+		if(err != ERR_NONE) {
+			fprintf(stderr, "%s: cannot write the hash file\n", argv[0]);
+		}
+	}
+	if(err == ERR_NONE) {
+		err = headless_run(&options);
+	}
+	if(err != ERR_NONE) {
+		fprintf(stderr, "%s: %s\n", argv[0], ERR_MESSAGES[err - ERR_NONE]);
+	}
+	gameboy_free(&gb);
+	return err;
+}
@@ -0,0 +1,169 @@
+/**
+ * @file gbplay.c
+ * @brief Exports (or describes) the recordings written by the emulator
+ *
+ * Usage: gbplay [options] RECORDING_FILE
+ *
+ * @date 2020
+ */
+
+#include "recorder.h"
+#include "error.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define GREY_SCALE(x) (255 - 85 * (x))
+
+/**
+ * @brief What frames to export and how (all ranges are inclusive)
+ */
+typedef struct {
+	uint64_t from;
+	uint64_t to;
+	int pgm;                // PGM images instead of raw grey bytes
+	const char* output;     // "-" for stdout, a file, or a printf pattern (one file per frame)
+	int info;               // only describe the recording
+} options_t;
+
+// ======================================================================
+static void usage(const char* pgm)
+{
+	fprintf(stderr, "usage:   %s [options] RECORDING_FILE\n", pgm);
+	fprintf(stderr, "options: --from FRAME    --to FRAME\n");
+	fprintf(stderr, "         --format F      raw8 (grey bytes, default) or pgm\n");
+	fprintf(stderr, "         --output F      file, - for stdout (default) or pattern such as frame%%05d.pgm\n");
+	fprintf(stderr, "         --info          print the size and rate of the recording only\n");
+}
+
+// ======================================================================
+static int write_frame(FILE* output, int pgm, uint8_t frame[LCD_HEIGHT][LCD_WIDTH])
+{
+	if(pgm) {
+		fprintf(output, "P5\n%d %d\n255\n", LCD_WIDTH, LCD_HEIGHT);
+	}
+	for(int y = 0; y < LCD_HEIGHT; y++) {
+		uint8_t line[LCD_WIDTH];
+		for(int x = 0; x < LCD_WIDTH; x++) {
+			line[x] = (uint8_t) GREY_SCALE(frame[y][x]);
+		}
+		if(fwrite(line, 1, LCD_WIDTH, output) != LCD_WIDTH) {
+			return ERR_IO;
+		}
+	}
+	return ERR_NONE;
+}
+
+// ======================================================================
+static void print_info(const recording_t* rec, const char* filename)
+{
+	const double fps = (double) rec->header.cycles_per_s / rec->header.cycles_per_frame;
+	printf("file:       %s\n", filename);
+	printf("size:       %" PRIu16 "x%" PRIu16 "\n", rec->header.width, rec->header.height);
+	printf("frames:     %" PRIu64 " (%.2f s at %.2f fps)\n",
+		   rec->trailer.nb_frames, rec->trailer.nb_frames / fps, fps);
+	printf("keyframes:  %" PRIu64 " (every %" PRIu32 " frames)\n",
+		   rec->trailer.nb_keyframes, rec->header.keyframe_interval);
+	if(rec->trailer.nb_frames != 0) {
+		printf("bytes:      %" PRIu64 " per frame (raw: %d)\n",
+			   rec->trailer.index_offset / rec->trailer.nb_frames, RECORDER_FRAME_SIZE);
+	}
+}
+
+// ======================================================================
+static int export_frames(recording_t* rec, const options_t* options)
+{
+	FILE* stream = NULL;
+	if(!strcmp(options->output, "-")) {
+		stream = stdout;
+	} else if(strchr(options->output, '%') == NULL) {
+		stream = fopen(options->output, "wb");
+		if(stream == NULL) {
+			return ERR_IO;
+		}
+	}
+
+	int err = ERR_NONE;
+	const uint64_t last = options->to < rec->trailer.nb_frames ? options->to : rec->trailer.nb_frames - 1;
+	for(uint64_t i = options->from; err == ERR_NONE && rec->trailer.nb_frames != 0 && i <= last; i++) {
+		uint8_t frame[LCD_HEIGHT][LCD_WIDTH];
+		err = recording_read(rec, i, frame);
+		if(err == ERR_NONE && stream != NULL) {
+			err = write_frame(stream, options->pgm, frame);
+		} else if(err == ERR_NONE) {
+			char filename[FILENAME_MAX];
+			snprintf(filename, sizeof(filename), options->output, i);
+			FILE* file = fopen(filename, "wb");
+			if(file == NULL) {
+				err = ERR_IO;
+			} else {
+				err = write_frame(file, options->pgm, frame);
+				if(fclose(file) != 0 && err == ERR_NONE) {
+					err = ERR_IO;
+				}
+			}
+		}
+	}
+
+	if(stream != NULL && fclose(stream) != 0 && err == ERR_NONE) {
+		err = ERR_IO;
+	}
+	return err;
+}
+
+// ======================================================================
+int main(int argc, char *argv[])
+{
+	options_t options = { 0, UINT64_MAX, 0, "-", 0 };
+	const char* filename = NULL;
+
+	for(int i = 1; i < argc; ++i) {
+		const int has_value = i + 1 < argc;
+		int ok = 1;
+		if(!strcmp(argv[i], "--from") && has_value) {
+			options.from = strtoull(argv[++i], NULL, 0);
+		} else if(!strcmp(argv[i], "--to") && has_value) {
+			options.to = strtoull(argv[++i], NULL, 0);
+		} else if(!strcmp(argv[i], "--format") && has_value) {
+			++i;
+			options.pgm = !strcmp(argv[i], "pgm");
+			ok = options.pgm || !strcmp(argv[i], "raw8");
+		} else if(!strcmp(argv[i], "--output") && has_value) {
+			options.output = argv[++i];
+		} else if(!strcmp(argv[i], "--info")) {
+			options.info = 1;
+		} else if(argv[i][0] != '-' && filename == NULL) {
+			filename = argv[i];
+		} else {
+			ok = 0;
+		}
+		if(!ok) {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if(filename == NULL) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	recording_t rec;
+	if(recording_open(&rec, filename) != ERR_NONE) {
+		fprintf(stderr, "%s: %s is not a complete recording of this version\n", argv[0], filename);
+		return 1;
+	}
+	int err = ERR_NONE;
+	if(options.info) {
+		print_info(&rec, filename);
+	} else {
+		err = export_frames(&rec, &options);
+	}
+	recording_close(&rec);
+	if(err != ERR_NONE) {
+		fprintf(stderr, "%s: %s\n", argv[0], ERR_MESSAGES[err - ERR_NONE]);
+		return 1;
+	}
+	return 0;
+}
@@ -6,8 +6,12 @@
 #include "util.h"
 #include <sys/time.h>
 
+#include <pthread.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 // Key press bits
 #define MY_KEY_UP_BIT    	0x01
@@ -22,11 +26,29 @@
 #define SCALE 3
 #define GREY_SCALE(x) (255 - 85 * x)
 #define MILLION 1000000
+#define IDLE_SLEEP_NS 1000000
 
 gameboy_t gb;
 struct timeval start; 
 struct timeval paused;
 
+// guards gb, start and paused, which the emulation thread shares with GTK
+pthread_mutex_t gb_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Pipelined mode: the emulation runs on its own thread and publishes every
+ * completed frame (at VBLANK) ; the GTK timer then only scales the last
+ * published frame, so both overlap on multi-core hosts.
+ */
+bool pipelined = false;
+bool emulation_running = false; // guarded by gb_lock
+pthread_t emulation_thread;
+
+// front frame is read by GTK, back one is written by the emulation thread
+pthread_mutex_t frame_lock = PTHREAD_MUTEX_INITIALIZER;
+uint8_t frames[2][LCD_HEIGHT][LCD_WIDTH];
+int front_frame = 0; // guarded by frame_lock
+
 // ======================================================================
 uint64_t get_time_in_GB_cycles_since(struct timeval* from) {
 	struct timeval time;
@@ -49,18 +71,72 @@ static void set_grey(guchar* pixels, int row, int col, int width, guchar grey)
 }
 
 // ======================================================================
-static void generate_image(guchar* pixels, int height, int width)
+static int capture_frame(uint8_t frame[LCD_HEIGHT][LCD_WIDTH])
+{
+	for(size_t y = 0; y < LCD_HEIGHT; y++) {
+		M_EXIT_IF_ERR(image_get_line_pixels(frame[y], &gb.screen.display, y));
+	}
+	return ERR_NONE;
+}
+
+// ======================================================================
+static void scale_frame(guchar* pixels, int height, int width, uint8_t frame[LCD_HEIGHT][LCD_WIDTH])
 {
-	uint64_t cycles = get_time_in_GB_cycles_since(&start);	
-	gameboy_run_until(&gb, cycles);
-	
 	for(int y = 0; y < height; y++) {
 		for(int x = 0; x < width; x++) {
-			uint8_t output;
-			image_get_pixel(&output, &gb.screen.display, x / SCALE, y / SCALE);
-			set_grey(pixels, y, x, width, GREY_SCALE(output));
+			set_grey(pixels, y, x, width, GREY_SCALE(frame[y / SCALE][x / SCALE]));
+		}
+	}
+}
+
+// ======================================================================
+static void* emulation_loop(void* arg _unused)
+{
+	struct timespec idle = { 0, IDLE_SLEEP_NS };
+
+	pthread_mutex_lock(&gb_lock);
+	while(emulation_running) {
+		bool late = false;
+		bool new_frame = false;
+		if(!timerisset(&paused)) {
+			const uint64_t cycle = get_time_in_GB_cycles_since(&start);
+			const uint64_t frame = gb.frames;
+			if(gameboy_run_frame(&gb, cycle) != ERR_NONE) {
+				emulation_running = false;
+			}
+			new_frame = gb.frames != frame && capture_frame(frames[1 - front_frame]) == ERR_NONE;
+			late = gb.cycles < cycle;
+		}
+		pthread_mutex_unlock(&gb_lock);
+
+		if(new_frame) {
+			pthread_mutex_lock(&frame_lock);
+			front_frame = 1 - front_frame;
+			pthread_mutex_unlock(&frame_lock);
 		}
-	}	
+		if(!late) {
+			nanosleep(&idle, NULL);
+		}
+		pthread_mutex_lock(&gb_lock);
+	}
+	pthread_mutex_unlock(&gb_lock);
+	return NULL;
+}
+
+// ======================================================================
+static void generate_image(guchar* pixels, int height, int width)
+{
+	if(pipelined) {
+		pthread_mutex_lock(&frame_lock);
+		scale_frame(pixels, height, width, frames[front_frame]);
+		pthread_mutex_unlock(&frame_lock);
+		return;
+	}
+
+	uint64_t cycles = get_time_in_GB_cycles_since(&start);	
+	gameboy_run_until(&gb, cycles);
+	capture_frame(frames[front_frame]);
+	scale_frame(pixels, height, width, frames[front_frame]);
 }
 
 // ======================================================================
@@ -68,7 +144,9 @@ static void generate_image(guchar* pixels, int height, int width)
     do { \
         if (! (psd->key_status & MY_KEY_ ## X ##_BIT)) { \
             psd->key_status |= MY_KEY_ ## X ##_BIT; \
-            joypad_key_pressed(&gb.pad, X ##_KEY); \
+            pthread_mutex_lock(&gb_lock); \
+            gameboy_key(&gb, X ##_KEY, 1); \
+            pthread_mutex_unlock(&gb_lock); \
         } \
     } while(0)
 
@@ -115,6 +193,7 @@ static gboolean keypress_handler(guint keyval, gpointer data)
 	case GDK_KEY_space: {
 			struct timeval time;
 			gettimeofday(&time, NULL);
+			pthread_mutex_lock(&gb_lock);
 			if(psd->timeout_id > 0) {
 				paused = time;
 			} else {
@@ -122,6 +201,7 @@ static gboolean keypress_handler(guint keyval, gpointer data)
 				timeradd(&start, &paused, &start);
 				timerclear(&paused);
 			}
+			pthread_mutex_unlock(&gb_lock);
 			return ds_simple_key_handler(keyval, data);
 		}
     }
@@ -135,7 +215,9 @@ static gboolean keypress_handler(guint keyval, gpointer data)
     do { \
         if (psd->key_status & MY_KEY_ ## X ##_BIT) { \
           psd->key_status &= (unsigned char) ~MY_KEY_ ## X ##_BIT; \
-            joypad_key_released(&gb.pad, X ##_KEY); \
+            pthread_mutex_lock(&gb_lock); \
+            gameboy_key(&gb, X ##_KEY, 0); \
+            pthread_mutex_unlock(&gb_lock); \
         } \
     } while(0)
 
@@ -189,32 +271,116 @@ static void error(const char* pgm, const char* msg)
 {
     fputs("ERROR: ", stderr);
     if (msg != NULL) fputs(msg, stderr);
-    fprintf(stderr, "\nusage:    %s input_file [iterations]\n", pgm);
-    fprintf(stderr, "examples: %s rom.gb 1000\n", pgm);
-    fprintf(stderr, "          %s game.gb\n", pgm);
+    fprintf(stderr, "\nusage:    %s [options] input_file\n", pgm);
+    fprintf(stderr, "options:  --pipelined  emulate on a separate thread from rendering\n");
+    fprintf(stderr, "          --trace FILE write a binary trace of the instructions (see gbtrace)\n");
+    fprintf(stderr, "          --record FILE record every frame, compressed (see gbplay)\n");
+    fprintf(stderr, "          --movie FILE record the key events, by cycle (see movie.h)\n");
+    fprintf(stderr, "          --play FILE  play the key events of a movie back\n");
+    fprintf(stderr, "          --hash FILE  write a hash of the state at each frame (see gbhashcmp)\n");
+    fprintf(stderr, "examples: %s game.gb\n", pgm);
+    fprintf(stderr, "          %s --pipelined game.gb\n", pgm);
+    fprintf(stderr, "          %s --trace game.trace game.gb\n", pgm);
+    fprintf(stderr, "          %s --record game.gbrec game.gb\n", pgm);
+    fprintf(stderr, "          %s --movie game.movie game.gb\n", pgm);
 }
 // ======================================================================
 int main(int argc, char *argv[])
 {
-	if (argc < 2) {
+    const char* filename = NULL;
+    const char* trace_filename = NULL;
+    const char* record_filename = NULL;
+    const char* movie_filename = NULL;
+    const char* hash_filename = NULL;
+    movie_mode_t movie_mode = MOVIE_RECORD;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--pipelined")) {
+            pipelined = true;
+        } else if (!strcmp(argv[i], "--trace") && i + 1 < argc) {
+            trace_filename = argv[++i];
+        } else if (!strcmp(argv[i], "--record") && i + 1 < argc) {
+            record_filename = argv[++i];
+        } else if (!strcmp(argv[i], "--movie") && i + 1 < argc) {
+            movie_filename = argv[++i];
+            movie_mode = MOVIE_RECORD;
+        } else if (!strcmp(argv[i], "--play") && i + 1 < argc) {
+            movie_filename = argv[++i];
+            movie_mode = MOVIE_PLAY;
+        } else if (!strcmp(argv[i], "--hash") && i + 1 < argc) {
+            hash_filename = argv[++i];
+        } else if (argv[i][0] == '-') {
+            error(argv[0], "unknown option");
+            return 1;
+        } else {
+            filename = argv[i];
+        }
+    }
+    if (filename == NULL) {
         error(argv[0], "please provide input_file");
         return 1;
     }
 
-    const char* const filename = argv[1];
-
     zero_init_var(gb);
     int err = gameboy_create(&gb, filename);
     if (err != ERR_NONE) {
         gameboy_free(&gb);
         return err;
     }
+    if (trace_filename != NULL) {
+        err = gameboy_trace_start(&gb, trace_filename, TRACE_DEFAULT_RECORDS);
+        if (err != ERR_NONE) {
+            error(argv[0], "cannot write the trace file");
+            gameboy_free(&gb);
+            return err;
+        }
+    }
+    if (record_filename != NULL) {
+        err = gameboy_record_start(&gb, record_filename, RECORDER_DEFAULT_KEYFRAMES);
+        if (err != ERR_NONE) {
+            error(argv[0], "cannot write the recording");
+            gameboy_free(&gb);
+            return err;
+        }
+    }
+    if (movie_filename != NULL) {
+        err = gameboy_movie_start(&gb, movie_filename, movie_mode);
+        if (err != ERR_NONE) {
+            error(argv[0], movie_mode == MOVIE_PLAY ? "cannot read the movie" : "cannot write the movie");
+            gameboy_free(&gb);
+            return err;
+        }
+    }
+    if (hash_filename != NULL) {
+        err = gameboy_hash_start(&gb, hash_filename);
+        if (err != ERR_NONE) {
+            error(argv[0], "cannot write the hash file");
+            gameboy_free(&gb);
+            return err;
+        }
+    }
+
     timerclear(&paused);
     gettimeofday(&start, NULL);
+
+    if (pipelined) {
+        emulation_running = true;
+        if (pthread_create(&emulation_thread, NULL, emulation_loop, NULL) != 0) {
+            error(argv[0], "cannot start emulation thread");
+            gameboy_free(&gb);
+            return 1;
+        }
+    }
     
 	sd_launch(&argc, &argv,
 			  sd_init("GameBoy Simulator", LCD_WIDTH * SCALE, LCD_HEIGHT * SCALE, 40,
 					  generate_image, keypress_handler, keyrelease_handler));				  
+
+    if (pipelined) {
+        pthread_mutex_lock(&gb_lock);
+        emulation_running = false;
+        pthread_mutex_unlock(&gb_lock);
+        pthread_join(emulation_thread, NULL);
+    }
 	gameboy_free(&gb);
 
     return 0;
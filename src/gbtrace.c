@@ -0,0 +1,200 @@
+/**
+ * @file gbtrace.c
+ * @brief Prints (and filters) the binary traces written by the emulator
+ *
+ * Usage: gbtrace [options] TRACE_FILE
+ *
+ * @date 2020
+ */
+
+#include "trace.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CHUNK_RECORDS 4096
+#define HEX 16
+
+/**
+ * @brief What records to print (all ranges are inclusive)
+ */
+typedef struct {
+	uint64_t from;
+	uint64_t to;
+	uint16_t pc_low;
+	uint16_t pc_high;
+	uint16_t write_low;
+	uint16_t write_high;
+	int write;          // only records writing into [write_low, write_high]
+	int opcode;         // only this opcode (-1 for any)
+	int interrupts;     // only interrupts
+	int count;          // only print the number of matching records
+} filter_t;
+
+// ======================================================================
+static void usage(const char* pgm)
+{
+	fprintf(stderr, "usage:   %s [options] TRACE_FILE\n", pgm);
+	fprintf(stderr, "options: --from CYCLE    --to CYCLE\n");
+	fprintf(stderr, "         --pc ADDR[-ADDR]      instructions at these addresses (hex)\n");
+	fprintf(stderr, "         --write ADDR[-ADDR]   instructions writing there (hex)\n");
+	fprintf(stderr, "         --op XX               instructions with this opcode (hex)\n");
+	fprintf(stderr, "         --interrupts          interrupt dispatches only\n");
+	fprintf(stderr, "         --count               print the number of records only\n");
+}
+
+// ======================================================================
+/**
+ * @brief Parses ADDR or ADDR-ADDR (hexadecimal)
+ */
+static int parse_range(const char* s, uint16_t* low, uint16_t* high)
+{
+	char* end = NULL;
+	const unsigned long first = strtoul(s, &end, HEX);
+	unsigned long last = first;
+	if(end == s) {
+		return 0;
+	}
+	if(*end == '-') {
+		const char* second = end + 1;
+		last = strtoul(second, &end, HEX);
+		if(end == second) {
+			return 0;
+		}
+	}
+	if(*end != '\0' || first > UINT16_MAX || last > UINT16_MAX || last < first) {
+		return 0;
+	}
+	*low = (uint16_t) first;
+	*high = (uint16_t) last;
+	return 1;
+}
+
+// ======================================================================
+static int matches(const trace_record_t* r, const filter_t* f)
+{
+	if(r->cycle < f->from || r->cycle > f->to || r->pc < f->pc_low || r->pc > f->pc_high) {
+		return 0;
+	}
+	if(f->interrupts && !(r->flags & TRACE_INTERRUPT)) {
+		return 0;
+	}
+	if(f->opcode >= 0 && ((r->flags & TRACE_INTERRUPT) || r->opcode != f->opcode)) {
+		return 0;
+	}
+	if(f->write) {
+		if(!(r->flags & (TRACE_WRITE | TRACE_WRITE16))) {
+			return 0;
+		}
+		// a 16-bit write touches write_addr and write_addr + 1
+		const uint32_t last = r->write_addr + ((r->flags & TRACE_WRITE16) ? 1 : 0);
+		if(last < f->write_low || r->write_addr > f->write_high) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// ======================================================================
+static void print_record(const trace_record_t* r)
+{
+	printf("%12" PRIu64 "  %04" PRIX16 "  ", r->cycle, r->pc);
+	if(r->flags & TRACE_INTERRUPT) {
+		printf("INT  ");
+	} else if(r->flags & TRACE_PREFIXED) {
+		printf("CB %02" PRIX8 "", r->prefixed_opcode);
+	} else {
+		printf("%02" PRIX8 "   ", r->opcode);
+	}
+	printf("  AF=%04" PRIX16 " BC=%04" PRIX16 " DE=%04" PRIX16 " HL=%04" PRIX16
+		   " SP=%04" PRIX16 " IME=%" PRIu8 " IE=%02" PRIX8 " IF=%02" PRIX8,
+		   r->AF, r->BC, r->DE, r->HL, r->SP, r->IME, r->IE, r->IF);
+	if(r->flags & TRACE_WRITE16) {
+		printf("  [%04" PRIX16 "]<-%04" PRIX16, r->write_addr, r->write_value);
+	} else if(r->flags & TRACE_WRITE) {
+		printf("  [%04" PRIX16 "]<-%02" PRIX16, r->write_addr, r->write_value);
+	}
+	if(r->flags & TRACE_ERROR) {
+		printf("  ERROR");
+	}
+	putchar('\n');
+}
+
+// ======================================================================
+int main(int argc, char *argv[])
+{
+	filter_t filter = { 0, UINT64_MAX, 0, UINT16_MAX, 0, UINT16_MAX, 0, -1, 0, 0 };
+	const char* filename = NULL;
+
+	for(int i = 1; i < argc; ++i) {
+		const int has_value = i + 1 < argc;
+		int ok = 1;
+		if(!strcmp(argv[i], "--from") && has_value) {
+			filter.from = strtoull(argv[++i], NULL, 0);
+		} else if(!strcmp(argv[i], "--to") && has_value) {
+			filter.to = strtoull(argv[++i], NULL, 0);
+		} else if(!strcmp(argv[i], "--pc") && has_value) {
+			ok = parse_range(argv[++i], &filter.pc_low, &filter.pc_high);
+		} else if(!strcmp(argv[i], "--write") && has_value) {
+			filter.write = 1;
+			ok = parse_range(argv[++i], &filter.write_low, &filter.write_high);
+		} else if(!strcmp(argv[i], "--op") && has_value) {
+			uint16_t low = 0, high = 0;
+			ok = parse_range(argv[++i], &low, &high) && low == high && low <= UINT8_MAX;
+			filter.opcode = low;
+		} else if(!strcmp(argv[i], "--interrupts")) {
+			filter.interrupts = 1;
+		} else if(!strcmp(argv[i], "--count")) {
+			filter.count = 1;
+		} else if(argv[i][0] != '-' && filename == NULL) {
+			filename = argv[i];
+		} else {
+			ok = 0;
+		}
+		if(!ok) {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if(filename == NULL) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	FILE* file = fopen(filename, "rb");
+	if(file == NULL) {
+		fprintf(stderr, "%s: cannot open %s\n", argv[0], filename);
+		return 1;
+	}
+	trace_header_t header;
+	if(fread(&header, sizeof(header), 1, file) != 1
+	   || memcmp(header.magic, TRACE_MAGIC, TRACE_MAGIC_SIZE) != 0
+	   || header.record_size != sizeof(trace_record_t)) {
+		fprintf(stderr, "%s: %s is not a trace file of this version\n", argv[0], filename);
+		fclose(file);
+		return 1;
+	}
+
+	static trace_record_t records[CHUNK_RECORDS];
+	uint64_t nb_matching = 0;
+	size_t nb_read = 0;
+	while((nb_read = fread(records, sizeof(trace_record_t), CHUNK_RECORDS, file)) > 0) {
+		for(size_t i = 0; i < nb_read; ++i) {
+			if(matches(&records[i], &filter)) {
+				++nb_matching;
+				if(!filter.count) {
+					print_record(&records[i]);
+				}
+			}
+		}
+	}
+	if(filter.count) {
+		printf("%" PRIu64 "\n", nb_matching);
+	}
+
+	const int status = ferror(file) ? 1 : 0;
+	fclose(file);
+	return status;
+}
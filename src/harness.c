@@ -0,0 +1,85 @@
+/**
+ * @file harness.c
+ * @brief What the command-line harnesses share: a report which keeps
+ *        stdout for itself, and a pool of threads running their jobs
+ *
+ * @date 2020
+ */
+
+#include "harness.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define INIT_VALUE 0
+
+/**
+ * @brief Jobs shared by the threads, which take the next one to run
+ */
+typedef struct {
+	size_t nb_jobs;
+	size_t next;
+	harness_job_t run;
+	void* data;
+	pthread_mutex_t lock;
+} harness_pool_t;
+
+// ======================================================================
+FILE* harness_report(void)
+{
+	fflush(stdout);
+	const int fd = dup(STDOUT_FILENO);
+	FILE* report = fd < 0 ? NULL : fdopen(fd, "w");
+	if(report == NULL || freopen("/dev/null", "w", stdout) == NULL) {
+		if(report != NULL) {
+			fclose(report);
+		}
+		return NULL;
+	}
+	return report;
+}
+
+// ======================================================================
+static void* harness_worker(void* arg)
+{
+	harness_pool_t* pool = arg;
+	for(;;) {
+		pthread_mutex_lock(&pool->lock);
+		const size_t job = pool->next < pool->nb_jobs ? pool->next++ : pool->nb_jobs;
+		pthread_mutex_unlock(&pool->lock);
+		if(job == pool->nb_jobs) {
+			return NULL;
+		}
+		pool->run(pool->data, job);
+	}
+}
+
+// ======================================================================
+long harness_run_jobs(size_t nb_jobs, long nb_threads, harness_job_t run, void* data)
+{
+	if(nb_threads < 1) {
+		nb_threads = 1;
+	}
+	if((size_t) nb_threads > nb_jobs) {
+		nb_threads = (long) nb_jobs;
+	}
+	harness_pool_t pool = { nb_jobs, INIT_VALUE, run, data, PTHREAD_MUTEX_INITIALIZER };
+
+	pthread_t* threads = calloc((size_t) nb_threads, sizeof(pthread_t));
+	long nb_started = INIT_VALUE;
+	while(threads != NULL && nb_started < nb_threads
+		  && pthread_create(&threads[nb_started], NULL, harness_worker, &pool) == 0) {
+		++nb_started;
+	}
+	if(nb_started == 0) {
+		// no thread: the jobs are run here
+		harness_worker(&pool);
+	}
+	for(long i = 0; i < nb_started; ++i) {
+		pthread_join(threads[i], NULL);
+	}
+	pthread_mutex_destroy(&pool.lock);
+	free(threads);
+	return nb_started;
+}
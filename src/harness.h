@@ -0,0 +1,52 @@
+#pragma once
+
+/**
+ * @file harness.h
+ * @brief What the command-line harnesses (gbdiff, gbblargg, gbgolden)
+ *        share: a report which keeps stdout for itself, and a pool of
+ *        threads running their jobs
+ *
+ * @date 2020
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Runs one job of a pool
+ *
+ * @param data data given to harness_run_jobs()
+ * @param job index of the job to run
+ */
+typedef void (*harness_job_t)(void* data, size_t job);
+
+/**
+ * @brief Keeps stdout for the report of a harness: what the rest of the
+ *        program prints on stdout (the Blargg serial output of the ROMs)
+ *        is dropped
+ *
+ * @return the stream of the report (to close with fclose()), NULL on error
+ */
+FILE* harness_report(void);
+
+/**
+ * @brief Runs jobs on a pool of threads, each thread taking the next job
+ *        to run, and waits for all of them (they are run in the calling
+ *        thread if no thread can be started)
+ *
+ * @param nb_jobs number of jobs
+ * @param nb_threads number of threads to start (at most one per job)
+ * @param run function running one job
+ * @param data given to run
+ * @return number of threads started (0 when the jobs were run in the
+ *         calling thread)
+ */
+long harness_run_jobs(size_t nb_jobs, long nb_threads, harness_job_t run, void* data);
+
+#ifdef __cplusplus
+}
+#endif
@@ -345,6 +345,35 @@ int image_get_pixel(uint8_t* output, image_t* pim, size_t x, size_t y)
     return ERR_NONE;
 }
 
+// ======================================================================
+int image_get_line_pixels(uint8_t* output, const image_t* pim, size_t y)
+{
+    M_REQUIRE_NON_NULL(output);
+    M_REQUIRE_NON_NULL(pim);
+    M_REQUIRE(y < pim->height, ERR_BAD_PARAMETER, "Invalid Y parameter (%zu >= %zu)", y, pim->height);
+    M_REQUIRE_NON_NULL(pim->content[y].msb);
+    M_REQUIRE_NON_NULL(pim->content[y].lsb);
+    M_REQUIRE(pim->content[y].msb->size == pim->content[y].lsb->size, ERR_BAD_PARAMETER, "%s", "Sizes do not match");
+
+    const bit_vector_t* msb = pim->content[y].msb;
+    const bit_vector_t* lsb = pim->content[y].lsb;
+
+    // one word at a time rather than one bit_vector_get() per pixel
+    for (size_t i = 0; i < size_to_content_size(msb->size); ++i) {
+        uint32_t m = msb->content[i];
+        uint32_t l = lsb->content[i];
+        const size_t end = (i + 1) * IMAGE_LINE_WORD_BITS < msb->size ?
+                           IMAGE_LINE_WORD_BITS : msb->size - i * IMAGE_LINE_WORD_BITS;
+        for (size_t j = 0; j < end; ++j) {
+            output[i * IMAGE_LINE_WORD_BITS + j] = (uint8_t) (((m & 1) << 1) | (l & 1));
+            m >>= 1;
+            l >>= 1;
+        }
+    }
+
+    return ERR_NONE;
+}
+
 // ======================================================================
 int image_own_line_content(image_t* pim, size_t y, image_line_t line)
 {
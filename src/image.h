@@ -168,6 +168,16 @@ int image_set_line(image_t* pim, size_t y, image_line_t line);
  */
 int image_get_pixel(uint8_t* output, image_t* pim, size_t x, size_t y);
 
+//=========================================================================
+/**
+ * @brief Get all pixel values of an image line, one byte per pixel
+ * @param output pointer to write pixel values to (at least line size bytes)
+ * @param pim pointer to image
+ * @param y line index
+ * @return Error code
+ */
+int image_get_line_pixels(uint8_t* output, const image_t* pim, size_t y);
+
 //=========================================================================
 /**
  * @brief Set line content of image (using provided bit vectors pointers)
@@ -0,0 +1,52 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "io.h"
+#include "error.h"
+
+int io_init(io_table_t* io) {
+	M_REQUIRE_NON_NULL(io);
+	
+	for(int i = 0; i < IO_SIZE; ++i) {
+		io->entries[i].read = NULL;
+		io->entries[i].write = NULL;
+		io->entries[i].component = NULL;
+	}
+	return ERR_NONE;
+}
+
+int io_register(io_table_t* io, addr_t start, addr_t end,
+				io_handler_t read, io_handler_t write, void* component) {
+	M_REQUIRE_NON_NULL(io);
+	M_REQUIRE_NON_NULL(component);
+	M_REQUIRE(start >= IO_START && start <= end, ERR_ADDRESS,
+			  "bad I/O range 0x%04X-0x%04X", start, end);
+	
+	for(int i = start; i <= end; ++i) {
+		if(io->entries[i - IO_START].component != NULL) {
+			return ERR_ADDRESS;
+		}
+	}
+	for(int i = start; i <= end; ++i) {
+		io->entries[i - IO_START].read = read;
+		io->entries[i - IO_START].write = write;
+		io->entries[i - IO_START].component = component;
+	}
+	return ERR_NONE;
+}
+
+int io_read(const io_table_t* io, addr_t addr) {
+	if(io == NULL || addr < IO_START) {
+		return ERR_NONE;
+	}
+	const io_entry_t* entry = &io->entries[addr - IO_START];
+	return entry->read == NULL ? ERR_NONE : entry->read(entry->component, addr);
+}
+
+int io_write(const io_table_t* io, addr_t addr) {
+	if(io == NULL || addr < IO_START) {
+		return ERR_NONE;
+	}
+	const io_entry_t* entry = &io->entries[addr - IO_START];
+	return entry->write == NULL ? ERR_NONE : entry->write(entry->component, addr);
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+/**
+ * @file io.h
+ * @brief Game Boy memory-mapped I/O registers dispatch
+ *
+ * @date 2020
+ */
+
+#include "memory.h"     // addr_t and data_t
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define IO_START 0xFF00
+#define IO_END   0xFFFF
+#define IO_SIZE  ((IO_END - IO_START) + 1)
+
+/**
+ * @brief I/O handler type: called with the component which registered it
+ *        and the address of the register accessed
+ */
+typedef int (*io_handler_t)(void* component, addr_t addr);
+
+/**
+ * @brief What is registered for one I/O address
+ */
+typedef struct {
+	io_handler_t read;	// called before the CPU reads the register
+	io_handler_t write;	// called after the cycle in which the CPU wrote the register
+	void* component;
+} io_entry_t;
+
+/**
+ * @brief I/O dispatch table, one entry per address from IO_START to IO_END
+ */
+typedef struct {
+	io_entry_t entries[IO_SIZE];
+} io_table_t;
+
+/**
+ * @brief Initializes an empty I/O table
+ *
+ * @param io table to initialize
+ * @return error code
+ */
+int io_init(io_table_t* io);
+
+/**
+ * @brief Registers the handlers of a component for a range of I/O registers
+ *
+ * @param io table to register into
+ * @param start first register address (included)
+ * @param end last register address (included)
+ * @param read handler to call before each read (may be NULL)
+ * @param write handler to call after the cycle of each write (may be NULL)
+ * @param component component to give to the handlers
+ * @return error code (ERR_ADDRESS if some address is already registered)
+ */
+int io_register(io_table_t* io, addr_t start, addr_t end,
+				io_handler_t read, io_handler_t write, void* component);
+
+/**
+ * @brief Notifies the component registered at the given address of a read
+ *
+ * @param io table to dispatch with (may be NULL)
+ * @param addr address read
+ * @return error code
+ */
+int io_read(const io_table_t* io, addr_t addr);
+
+/**
+ * @brief Notifies the component registered at the given address of a write
+ *
+ * @param io table to dispatch with (may be NULL)
+ * @param addr address written
+ * @return error code
+ */
+int io_write(const io_table_t* io, addr_t addr);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,230 @@
+/**
+ * @file link.c
+ * @brief Link cable between two gameboys of the same process
+ *
+ * @date 2020
+ */
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "link.h"
+#include "error.h"
+#include "bit.h"
+
+#define INIT_VALUE 0
+#define TRUE 1
+#define FALSE 0
+
+// ======================================================================
+/**
+ * @brief Breaks the run of a gameboy on the SC writes which may start a
+ *        transfer on its internal clock
+ */
+static watch_action_t link_sc_written(void* data, const cpu_t* cpu,
+									  watch_kind_t kind, addr_t addr, data_t value)
+{
+	(void) data; (void) cpu; (void) kind; (void) addr;
+	return bit_get(value, SC_TRANSFER) && bit_get(value, SC_CLOCK) ? WATCH_BREAK : WATCH_CONTINUE;
+}
+
+// ---------------------------------------------------------------------
+/**
+ * @brief Tells whether the serial port of an end just started a transfer
+ *        on its internal clock (not if its run failed)
+ */
+static bit_t link_started(const link_end_t* end)
+{
+	const serial_t* serial = &end->gameboy->serial;
+	return end->err == ERR_NONE && serial->bits == SERIAL_BITS && serial->clock == SERIAL_BIT_CYCLES;
+}
+
+// ---------------------------------------------------------------------
+/**
+ * @brief Runs the gameboy of an end up to its end cycle, or until it starts
+ *        a transfer (other breaks are ignored)
+ */
+static int link_end_run(link_end_t* end)
+{
+	gameboy_t* gameboy = end->gameboy;
+	while(gameboy->cycles < end->end) {
+		M_EXIT_IF_ERR(gameboy_run_until(gameboy, end->end));
+		if(link_started(end)) {
+			break;
+		}
+	}
+	return ERR_NONE;
+}
+
+static void* link_end_thread(void* arg)
+{
+	link_end_t* end = arg;
+	end->err = link_end_run(end);
+	return NULL;
+}
+
+// ---------------------------------------------------------------------
+/**
+ * @brief Takes the snapshots of a meeting point
+ */
+static int link_meet(link_t* link)
+{
+	for(int i = 0; i < LINK_NB_GAMEBOYS; ++i) {
+		M_EXIT_IF_ERR(gameboy_save_state(link->ends[i].gameboy, link->ends[i].snapshot));
+	}
+	return ERR_NONE;
+}
+
+// ---------------------------------------------------------------------
+/**
+ * @brief Runs both ends up to the given cycle, the second one on its own
+ *        thread (unless none can be created); an end whose run fails stops
+ *        there, with its error in err
+ */
+static void link_run_ends(link_t* link, uint64_t cycle)
+{
+	for(int i = 0; i < LINK_NB_GAMEBOYS; ++i) {
+		link->ends[i].end = cycle;
+		link->ends[i].err = ERR_NONE;
+	}
+	pthread_t thread;
+	const bit_t threaded = pthread_create(&thread, NULL, link_end_thread, &link->ends[1]) == 0;
+	link_end_thread(&link->ends[0]);
+	if(threaded) {
+		pthread_join(thread, NULL);
+	} else {
+		link_end_thread(&link->ends[1]);
+	}
+}
+
+// ---------------------------------------------------------------------
+/**
+ * @brief Connects the earliest transfer started by the ends, the ends
+ *        having gone beyond it being rolled back to their snapshot first:
+ *        so is an end whose run failed from that cycle on, as it ran
+ *        without the byte of the transfer (a failure before it is an
+ *        error)
+ */
+static int link_transfer(link_t* link)
+{
+	uint64_t cycle = UINT64_MAX;
+	for(int i = 0; i < LINK_NB_GAMEBOYS; ++i) {
+		if(link_started(&link->ends[i]) && link->ends[i].gameboy->cycles < cycle) {
+			cycle = link->ends[i].gameboy->cycles;
+		}
+	}
+
+	for(int i = 0; i < LINK_NB_GAMEBOYS; ++i) {
+		link_end_t* end = &link->ends[i];
+		if(end->err != ERR_NONE && end->gameboy->cycles < cycle) {
+			return end->err;
+		}
+		if(end->gameboy->cycles > cycle || end->err != ERR_NONE) {
+			M_EXIT_IF_ERR(gameboy_load_state(end->gameboy, end->snapshot));
+			end->end = cycle;
+			end->err = ERR_NONE;
+			M_EXIT_IF_ERR(link_end_run(end));
+			M_REQUIRE(end->gameboy->cycles == cycle, ERR_BAD_PARAMETER,
+					  "gameboy %d run again from its snapshot does not reach cycle %" PRIu64, i, cycle);
+			++link->nb_rollbacks;
+		}
+	}
+
+	// (both ends may have started one at the same cycle)
+	for(int i = 0; i < LINK_NB_GAMEBOYS; ++i) {
+		if(link_started(&link->ends[i])) {
+			M_EXIT_IF_ERR(serial_exchange(&link->ends[i].gameboy->serial,
+										  &link->ends[LINK_NB_GAMEBOYS - 1 - i].gameboy->serial));
+			++link->nb_transfers;
+		}
+	}
+	return link_meet(link);
+}
+
+// ======================================================================
+int link_connect(link_t* link, gameboy_t* first, gameboy_t* second, uint64_t quantum)
+{
+	M_REQUIRE_NON_NULL(link);
+	M_REQUIRE_NON_NULL(first);
+	M_REQUIRE_NON_NULL(second);
+	M_REQUIRE(first != second && first->cycles == second->cycles, ERR_BAD_PARAMETER,
+			  "%s", "two gameboys at the same cycle are needed");
+
+	gameboy_t* gameboys[LINK_NB_GAMEBOYS] = { first, second };
+	// (both checked before anything is allocated)
+	for(int i = 0; i < LINK_NB_GAMEBOYS; ++i) {
+		M_REQUIRE(gameboys[i]->movie == NULL || gameboys[i]->movie->mode != MOVIE_PLAY, ERR_BAD_PARAMETER,
+				  "gameboy %d plays a movie, which cannot be rolled back", i);
+	}
+
+	link->quantum = quantum == 0 ? LINK_DEFAULT_QUANTUM : quantum;
+	link->nb_transfers = INIT_VALUE;
+	link->nb_rollbacks = INIT_VALUE;
+	for(int i = 0; i < LINK_NB_GAMEBOYS; ++i) {
+		link_end_t* end = &link->ends[i];
+		end->gameboy = gameboys[i];
+		end->watch = -1;
+		end->end = gameboys[i]->cycles;
+		end->err = ERR_NONE;
+		end->snapshot = malloc(sizeof(gameboy_state_t));
+	}
+
+	int err = ERR_NONE;
+	for(int i = 0; i < LINK_NB_GAMEBOYS && err == ERR_NONE; ++i) {
+		link_end_t* end = &link->ends[i];
+		if(end->snapshot == NULL) {
+			err = ERR_MEM;
+		} else {
+			err = watch_add(&end->gameboy->watch, REG_SC, REG_SC, WATCH_WRITE, link_sc_written, link,
+							&end->watch);
+			end->gameboy->serial.linked = TRUE;
+		}
+	}
+	if(err != ERR_NONE) {
+		link_disconnect(link);
+	}
+	return err;
+}
+
+// ======================================================================
+int link_run_until(link_t* link, uint64_t cycle)
+{
+	M_REQUIRE_NON_NULL(link);
+
+	// (the gameboys may have been changed since the last call: keys...)
+	M_EXIT_IF_ERR(link_meet(link));
+	gameboy_t* gameboy = link->ends[0].gameboy;
+	while(gameboy->cycles < cycle) {
+		const uint64_t end = cycle - gameboy->cycles < link->quantum ? cycle : gameboy->cycles + link->quantum;
+		link_run_ends(link, end);
+		if(link_started(&link->ends[0]) || link_started(&link->ends[1])) {
+			M_EXIT_IF_ERR(link_transfer(link));
+		} else {
+			M_EXIT_IF_ERR(link->ends[0].err);
+			M_EXIT_IF_ERR(link->ends[1].err);
+			M_EXIT_IF_ERR(link_meet(link));
+		}
+	}
+	return ERR_NONE;
+}
+
+// ======================================================================
+void link_disconnect(link_t* link)
+{
+	if(link != NULL) {
+		for(int i = 0; i < LINK_NB_GAMEBOYS; ++i) {
+			link_end_t* end = &link->ends[i];
+			if(end->gameboy != NULL) {
+				if(end->watch >= 0) {
+					watch_remove(&end->gameboy->watch, end->watch);
+				}
+				end->gameboy->serial.linked = FALSE;
+			}
+			free(end->snapshot);
+			end->snapshot = NULL;
+			end->gameboy = NULL;
+			end->watch = -1;
+		}
+	}
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+/**
+ * @file link.h
+ * @brief Link cable between two gameboys of the same process
+ *
+ * The two gameboys run on their own thread, each one up to the end of the
+ * current quantum, without looking at the other one. A gameboy stops early
+ * when it starts a transfer on its internal clock: that is where the two
+ * have to meet (see serial_exchange()). Once both have stopped, the
+ * earliest transfer is connected: a gameboy which went beyond its cycle is
+ * rolled back to the snapshot taken at the last meeting point and run
+ * again up to it. Both then go on from there, from a new snapshot.
+ *
+ * Nothing but the transfers connects the two gameboys, and each one only
+ * runs ahead of the last meeting point until its own next transfer: the
+ * runs are the same whatever the quantum and the threads (the quantum only
+ * bounds the cycles run again on a rollback). What is attached to a
+ * gameboy rolled back (trace, recorder, movie, state hash) sees the cycles
+ * run again twice, and the fusion of instructions is disabled by the
+ * watchpoint on SC.
+ *
+ * @date 2020
+ */
+
+#include <stdint.h>
+
+#include "gameboy.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LINK_NB_GAMEBOYS 2
+#define LINK_DEFAULT_QUANTUM (4 * FRAME_TOTAL_CYCLES)
+
+/**
+ * @brief One end of a link cable
+ */
+typedef struct {
+	gameboy_t* gameboy;
+	gameboy_state_t* snapshot;  // at the last meeting point
+	int watch;                  // watchpoint on SC
+	uint64_t end;               // cycle to run up to
+	int err;                    // of the last run
+} link_end_t;
+
+/**
+ * @brief Type to represent a link cable
+ */
+typedef struct {
+	link_end_t ends[LINK_NB_GAMEBOYS];
+	uint64_t quantum;           // cycles run between two meeting points at most
+	uint64_t nb_transfers;      // transfers connected
+	uint64_t nb_rollbacks;      // gameboys run again from their snapshot
+} link_t;
+
+/**
+ * @brief Connects two gameboys, at the same cycle, by a link cable
+ *
+ * @param link link cable to connect
+ * @param first gameboy at one end
+ * @param second gameboy at the other end
+ * @param quantum cycles run between two meeting points at most (0 for
+ *        LINK_DEFAULT_QUANTUM)
+ * @return error code
+ */
+int link_connect(link_t* link, gameboy_t* first, gameboy_t* second, uint64_t quantum);
+
+/**
+ * @brief Runs both gameboys of a link cable until the given cycle
+ *
+ * The gameboys may be changed between two calls (keys pressed...): the
+ * first meeting point is taken at the start of each call.
+ *
+ * @param link link cable to run
+ * @param cycle cycle to run until
+ * @return error code
+ */
+int link_run_until(link_t* link, uint64_t cycle);
+
+/**
+ * @brief Disconnects the gameboys of a link cable (which may then be freed)
+ *
+ * @param link link cable to disconnect
+ */
+void link_disconnect(link_t* link);
+
+#ifdef __cplusplus
+}
+#endif
@@ -7,13 +7,18 @@
 #define INIT_VALUE 0
 
 int mem_create(memory_t* mem, size_t size) {
+	return mem_create_in(mem, size, NULL);
+}
+
+int mem_create_in(memory_t* mem, size_t size, arena_t* arena) {
 	M_REQUIRE_NON_NULL(mem);	
 
 	if(size == 0) {
 		return ERR_MEM;
 	} else {
-		if((mem->memory = calloc(1, size * sizeof(data_t))) == NULL) {
-			free(mem->memory);
+		mem->in_arena = arena != NULL;
+		mem->memory = arena != NULL ? arena_alloc(arena, size * sizeof(data_t)) : calloc(1, size * sizeof(data_t));
+		if(mem->memory == NULL) {
 			return ERR_MEM;
 		}
 		mem->size = size;
@@ -23,10 +28,10 @@ int mem_create(memory_t* mem, size_t size) {
 
 void mem_free(memory_t* mem) {
 	if(mem != NULL) {
-		if(mem->memory != NULL) {
+		if(mem->memory != NULL && !mem->in_arena) {
 			free(mem->memory);
-			mem->memory = NULL;
 		}
+		mem->memory = NULL;
 		mem->size = INIT_VALUE;
 		mem = NULL;
 	}
@@ -11,6 +11,8 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "arena.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -29,6 +31,7 @@ typedef uint8_t data_t;
 typedef struct {
 	data_t* memory;
 	size_t size; 
+	bool in_arena;	// memory carved out of an arena, freed with it
 } memory_t;
 
 /**
@@ -40,6 +43,16 @@ typedef struct {
  */
 int mem_create(memory_t* mem, size_t size);
 
+/**
+ * @brief Creates memory structure, its memory carved out of an arena
+ *
+ * @param mem memory structure pointer to initialize
+ * @param size size of the memory to create
+ * @param arena arena to allocate from, NULL to allocate on the heap
+ * @return error code
+ */
+int mem_create_in(memory_t* mem, size_t size, arena_t* arena);
+
 /**
  * @brief Destroys memory structure
  *
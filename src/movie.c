@@ -0,0 +1,156 @@
+/**
+ * @file movie.c
+ * @brief Joypad input logs, keyed by emulated cycle, to replay a run exactly
+ *
+ * @date 2020
+ */
+
+#include "movie.h"
+#include "error.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INIT_VALUE 0
+
+#define LINE_SIZE 128
+#define KEY_NAME_SIZE 16
+#define INITIAL_EVENTS 64
+
+static const char* const key_names[NB_GB_KEYS] = {
+	"RIGHT", "LEFT", "UP", "DOWN", "A", "B", "SELECT", "START"
+};
+
+// ======================================================================
+const char* movie_key_name(gb_key_t key) {
+	return key >= 0 && key < NB_GB_KEYS ? key_names[key] : NULL;
+}
+
+// ---------------------------------------------------------------------
+/**
+ * @brief Parses one event line, returns ERR_IO if malformed
+ */
+static int movie_parse_event(const char* line, movie_event_t* event) {
+	char sign = INIT_VALUE;
+	char name[KEY_NAME_SIZE];
+	if(sscanf(line, "%" SCNu64 " %c%15s", &event->cycle, &sign, name) != 3
+	   || (sign != '+' && sign != '-')) {
+		return ERR_IO;
+	}
+	event->pressed = sign == '+';
+	for(int key = 0; key < NB_GB_KEYS; ++key) {
+		if(!strcmp(name, key_names[key])) {
+			event->key = (gb_key_t) key;
+			return ERR_NONE;
+		}
+	}
+	return ERR_IO;
+}
+
+// ======================================================================
+int movie_record(movie_t* movie, const char* filename) {
+	M_REQUIRE_NON_NULL(movie);
+	M_REQUIRE_NON_NULL(filename);
+
+	memset(movie, 0, sizeof(*movie));
+	movie->mode = MOVIE_RECORD;
+	movie->file = fopen(filename, "w");
+	if(movie->file == NULL) {
+		return ERR_IO;
+	}
+	fprintf(movie->file, "%s\n", MOVIE_MAGIC);
+	return ERR_NONE;
+}
+
+// ======================================================================
+int movie_play(movie_t* movie, const char* filename) {
+	M_REQUIRE_NON_NULL(movie);
+	M_REQUIRE_NON_NULL(filename);
+
+	memset(movie, 0, sizeof(*movie));
+	movie->mode = MOVIE_PLAY;
+	FILE* file = fopen(filename, "r");
+	if(file == NULL) {
+		return ERR_IO;
+	}
+
+	char line[LINE_SIZE];
+	int err = ERR_NONE;
+	if(fgets(line, sizeof(line), file) == NULL || strncmp(line, MOVIE_MAGIC, strlen(MOVIE_MAGIC)) != 0) {
+		err = ERR_IO;
+	}
+	size_t capacity = INIT_VALUE;
+	while(err == ERR_NONE && fgets(line, sizeof(line), file) != NULL) {
+		const char* start = line + strspn(line, " \t");
+		if(*start == '#' || *start == '\n' || *start == '\0') {
+			continue;
+		}
+		if(movie->nb_events == capacity) {
+			capacity = capacity == 0 ? INITIAL_EVENTS : 2 * capacity;
+			movie_event_t* events = realloc(movie->events, capacity * sizeof(movie_event_t));
+			if(events == NULL) {
+				err = ERR_MEM;
+				break;
+			}
+			movie->events = events;
+		}
+		movie_event_t* event = &movie->events[movie->nb_events];
+		err = movie_parse_event(start, event);
+		if(err == ERR_NONE && movie->nb_events > 0 && event->cycle < event[-1].cycle) {
+			err = ERR_IO;
+		}
+		++movie->nb_events;
+	}
+	if(ferror(file)) {
+		err = ERR_IO;
+	}
+	fclose(file);
+	if(err != ERR_NONE) {
+		movie_close(movie);
+	}
+	return err;
+}
+
+// ======================================================================
+int movie_write(movie_t* movie, const movie_event_t* event) {
+	M_REQUIRE_NON_NULL(movie);
+	M_REQUIRE_NON_NULL(event);
+	M_REQUIRE(movie->mode == MOVIE_RECORD && movie->file != NULL, ERR_BAD_PARAMETER,
+			  "%s", "movie not recorded");
+	M_REQUIRE(movie_key_name(event->key) != NULL, ERR_BAD_PARAMETER, "key %d", event->key);
+
+	if(fprintf(movie->file, "%" PRIu64 " %c%s\n", event->cycle, event->pressed ? '+' : '-',
+			   key_names[event->key]) < 0) {
+		return ERR_IO;
+	}
+	++movie->nb_events;
+	return ERR_NONE;
+}
+
+// ======================================================================
+const movie_event_t* movie_peek(const movie_t* movie) {
+	if(movie == NULL || movie->mode != MOVIE_PLAY || movie->next >= movie->nb_events) {
+		return NULL;
+	}
+	return &movie->events[movie->next];
+}
+
+// ======================================================================
+void movie_skip(movie_t* movie) {
+	if(movie_peek(movie) != NULL) {
+		++movie->next;
+	}
+}
+
+// ======================================================================
+int movie_close(movie_t* movie) {
+	M_REQUIRE_NON_NULL(movie);
+	int err = ERR_NONE;
+	if(movie->file != NULL && fclose(movie->file) != 0) {
+		err = ERR_IO;
+	}
+	free(movie->events);
+	memset(movie, 0, sizeof(*movie));
+	return err;
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+/**
+ * @file movie.h
+ * @brief Joypad input logs, keyed by emulated cycle, to replay a run exactly
+ *
+ * A movie is a text file starting with the line MOVIE_MAGIC, then one
+ * event per line, in increasing cycle order:
+ *
+ *   CYCLE +KEY        key pressed
+ *   CYCLE -KEY        key released
+ *
+ * where CYCLE is the value of gameboy.cycles when the event happens (the
+ * event is seen by the first cycle emulated after it) and KEY one of RIGHT,
+ * LEFT, UP, DOWN, A, B, SELECT, START. Empty lines and lines starting with
+ * '#' are ignored.
+ *
+ * @date 2020
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "joypad.h"     // gb_key_t
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MOVIE_MAGIC "GBMOVIE1"
+
+/**
+ * @brief One joypad event
+ */
+typedef struct {
+	uint64_t cycle;
+	gb_key_t key;
+	bit_t pressed;
+} movie_event_t;
+
+/**
+ * @brief Whether a movie is written (recorded) or read (played back)
+ */
+typedef enum {
+	MOVIE_RECORD,
+	MOVIE_PLAY
+} movie_mode_t;
+
+/**
+ * @brief Type to represent a movie
+ */
+typedef struct {
+	movie_mode_t mode;
+	FILE* file;                 // MOVIE_RECORD only
+	movie_event_t* events;      // MOVIE_PLAY only, all events of the file
+	size_t nb_events;
+	size_t next;                // first event not played yet
+} movie_t;
+
+/**
+ * @brief Name of a key in the movies
+ *
+ * @param key key to name
+ * @return name, NULL for no valid key
+ */
+const char* movie_key_name(gb_key_t key);
+
+/**
+ * @brief Creates a movie file to record events into
+ *
+ * @param movie movie to initialize
+ * @param filename file to write
+ * @return error code
+ */
+int movie_record(movie_t* movie, const char* filename);
+
+/**
+ * @brief Reads a whole movie file to play it back
+ *
+ * @param movie movie to initialize
+ * @param filename file to read
+ * @return error code (ERR_IO for a malformed or unordered movie)
+ */
+int movie_play(movie_t* movie, const char* filename);
+
+/**
+ * @brief Appends an event to a recorded movie
+ *
+ * @param movie recorded movie
+ * @param event event to append (not before the last one)
+ * @return error code
+ */
+int movie_write(movie_t* movie, const movie_event_t* event);
+
+/**
+ * @brief Gives the next event of a played movie, without consuming it
+ *
+ * @param movie played movie
+ * @return next event, NULL at the end of the movie (or when recording)
+ */
+const movie_event_t* movie_peek(const movie_t* movie);
+
+/**
+ * @brief Consumes the next event of a played movie
+ *
+ * @param movie played movie
+ */
+void movie_skip(movie_t* movie);
+
+/**
+ * @brief Closes a movie (flushing a recorded one)
+ *
+ * @param movie movie to close
+ * @return error code
+ */
+int movie_close(movie_t* movie);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,269 @@
+/**
+ * @file profiler.c
+ * @brief Guest code profiler
+ *
+ * @date 2020
+ */
+
+#include "profiler.h"
+#include "error.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INIT_VALUE 0
+#define PERCENT 100.0
+#define BOOT_INDEX 0x10000
+
+static const char* const family_names[] = {
+	"NOP", "LD_A_BCR", "LD_A_CR", "LD_A_DER", "LD_A_HLRU", "LD_A_N16R",
+	"LD_A_N8R", "LD_R16SP_N16", "LD_R8_HLR", "LD_R8_N8", "POP_R16", "LD_BCR_A",
+	"LD_CR_A", "LD_DER_A", "LD_HLRU_A", "LD_HLR_N8", "LD_HLR_R8", "LD_N16R_A",
+	"LD_N16R_SP", "LD_N8R_A", "PUSH_R16", "LD_R8_R8", "LD_SP_HL", "ADD_A_HLR",
+	"ADD_A_N8", "ADD_A_R8", "ADD_HL_R16SP", "INC_HLR", "INC_R16SP", "INC_R8",
+	"LD_HLSP_S8", "CP_A_HLR", "CP_A_N8", "CP_A_R8", "DEC_HLR", "DEC_R16SP",
+	"DEC_R8", "SUB_A_HLR", "SUB_A_N8", "SUB_A_R8", "AND_A_HLR", "AND_A_N8",
+	"AND_A_R8", "OR_A_HLR", "OR_A_N8", "OR_A_R8", "XOR_A_HLR", "XOR_A_N8",
+	"XOR_A_R8", "ROTA", "ROTCA", "ROTC_HLR", "ROTC_R8", "ROT_HLR", "ROT_R8",
+	"SWAP_HLR", "SWAP_R8", "SLA_HLR", "SLA_R8", "SRA_HLR", "SRA_R8", "SRL_HLR",
+	"SRL_R8", "BIT_U3_HLR", "BIT_U3_R8", "CHG_U3_HLR", "CHG_U3_R8", "CPL",
+	"DAA", "SCCF", "JP_CC_N16", "JP_HL", "JP_N16", "JR_CC_E8", "JR_E8",
+	"CALL_CC_N16", "CALL_N16", "RET", "RET_CC", "RST_U3", "EDI", "RETI",
+	"HALT", "STOP", "UNKN", "(interrupt)"
+};
+_Static_assert(sizeof(family_names) / sizeof(family_names[0]) == PROFILER_NB_FAMILIES,
+			   "one name per opcode family");
+
+/*
+ * Memory regions the code may run from (the cartridges supported have no
+ * bank controller: ROM bank 0 and 1 are fixed)
+ */
+typedef enum {
+	BANK_BOOT, BANK_ROM0, BANK_ROM1, BANK_VRAM, BANK_ERAM, BANK_WRAM,
+	BANK_ECHO, BANK_OAM_IO, BANK_HRAM, NB_BANKS
+} bank_t;
+
+static const char* const bank_names[NB_BANKS] = {
+	"boot", "rom0", "rom1", "vram", "eram", "wram", "echo", "oam/io", "hram"
+};
+
+typedef struct {
+	size_t index;
+	uint64_t cycles;
+} cost_t;
+
+// ======================================================================
+static bank_t profiler_bank(size_t index) {
+	if(index >= BOOT_INDEX) return BANK_BOOT;
+	if(index < 0x4000) return BANK_ROM0;
+	if(index < 0x8000) return BANK_ROM1;
+	if(index < 0xA000) return BANK_VRAM;
+	if(index < 0xC000) return BANK_ERAM;
+	if(index < 0xE000) return BANK_WRAM;
+	if(index < 0xFE00) return BANK_ECHO;
+	if(index < 0xFF80) return BANK_OAM_IO;
+	return BANK_HRAM;
+}
+
+// ======================================================================
+int profiler_init(profiler_t* prof, profiler_mode_t mode, uint32_t period) {
+	M_REQUIRE_NON_NULL(prof);
+	M_REQUIRE(mode == PROFILER_EXACT || period != 0, ERR_BAD_PARAMETER,
+			  "%s", "sampling period is 0");
+
+	memset(prof, 0, sizeof(*prof));
+	prof->mode = mode;
+	prof->period = mode == PROFILER_EXACT ? 1 : period;
+	prof->countdown = prof->period;
+
+	prof->pc_cycles = calloc(PROFILER_NB_PCS, sizeof(uint64_t));
+	prof->pc_count = calloc(PROFILER_NB_PCS, sizeof(uint64_t));
+	prof->pc_family = calloc(PROFILER_NB_PCS, sizeof(uint8_t));
+	if(prof->pc_cycles == NULL || prof->pc_count == NULL || prof->pc_family == NULL) {
+		profiler_free(prof);
+		return ERR_MEM;
+	}
+	return ERR_NONE;
+}
+
+// ======================================================================
+void profiler_free(profiler_t* prof) {
+	if(prof != NULL) {
+		free(prof->pc_cycles);
+		free(prof->pc_count);
+		free(prof->pc_family);
+		prof->pc_cycles = NULL;
+		prof->pc_count = NULL;
+		prof->pc_family = NULL;
+	}
+}
+
+// ======================================================================
+void profiler_set_boot(profiler_t* prof, uint8_t boot) {
+	if(prof != NULL) {
+		prof->boot = boot;
+	}
+}
+
+// ---------------------------------------------------------------------
+static void profiler_add(profiler_t* prof, const profiler_entry_t* entry, uint64_t cycles) {
+	prof->pc_cycles[entry->pc] += cycles;
+	prof->pc_family[entry->pc] = entry->family;
+	prof->family_cycles[entry->family] += cycles;
+	prof->total += cycles;
+}
+
+// ---------------------------------------------------------------------
+/**
+ * @brief Attributes cycles to an instruction; in sampled mode, only the
+ *        samples falling into these cycles are, each weighing period cycles
+ */
+static void profiler_charge(profiler_t* prof, const profiler_entry_t* entry, uint64_t cycles) {
+	if(prof->mode == PROFILER_EXACT) {
+		profiler_add(prof, entry, cycles);
+		return;
+	}
+	prof->countdown -= cycles;
+	if(prof->countdown <= 0) {
+		const uint64_t samples = (uint64_t) -prof->countdown / prof->period + 1;
+		profiler_add(prof, entry, samples * prof->period);
+		prof->countdown += samples * prof->period;
+	}
+}
+
+// ---------------------------------------------------------------------
+static void profiler_count(profiler_t* prof, const profiler_entry_t* entry, uint64_t executions) {
+	if(prof->mode == PROFILER_EXACT) {
+		prof->pc_count[entry->pc] += executions;
+		prof->family_count[entry->family] += executions;
+	}
+}
+
+// ======================================================================
+void profiler_instruction(profiler_t* prof, addr_t pc, int family, uint8_t cycles) {
+	if(prof == NULL) {
+		return;
+	}
+	prof->ring_pos = (prof->ring_pos + 1) % PROFILER_RING_SIZE;
+	profiler_entry_t* entry = &prof->ring[prof->ring_pos];
+	entry->pc = prof->boot && pc < PROFILER_BOOT_SIZE ? BOOT_INDEX + pc : pc;
+	entry->family = (uint8_t) family;
+	entry->cycles = cycles;
+
+	profiler_count(prof, entry, 1);
+	profiler_charge(prof, entry, cycles);
+}
+
+// ======================================================================
+void profiler_wait(profiler_t* prof, uint64_t cycles) {
+	if(prof != NULL) {
+		profiler_charge(prof, &prof->ring[prof->ring_pos], cycles);
+	}
+}
+
+// ======================================================================
+int profiler_repeat(profiler_t* prof, uint64_t iterations, uint64_t nb_instructions) {
+	if(prof == NULL || iterations == 0) {
+		return ERR_NONE;
+	}
+	M_REQUIRE(nb_instructions <= PROFILER_RING_SIZE, ERR_BAD_PARAMETER,
+			  "loop of %" PRIu64 " instructions", nb_instructions);
+
+	for(size_t i = 0; i < nb_instructions; ++i) {
+		const profiler_entry_t* entry =
+			&prof->ring[(prof->ring_pos + PROFILER_RING_SIZE - i) % PROFILER_RING_SIZE];
+		profiler_count(prof, entry, iterations);
+		profiler_charge(prof, entry, iterations * entry->cycles);
+	}
+	return ERR_NONE;
+}
+
+// ---------------------------------------------------------------------
+static int cost_compare(const void* a, const void* b) {
+	const uint64_t ca = ((const cost_t*) a)->cycles;
+	const uint64_t cb = ((const cost_t*) b)->cycles;
+	return (ca < cb) - (ca > cb);
+}
+
+// ---------------------------------------------------------------------
+static double profiler_percent(const profiler_t* prof, uint64_t cycles) {
+	return prof->total == 0 ? 0.0 : PERCENT * cycles / prof->total;
+}
+
+// ---------------------------------------------------------------------
+static void profiler_print_count(const profiler_t* prof, FILE* output, uint64_t count) {
+	if(prof->mode == PROFILER_EXACT) {
+		fprintf(output, "%12" PRIu64 "\n", count);
+	} else {
+		fprintf(output, "%12s\n", "-");	// executions are not counted when sampling
+	}
+}
+
+// ======================================================================
+int profiler_report(const profiler_t* prof, FILE* output, size_t max_lines) {
+	M_REQUIRE_NON_NULL(prof);
+	M_REQUIRE_NON_NULL(output);
+	M_REQUIRE_NON_NULL(prof->pc_cycles);
+
+	cost_t* costs = calloc(PROFILER_NB_PCS, sizeof(cost_t));
+	if(costs == NULL) {
+		return ERR_MEM;
+	}
+	uint64_t bank_cycles[NB_BANKS] = { INIT_VALUE };
+	size_t nb_costs = 0;
+	for(size_t i = 0; i < PROFILER_NB_PCS; ++i) {
+		if(prof->pc_cycles[i] != 0) {
+			costs[nb_costs].index = i;
+			costs[nb_costs].cycles = prof->pc_cycles[i];
+			++nb_costs;
+			bank_cycles[profiler_bank(i)] += prof->pc_cycles[i];
+		}
+	}
+	qsort(costs, nb_costs, sizeof(cost_t), cost_compare);
+
+	fprintf(output, "=== guest profile: %" PRIu64 " cycles, ", prof->total);
+	if(prof->mode == PROFILER_EXACT) {
+		fprintf(output, "exact ===\n");
+	} else {
+		fprintf(output, "sampled every %" PRIu32 " cycles ===\n", prof->period);
+	}
+
+	fprintf(output, "%-6s %-6s %-12s %14s %7s %12s\n",
+			"bank", "pc", "family", "cycles", "%", "executions");
+	for(size_t i = 0; i < nb_costs && i < max_lines; ++i) {
+		const size_t index = costs[i].index;
+		fprintf(output, "%-6s 0x%04zX %-12s %14" PRIu64 " %6.2f%% ",
+				bank_names[profiler_bank(index)], index % BOOT_INDEX,
+				family_names[prof->pc_family[index]], costs[i].cycles,
+				profiler_percent(prof, costs[i].cycles));
+		profiler_print_count(prof, output, prof->pc_count[index]);
+	}
+
+	// banks and families reuse the costs array, sorted in the same way
+	for(size_t i = 0; i < NB_BANKS; ++i) {
+		costs[i].index = i;
+		costs[i].cycles = bank_cycles[i];
+	}
+	qsort(costs, NB_BANKS, sizeof(cost_t), cost_compare);
+	fprintf(output, "\n%-6s %14s %7s\n", "bank", "cycles", "%");
+	for(size_t i = 0; i < NB_BANKS && costs[i].cycles != 0; ++i) {
+		fprintf(output, "%-6s %14" PRIu64 " %6.2f%%\n", bank_names[costs[i].index],
+				costs[i].cycles, profiler_percent(prof, costs[i].cycles));
+	}
+
+	for(size_t i = 0; i < PROFILER_NB_FAMILIES; ++i) {
+		costs[i].index = i;
+		costs[i].cycles = prof->family_cycles[i];
+	}
+	qsort(costs, PROFILER_NB_FAMILIES, sizeof(cost_t), cost_compare);
+	fprintf(output, "\n%-12s %14s %7s %12s\n", "family", "cycles", "%", "executions");
+	for(size_t i = 0; i < PROFILER_NB_FAMILIES && i < max_lines && costs[i].cycles != 0; ++i) {
+		fprintf(output, "%-12s %14" PRIu64 " %6.2f%% ", family_names[costs[i].index],
+				costs[i].cycles, profiler_percent(prof, costs[i].cycles));
+		profiler_print_count(prof, output, prof->family_count[costs[i].index]);
+	}
+
+	free(costs);
+	return ERR_NONE;
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+/**
+ * @file profiler.h
+ * @brief Guest code profiler: attributes the emulated cycles to the PC, the
+ *        memory bank and the opcode family of the guest instructions
+ *
+ * Only compiled in with -DPROFILER (see Makefile); the CPU and the gameboy
+ * then call the hooks below and the report is printed on stderr when the
+ * gameboy is freed.
+ *
+ * @date 2020
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "memory.h"     // addr_t
+#include "opcode.h"     // opcode_family
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PROFILER_BOOT_SIZE 0x100
+// one entry per address, then one per boot ROM address (while it is mapped)
+#define PROFILER_NB_PCS (0x10000 + PROFILER_BOOT_SIZE)
+
+// pseudo family of the cycles spent dispatching an interrupt (PC = vector)
+#define PROFILER_INTERRUPT (UNKN + 1)
+#define PROFILER_NB_FAMILIES (PROFILER_INTERRUPT + 1)
+
+// last instructions remembered, to replay the iterations of a skipped idle loop
+#define PROFILER_RING_SIZE 256
+
+#define PROFILER_REPORT_LINES 20
+
+/**
+ * @brief Profiling modes
+ */
+typedef enum {
+	PROFILER_EXACT,		// every cycle is attributed, executions are counted
+	PROFILER_SAMPLED	// one cycle out of period is looked at (and weighs period)
+} profiler_mode_t;
+
+/**
+ * @brief One instruction as seen by the profiler
+ */
+typedef struct {
+	uint32_t pc;		// index in the per-PC tables
+	uint8_t family;
+	uint8_t cycles;
+} profiler_entry_t;
+
+/**
+ * @brief Type to represent the profiler
+ */
+typedef struct {
+	profiler_mode_t mode;
+	uint32_t period;
+	int64_t countdown;	// cycles before the next sample (sampled mode)
+	uint8_t boot;		// whether the boot ROM is mapped
+	uint64_t total;		// cycles attributed
+
+	uint64_t* pc_cycles;
+	uint64_t* pc_count;
+	uint8_t* pc_family;	// family of the last instruction at each PC
+	uint64_t family_cycles[PROFILER_NB_FAMILIES];
+	uint64_t family_count[PROFILER_NB_FAMILIES];
+
+	profiler_entry_t ring[PROFILER_RING_SIZE];
+	size_t ring_pos;	// position of the last instruction
+} profiler_t;
+
+/**
+ * @brief Initializes an empty profiler
+ *
+ * @param prof profiler to initialize
+ * @param mode exact or sampled
+ * @param period sampling period in cycles (sampled mode only, not 0)
+ * @return error code
+ */
+int profiler_init(profiler_t* prof, profiler_mode_t mode, uint32_t period);
+
+/**
+ * @brief Frees a profiler
+ *
+ * @param prof profiler to free
+ */
+void profiler_free(profiler_t* prof);
+
+/**
+ * @brief Tells the profiler whether the boot ROM is mapped at 0x0000
+ *
+ * @param prof profiler to update
+ * @param boot non zero while the boot ROM is mapped
+ */
+void profiler_set_boot(profiler_t* prof, uint8_t boot);
+
+/**
+ * @brief Attributes the cycles of an instruction the CPU just dispatched
+ *
+ * @param prof profiler (may be NULL)
+ * @param pc address of the instruction
+ * @param family its family (or PROFILER_INTERRUPT)
+ * @param cycles cycles until the next dispatch (extra cycles included)
+ */
+void profiler_instruction(profiler_t* prof, addr_t pc, int family, uint8_t cycles);
+
+/**
+ * @brief Attributes cycles during which the CPU dispatches nothing (HALT)
+ *        to the last instruction
+ *
+ * @param prof profiler (may be NULL)
+ * @param cycles number of cycles
+ */
+void profiler_wait(profiler_t* prof, uint64_t cycles);
+
+/**
+ * @brief Attributes skipped iterations of an idle loop, by replaying its
+ *        last instructions
+ *
+ * @param prof profiler (may be NULL)
+ * @param iterations number of iterations skipped
+ * @param nb_instructions number of instructions of one iteration
+ * @return error code
+ */
+int profiler_repeat(profiler_t* prof, uint64_t iterations, uint64_t nb_instructions);
+
+/**
+ * @brief Prints the report: the most costly PCs, then the cycles per bank
+ *        and per opcode family, sorted by decreasing cost
+ *
+ * @param prof profiler to report
+ * @param output where to print
+ * @param max_lines maximum number of PCs and of families printed
+ * @return error code
+ */
+int profiler_report(const profiler_t* prof, FILE* output, size_t max_lines);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,426 @@
+/**
+ * @file recorder.c
+ * @brief Lossless recording of the emulated frames
+ *
+ * @date 2020
+ */
+
+#include "recorder.h"
+#include "gameboy.h"     // GB_CYCLES_PER_S
+#include "error.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define INIT_VALUE 0
+#define TRUE 1
+#define FALSE 0
+
+#define BITS_PER_PIXEL 2
+#define PIXEL_MASK 0x3
+
+#define RLE_MAX_LITERAL 128
+#define RLE_RUN 0x80
+#define RLE_MIN_RUN 3           // shorter runs are kept in the literals
+#define RLE_MAX_RUN 128
+#define RLE_ZEROS 0xFF
+#define RLE_MAX_ZEROS 0xFFFF
+#define RLE_BUFFER_SIZE (2 * RECORDER_FRAME_SIZE)
+
+// ---------------------------------------------------------------------
+static size_t rle_flush_literals(const uint8_t* literals, size_t size, uint8_t* out, size_t o) {
+	if(size != 0) {
+		out[o++] = (uint8_t) (size - 1);
+		memcpy(out + o, literals, size);
+		o += size;
+	}
+	return o;
+}
+
+// ---------------------------------------------------------------------
+/**
+ * @brief Run-length encodes size bytes (see recorder.h), returns the size
+ *        of the output (at most size + size / RLE_MAX_LITERAL + 1)
+ */
+static size_t rle_encode(const uint8_t* in, size_t size, uint8_t* out) {
+	size_t o = 0;
+	size_t literal_start = 0;
+	size_t nb_literals = 0;
+	size_t i = 0;
+	while(i < size) {
+		const size_t max = in[i] == 0 ? RLE_MAX_ZEROS : RLE_MAX_RUN;
+		size_t run = 1;
+		while(i + run < size && run < max && in[i + run] == in[i]) {
+			++run;
+		}
+
+		if(run >= RLE_MIN_RUN) {
+			o = rle_flush_literals(in + literal_start, nb_literals, out, o);
+			nb_literals = 0;
+			if(in[i] == 0) {
+				out[o++] = RLE_ZEROS;
+				out[o++] = (uint8_t) (run & 0xFF);
+				out[o++] = (uint8_t) (run >> 8);
+			} else {
+				out[o++] = (uint8_t) (RLE_RUN + run - 2);
+				out[o++] = in[i];
+			}
+			i += run;
+		} else {
+			if(nb_literals == 0) {
+				literal_start = i;
+			}
+			++nb_literals;
+			++i;
+			if(nb_literals == RLE_MAX_LITERAL) {
+				o = rle_flush_literals(in + literal_start, nb_literals, out, o);
+				nb_literals = 0;
+			}
+		}
+	}
+	return rle_flush_literals(in + literal_start, nb_literals, out, o);
+}
+
+// ---------------------------------------------------------------------
+/**
+ * @brief Decodes exactly size bytes, returns ERR_IO on corrupted input
+ */
+static int rle_decode(const uint8_t* in, size_t in_size, uint8_t* out, size_t size) {
+	size_t i = 0;
+	size_t o = 0;
+	while(i < in_size) {
+		const uint8_t c = in[i++];
+		size_t count = 0;
+		if(c < RLE_RUN) {
+			count = (size_t) c + 1;
+			if(i + count > in_size || o + count > size) {
+				return ERR_IO;
+			}
+			memcpy(out + o, in + i, count);
+			i += count;
+		} else if(c == RLE_ZEROS) {
+			if(i + 2 > in_size) {
+				return ERR_IO;
+			}
+			count = in[i] | (size_t) in[i + 1] << 8;
+			i += 2;
+			if(o + count > size) {
+				return ERR_IO;
+			}
+			memset(out + o, 0, count);
+		} else {
+			count = (size_t) c - RLE_RUN + 2;
+			if(i + 1 > in_size || o + count > size) {
+				return ERR_IO;
+			}
+			memset(out + o, in[i++], count);
+		}
+		o += count;
+	}
+	return o == size ? ERR_NONE : ERR_IO;
+}
+
+// ---------------------------------------------------------------------
+static void recorder_pack(uint8_t frame[LCD_HEIGHT][LCD_WIDTH], uint8_t* packed) {
+	const uint8_t* pixels = &frame[0][0];
+	for(size_t i = 0; i < RECORDER_FRAME_SIZE; ++i) {
+		uint8_t byte = 0;
+		for(int p = 0; p < RECORDER_PIXELS_PER_BYTE; ++p) {
+			byte = (uint8_t) (byte << BITS_PER_PIXEL | (*pixels++ & PIXEL_MASK));
+		}
+		packed[i] = byte;
+	}
+}
+
+// ---------------------------------------------------------------------
+static void recorder_unpack(const uint8_t* packed, uint8_t frame[LCD_HEIGHT][LCD_WIDTH]) {
+	uint8_t* pixels = &frame[0][0];
+	for(size_t i = 0; i < RECORDER_FRAME_SIZE; ++i) {
+		for(int p = RECORDER_PIXELS_PER_BYTE - 1; p >= 0; --p) {
+			*pixels++ = (packed[i] >> (p * BITS_PER_PIXEL)) & PIXEL_MASK;
+		}
+	}
+}
+
+// ---------------------------------------------------------------------
+/**
+ * @brief Compresses and writes one frame (writer thread)
+ */
+static int recorder_write_frame(recorder_t* rec, const uint8_t* packed, uint64_t number) {
+	uint8_t delta[RECORDER_FRAME_SIZE];
+	uint8_t encoded[RLE_BUFFER_SIZE];
+	const uint8_t type = number % rec->keyframe_interval == 0 ? RECORDER_KEYFRAME : RECORDER_DELTA;
+
+	if(type == RECORDER_KEYFRAME) {
+		recording_index_t* index = realloc(rec->index, (rec->nb_keyframes + 1) * sizeof(recording_index_t));
+		if(index == NULL) {
+			return ERR_MEM;
+		}
+		rec->index = index;
+		const long offset = ftell(rec->file);
+		if(offset < 0) {
+			return ERR_IO;
+		}
+		rec->index[rec->nb_keyframes].frame = number;
+		rec->index[rec->nb_keyframes].offset = (uint64_t) offset;
+		++rec->nb_keyframes;
+		memcpy(delta, packed, RECORDER_FRAME_SIZE);
+	} else {
+		for(size_t i = 0; i < RECORDER_FRAME_SIZE; ++i) {
+			delta[i] = packed[i] ^ rec->previous[i];
+		}
+	}
+	memcpy(rec->previous, packed, RECORDER_FRAME_SIZE);
+
+	const uint32_t size = (uint32_t) rle_encode(delta, RECORDER_FRAME_SIZE, encoded);
+	if(fwrite(&type, sizeof(type), 1, rec->file) != 1
+	   || fwrite(&size, sizeof(size), 1, rec->file) != 1
+	   || fwrite(encoded, 1, size, rec->file) != size) {
+		return ERR_IO;
+	}
+	return ERR_NONE;
+}
+
+// ---------------------------------------------------------------------
+/**
+ * @brief Writer thread: writes the frames pushed until the recorder is
+ *        closed (after an error, frames are only consumed)
+ */
+static void* recorder_writer(void* arg) {
+	recorder_t* rec = arg;
+	pthread_mutex_lock(&rec->lock);
+	for(;;) {
+		while(rec->written == rec->pushed && rec->running) {
+			pthread_cond_wait(&rec->changed, &rec->lock);
+		}
+		if(rec->written == rec->pushed) {
+			break;
+		}
+		const uint64_t number = rec->written;
+		pthread_mutex_unlock(&rec->lock);
+
+		// the slot is not reused before written is incremented
+		if(rec->error == ERR_NONE) {
+			rec->error = recorder_write_frame(rec, rec->queue[number % RECORDER_QUEUE_SIZE], number);
+		}
+
+		pthread_mutex_lock(&rec->lock);
+		++rec->written;
+		pthread_cond_broadcast(&rec->changed);
+	}
+	pthread_mutex_unlock(&rec->lock);
+	return NULL;
+}
+
+// ======================================================================
+int recorder_open(recorder_t* rec, const char* filename, uint32_t keyframe_interval) {
+	M_REQUIRE_NON_NULL(rec);
+	M_REQUIRE_NON_NULL(filename);
+	M_REQUIRE(keyframe_interval != 0, ERR_BAD_PARAMETER, "%s", "no keyframe interval");
+
+	memset(rec, 0, sizeof(*rec));
+	rec->keyframe_interval = keyframe_interval;
+	rec->file = fopen(filename, "wb");
+	if(rec->file == NULL) {
+		return ERR_IO;
+	}
+
+	recording_header_t header;
+	memset(&header, 0, sizeof(header));
+	strncpy(header.magic, RECORDER_MAGIC, RECORDER_MAGIC_SIZE);
+	header.width = LCD_WIDTH;
+	header.height = LCD_HEIGHT;
+	header.keyframe_interval = keyframe_interval;
+	header.cycles_per_frame = FRAME_TOTAL_CYCLES;
+	header.cycles_per_s = GB_CYCLES_PER_S;
+	if(fwrite(&header, sizeof(header), 1, rec->file) != 1) {
+		fclose(rec->file);
+		rec->file = NULL;
+		return ERR_IO;
+	}
+
+	pthread_mutex_init(&rec->lock, NULL);
+	pthread_cond_init(&rec->changed, NULL);
+	rec->running = TRUE;
+	if(pthread_create(&rec->writer, NULL, recorder_writer, rec) != 0) {
+		pthread_mutex_destroy(&rec->lock);
+		pthread_cond_destroy(&rec->changed);
+		fclose(rec->file);
+		rec->file = NULL;
+		return ERR_IO;
+	}
+	return ERR_NONE;
+}
+
+// ======================================================================
+int recorder_push(recorder_t* rec, uint8_t frame[LCD_HEIGHT][LCD_WIDTH]) {
+	M_REQUIRE_NON_NULL(rec);
+	M_REQUIRE_NON_NULL(frame);
+	M_REQUIRE_NON_NULL(rec->file);
+
+	pthread_mutex_lock(&rec->lock);
+	while(rec->pushed - rec->written == RECORDER_QUEUE_SIZE) {
+		pthread_cond_wait(&rec->changed, &rec->lock);
+	}
+	const uint64_t number = rec->pushed;
+	pthread_mutex_unlock(&rec->lock);
+
+	// the writer does not read the slot before pushed is incremented
+	recorder_pack(frame, rec->queue[number % RECORDER_QUEUE_SIZE]);
+
+	pthread_mutex_lock(&rec->lock);
+	++rec->pushed;
+	pthread_cond_broadcast(&rec->changed);
+	pthread_mutex_unlock(&rec->lock);
+	return ERR_NONE;
+}
+
+// ======================================================================
+int recorder_close(recorder_t* rec) {
+	M_REQUIRE_NON_NULL(rec);
+	if(rec->file == NULL) {
+		return ERR_NONE;
+	}
+
+	pthread_mutex_lock(&rec->lock);
+	rec->running = FALSE;
+	pthread_cond_broadcast(&rec->changed);
+	pthread_mutex_unlock(&rec->lock);
+	pthread_join(rec->writer, NULL);
+	pthread_mutex_destroy(&rec->lock);
+	pthread_cond_destroy(&rec->changed);
+
+	int err = rec->error;
+	const long offset = ftell(rec->file);
+	recording_trailer_t trailer;
+	memset(&trailer, 0, sizeof(trailer));
+	trailer.nb_frames = rec->written;
+	trailer.nb_keyframes = rec->nb_keyframes;
+	trailer.index_offset = offset < 0 ? INIT_VALUE : (uint64_t) offset;
+	strncpy(trailer.magic, RECORDER_INDEX_MAGIC, RECORDER_MAGIC_SIZE);
+	if(err == ERR_NONE
+	   && (offset < 0
+		   || fwrite(rec->index, sizeof(recording_index_t), rec->nb_keyframes, rec->file) != rec->nb_keyframes
+		   || fwrite(&trailer, sizeof(trailer), 1, rec->file) != 1)) {
+		err = ERR_IO;
+	}
+	if(fclose(rec->file) != 0 && err == ERR_NONE) {
+		err = ERR_IO;
+	}
+	rec->file = NULL;
+	free(rec->index);
+	rec->index = NULL;
+	return err;
+}
+
+// ======================================================================
+int recording_open(recording_t* rec, const char* filename) {
+	M_REQUIRE_NON_NULL(rec);
+	M_REQUIRE_NON_NULL(filename);
+
+	memset(rec, 0, sizeof(*rec));
+	rec->file = fopen(filename, "rb");
+	if(rec->file == NULL) {
+		return ERR_IO;
+	}
+	if(fread(&rec->header, sizeof(rec->header), 1, rec->file) != 1
+	   || strncmp(rec->header.magic, RECORDER_MAGIC, RECORDER_MAGIC_SIZE) != 0
+	   || rec->header.width != LCD_WIDTH || rec->header.height != LCD_HEIGHT
+	   || fseek(rec->file, -(long) sizeof(recording_trailer_t), SEEK_END) != 0
+	   || fread(&rec->trailer, sizeof(rec->trailer), 1, rec->file) != 1
+	   || strncmp(rec->trailer.magic, RECORDER_INDEX_MAGIC, RECORDER_MAGIC_SIZE) != 0
+	   || fseek(rec->file, (long) rec->trailer.index_offset, SEEK_SET) != 0) {
+		recording_close(rec);
+		return ERR_IO;
+	}
+
+	rec->index = calloc(rec->trailer.nb_keyframes + 1, sizeof(recording_index_t));
+	if(rec->index == NULL) {
+		recording_close(rec);
+		return ERR_MEM;
+	}
+	if(fread(rec->index, sizeof(recording_index_t), rec->trailer.nb_keyframes, rec->file)
+	   != rec->trailer.nb_keyframes
+	   || fseek(rec->file, sizeof(recording_header_t), SEEK_SET) != 0) {
+		recording_close(rec);
+		return ERR_IO;
+	}
+	rec->next = INIT_VALUE;
+	return ERR_NONE;
+}
+
+// ---------------------------------------------------------------------
+static int recording_decode_next(recording_t* rec) {
+	uint8_t type = 0;
+	uint32_t size = 0;
+	uint8_t encoded[RLE_BUFFER_SIZE];
+	uint8_t delta[RECORDER_FRAME_SIZE];
+	if(fread(&type, sizeof(type), 1, rec->file) != 1
+	   || fread(&size, sizeof(size), 1, rec->file) != 1
+	   || size > sizeof(encoded)
+	   || fread(encoded, 1, size, rec->file) != size) {
+		return ERR_IO;
+	}
+	M_EXIT_IF_ERR(rle_decode(encoded, size, delta, RECORDER_FRAME_SIZE));
+
+	if(type == RECORDER_KEYFRAME) {
+		memcpy(rec->current, delta, RECORDER_FRAME_SIZE);
+	} else if(type == RECORDER_DELTA) {
+		for(size_t i = 0; i < RECORDER_FRAME_SIZE; ++i) {
+			rec->current[i] ^= delta[i];
+		}
+	} else {
+		return ERR_IO;
+	}
+	++rec->next;
+	return ERR_NONE;
+}
+
+// ======================================================================
+int recording_read(recording_t* rec, uint64_t number, uint8_t frame[LCD_HEIGHT][LCD_WIDTH]) {
+	M_REQUIRE_NON_NULL(rec);
+	M_REQUIRE_NON_NULL(frame);
+	M_REQUIRE_NON_NULL(rec->file);
+	M_REQUIRE(number < rec->trailer.nb_frames, ERR_BAD_PARAMETER,
+			  "no frame %llu", (unsigned long long) number);
+
+	if(number + 1 != rec->next) {
+		M_REQUIRE(rec->trailer.nb_keyframes != 0, ERR_IO, "%s", "no keyframe");
+		// last keyframe not after the frame (the index is sorted)
+		uint64_t low = 0;
+		uint64_t high = rec->trailer.nb_keyframes;
+		while(high - low > 1) {
+			const uint64_t middle = (low + high) / 2;
+			if(rec->index[middle].frame <= number) {
+				low = middle;
+			} else {
+				high = middle;
+			}
+		}
+		// decoding on from the last frame read is shorter unless it is after
+		// the frame or before its keyframe
+		if(number < rec->next || rec->index[low].frame > rec->next) {
+			if(fseek(rec->file, (long) rec->index[low].offset, SEEK_SET) != 0) {
+				return ERR_IO;
+			}
+			rec->next = rec->index[low].frame;
+		}
+	}
+	while(rec->next <= number) {
+		M_EXIT_IF_ERR(recording_decode_next(rec));
+	}
+	recorder_unpack(rec->current, frame);
+	return ERR_NONE;
+}
+
+// ======================================================================
+void recording_close(recording_t* rec) {
+	if(rec != NULL) {
+		if(rec->file != NULL) {
+			fclose(rec->file);
+		}
+		free(rec->index);
+		rec->file = NULL;
+		rec->index = NULL;
+	}
+}
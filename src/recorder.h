@@ -0,0 +1,171 @@
+#pragma once
+
+/**
+ * @file recorder.h
+ * @brief Lossless recording of the emulated frames
+ *
+ * A recording starts with a recording_header_t. Each frame is then stored,
+ * packed at 2 bits per pixel, as its XOR with the previous frame (or alone
+ * for a keyframe, every keyframe_interval frames), run-length encoded:
+ *
+ *   0x00-0x7F n        : n + 1 literal bytes follow
+ *   0x80-0xFE n, b     : n - 0x80 + 2 copies of b
+ *   0xFF lo hi         : lo + 256 * hi zero bytes (unchanged pixels)
+ *
+ * preceded by its type (RECORDER_KEYFRAME or RECORDER_DELTA) and its size
+ * (uint32_t). The recording ends with the seek index, the frame number and
+ * the file offset (uint64_t each) of every keyframe, then a
+ * recording_trailer_t. Integers are in the byte order of the host.
+ *
+ * Frames are compressed and written by a background thread.
+ *
+ * @date 2020
+ */
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "lcdc.h"       // LCD_WIDTH, LCD_HEIGHT
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RECORDER_MAGIC "GBREC1"
+#define RECORDER_INDEX_MAGIC "GBRIDX1"
+#define RECORDER_MAGIC_SIZE 8
+
+#define RECORDER_PIXELS_PER_BYTE 4
+#define RECORDER_FRAME_SIZE (LCD_WIDTH * LCD_HEIGHT / RECORDER_PIXELS_PER_BYTE)
+
+#define RECORDER_KEYFRAME 'K'
+#define RECORDER_DELTA 'D'
+
+#define RECORDER_DEFAULT_KEYFRAMES 60   // about one keyframe per second
+#define RECORDER_QUEUE_SIZE 64          // frames waiting for the writer
+
+/**
+ * @brief Header of the recordings
+ */
+typedef struct {
+	char magic[RECORDER_MAGIC_SIZE];
+	uint16_t width;
+	uint16_t height;
+	uint32_t keyframe_interval;
+	uint32_t cycles_per_frame;      // frame rate is cycles_per_s / cycles_per_frame
+	uint32_t cycles_per_s;
+} recording_header_t;
+
+/**
+ * @brief Trailer of the recordings, at the very end of the file
+ */
+typedef struct {
+	uint64_t nb_frames;
+	uint64_t nb_keyframes;
+	uint64_t index_offset;
+	char magic[RECORDER_MAGIC_SIZE];
+} recording_trailer_t;
+
+/**
+ * @brief Keyframe entry of the seek index
+ */
+typedef struct {
+	uint64_t frame;
+	uint64_t offset;
+} recording_index_t;
+
+/**
+ * @brief Type to represent a recorder (writing side)
+ */
+typedef struct {
+	FILE* file;
+	uint32_t keyframe_interval;
+
+	// frames pushed, packed, waiting for the writer thread
+	uint8_t queue[RECORDER_QUEUE_SIZE][RECORDER_FRAME_SIZE];
+	uint64_t pushed;                // guarded by lock
+	uint64_t written;               // guarded by lock
+	int running;                    // guarded by lock
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	pthread_t writer;
+
+	// writer thread only
+	uint8_t previous[RECORDER_FRAME_SIZE];
+	recording_index_t* index;
+	uint64_t nb_keyframes;
+	int error;
+} recorder_t;
+
+/**
+ * @brief Type to represent a recording being read
+ */
+typedef struct {
+	FILE* file;
+	recording_header_t header;
+	recording_trailer_t trailer;
+	recording_index_t* index;
+	uint64_t next;                  // number of the next frame in the file
+	uint8_t current[RECORDER_FRAME_SIZE];
+} recording_t;
+
+/**
+ * @brief Starts a recording and its writer thread
+ *
+ * @param rec recorder to initialize
+ * @param filename file to write
+ * @param keyframe_interval number of frames between two keyframes (not 0)
+ * @return error code
+ */
+int recorder_open(recorder_t* rec, const char* filename, uint32_t keyframe_interval);
+
+/**
+ * @brief Appends a frame (waits only if RECORDER_QUEUE_SIZE frames are
+ *        already waiting for the writer)
+ *
+ * @param rec recorder to append to
+ * @param frame pixels, color indexes from 0 to 3
+ * @return error code
+ */
+int recorder_push(recorder_t* rec, uint8_t frame[LCD_HEIGHT][LCD_WIDTH]);
+
+/**
+ * @brief Writes the frames left and the seek index, and closes the file
+ *
+ * @param rec recorder to close
+ * @return error code (the first error of the writer, if any)
+ */
+int recorder_close(recorder_t* rec);
+
+/**
+ * @brief Opens a recording (reads its header and seek index)
+ *
+ * @param rec recording to initialize
+ * @param filename file to read
+ * @return error code
+ */
+int recording_open(recording_t* rec, const char* filename);
+
+/**
+ * @brief Decodes a frame, seeking from the last keyframe before it unless
+ *        it follows the last frame read
+ *
+ * @param rec recording to read from
+ * @param number frame number, from 0 to trailer.nb_frames - 1
+ * @param frame (output) pixels, color indexes from 0 to 3
+ * @return error code
+ */
+int recording_read(recording_t* rec, uint64_t number, uint8_t frame[LCD_HEIGHT][LCD_WIDTH]);
+
+/**
+ * @brief Closes a recording
+ *
+ * @param rec recording to close
+ */
+void recording_close(recording_t* rec);
+
+#ifdef __cplusplus
+}
+#endif
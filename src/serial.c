@@ -0,0 +1,173 @@
+/**
+ * @file serial.c
+ * @brief Game Boy serial port simulation
+ *
+ * @date 2020
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "serial.h"
+#include "cpu.h"
+#include "error.h"
+#include "bit.h"
+
+#define INIT_VALUE 0
+#define TRUE 1
+#define FALSE 0
+#define MSB 7
+
+/*
+ * Like the timer, the serial port accesses its registers directly on the
+ * bus: its own updates must not be dispatched back to it as CPU writes.
+ */
+static data_t serial_reg_get(const serial_t* serial, addr_t addr){
+	data_t value = 0;
+	bus_read(*serial->cpu->bus, addr, &value);
+	return value;
+}
+
+static void serial_reg_set(serial_t* serial, addr_t addr, data_t value){
+	bus_write(*serial->cpu->bus, addr, value);
+}
+
+/**
+ * @brief pushes a byte sent to the output buffer (the producer side: the
+ *        emulation thread), dropping it if the buffer is full
+ */
+static void serial_push(serial_buffer_t* buffer, data_t byte){
+	const uint64_t head = atomic_load_explicit(&buffer->head, memory_order_relaxed);
+	if(head - atomic_load_explicit(&buffer->tail, memory_order_acquire) >= SERIAL_BUFFER_SIZE){
+		atomic_fetch_add_explicit(&buffer->lost, 1, memory_order_relaxed);
+		return;
+	}
+	buffer->bytes[head & (SERIAL_BUFFER_SIZE - 1)] = byte;
+	atomic_store_explicit(&buffer->head, head + 1, memory_order_release);
+}
+
+/**
+ * @brief shifts one bit of SB out (and the next one of in in), completing
+ *        the transfer after the last one
+ */
+static void serial_shift(serial_t* serial){
+	serial_reg_set(serial, REG_SB, (data_t) (serial_reg_get(serial, REG_SB) << 1 | bit_get(serial->in, MSB)));
+	serial->in = (data_t) (serial->in << 1);
+	if(--serial->bits > 0){
+		serial->clock = SERIAL_BIT_CYCLES;
+		return;
+	}
+	data_t sc = serial_reg_get(serial, REG_SC);
+	bit_unset(&sc, SC_TRANSFER);
+	serial_reg_set(serial, REG_SC, sc);
+	serial->clock = INIT_VALUE;
+	cpu_request_interrupt(serial->cpu, SERIAL);
+}
+
+int serial_init(serial_t* serial, cpu_t* cpu){
+	M_REQUIRE_NON_NULL(serial);
+	M_REQUIRE_NON_NULL(cpu);
+
+	serial->cpu = cpu;
+	serial->bits = INIT_VALUE;
+	serial->clock = INIT_VALUE;
+	serial->in = SERIAL_NOTHING_IN;
+	serial->linked = FALSE;
+	memset(serial->out.bytes, INIT_VALUE, sizeof(serial->out.bytes));
+	atomic_init(&serial->out.head, INIT_VALUE);
+	atomic_init(&serial->out.tail, INIT_VALUE);
+	atomic_init(&serial->out.lost, INIT_VALUE);
+
+	return ERR_NONE;
+}
+
+int serial_cycle(serial_t* serial){
+	M_REQUIRE_NON_NULL(serial);
+
+	// (no transfer on the internal clock when 0)
+	if(serial->clock != 0 && --serial->clock == 0){
+		serial_shift(serial);
+	}
+	return ERR_NONE;
+}
+
+/*
+ * A transfer requested while another one is in progress only changes its
+ * clock; the byte is sent when the transfer starts on the internal clock.
+ */
+int serial_bus_listener(serial_t* serial, addr_t addr){
+	M_REQUIRE_NON_NULL(serial);
+	if(addr != REG_SC){
+		return ERR_NONE;
+	}
+
+	const data_t sc = serial_reg_get(serial, REG_SC);
+	if(!bit_get(sc, SC_TRANSFER)){
+		serial->bits = INIT_VALUE;
+		serial->clock = INIT_VALUE;
+	} else if(!bit_get(sc, SC_CLOCK)){
+		serial->bits = serial->bits == 0 ? SERIAL_BITS : serial->bits;
+		serial->clock = INIT_VALUE;
+	} else if(serial->bits == 0){
+		serial->bits = SERIAL_BITS;
+		serial->clock = SERIAL_BIT_CYCLES;
+		serial->in = SERIAL_NOTHING_IN;
+		if(!serial->linked){
+			serial_push(&serial->out, serial_reg_get(serial, REG_SB));
+		}
+	} else if(serial->clock == 0){
+		serial->clock = SERIAL_BIT_CYCLES;
+	}
+	return ERR_NONE;
+}
+
+int serial_exchange(serial_t* master, serial_t* other){
+	M_REQUIRE_NON_NULL(master);
+	M_REQUIRE_NON_NULL(other);
+	M_REQUIRE(master->bits == SERIAL_BITS && master->clock == SERIAL_BIT_CYCLES, ERR_BAD_PARAMETER,
+			  "%s", "no transfer just started on the internal clock");
+
+	const data_t sent = serial_reg_get(master, REG_SB);
+	serial_push(&master->out, sent);
+	if(other->bits != 0 && other->clock == 0){
+		// (the other end waits on the external clock)
+		master->in = serial_reg_get(other, REG_SB);
+		serial_push(&other->out, master->in);
+		other->in = sent;
+		other->clock = SERIAL_BIT_CYCLES;
+	}
+	return ERR_NONE;
+}
+
+uint64_t serial_cycles_before_event(const serial_t* serial){
+	// the shifting cycle itself must not be run
+	return serial->clock == 0 ? UINT64_MAX : (uint64_t) serial->clock - 1;
+}
+
+int serial_cycles(serial_t* serial, uint64_t nb_cycles){
+	M_REQUIRE_NON_NULL(serial);
+	if(nb_cycles == 0){
+		return ERR_NONE;
+	}
+	M_REQUIRE(nb_cycles <= serial_cycles_before_event(serial), ERR_BAD_PARAMETER,
+			  "%s", "cannot skip a serial bit");
+
+	if(serial->clock != 0){
+		serial->clock = (uint8_t) (serial->clock - nb_cycles);
+	}
+	return ERR_NONE;
+}
+
+size_t serial_drain(serial_buffer_t* buffer, data_t* bytes, size_t size){
+	if(buffer == NULL || bytes == NULL){
+		return 0;
+	}
+	const uint64_t tail = atomic_load_explicit(&buffer->tail, memory_order_relaxed);
+	const uint64_t head = atomic_load_explicit(&buffer->head, memory_order_acquire);
+	size_t nb_bytes = INIT_VALUE;
+	for(; nb_bytes < size && tail + nb_bytes < head; ++nb_bytes){
+		bytes[nb_bytes] = buffer->bytes[(tail + nb_bytes) & (SERIAL_BUFFER_SIZE - 1)];
+	}
+	atomic_store_explicit(&buffer->tail, tail + nb_bytes, memory_order_release);
+	return nb_bytes;
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+/**
+ * @file serial.h
+ * @brief Game Boy serial port simulation header
+ *
+ * A transfer starts when SC is written with its bit 7 set. With the
+ * internal clock (bit 0 of SC), SB is shifted out, its most significant bit
+ * first, one bit every SERIAL_BIT_CYCLES cycles, while the byte of the
+ * other end is shifted in: 0xFF when nothing is connected. Once the 8 bits
+ * are shifted, bit 7 of SC is cleared and the SERIAL interrupt is
+ * requested. A transfer on the external clock only progresses when the
+ * other end of a link cable clocks it (see serial_exchange()).
+ *
+ * The byte of each transfer started on the internal clock is pushed to the
+ * output buffer of the serial port: a single-producer single-consumer ring
+ * without lock, so that the host may drain it in batches (see
+ * serial_drain()), from any thread. Through a link cable, the bytes of the
+ * transfers clocked by the other end are pushed too.
+ *
+ * @date 2020
+ */
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bit.h"
+#include "cpu.h"
+#include "bus.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// SERIAL BUS REG ADDR
+
+#define REG_SB          0xFF01
+#define REG_SC          0xFF02
+
+#define SERIAL_START    REG_SB
+#define SERIAL_END      REG_SC
+
+#define SC_TRANSFER     7   // bit of SC: transfer requested or in progress
+#define SC_CLOCK        0   // bit of SC: internal clock
+
+#define SERIAL_BIT_CYCLES 128   // internal clock: 8192 Hz
+#define SERIAL_BITS       8
+
+#define SERIAL_NOTHING_IN 0xFF  // byte shifted in when nothing is connected
+
+#define SERIAL_BUFFER_SIZE 4096 // bytes, a power of 2
+
+/**
+ * @brief Output buffer of a serial port
+ */
+typedef struct {
+	data_t bytes[SERIAL_BUFFER_SIZE];
+	_Atomic uint64_t head;      // bytes pushed since serial_init()
+	_Atomic uint64_t tail;      // bytes drained
+	_Atomic uint64_t lost;      // bytes dropped, the buffer being full
+} serial_buffer_t;
+
+/**
+ * @brief Serial port type
+ */
+typedef struct {
+	cpu_t* cpu;
+	uint8_t bits;               // bits left to shift, 0 when no transfer is in progress
+	uint8_t clock;              // cycles before the next bit is shifted (internal clock)
+	data_t in;                  // bits left to shift in, the next one first
+	bit_t linked;               // the bytes sent are pushed by serial_exchange() (see link.h)
+	serial_buffer_t out;
+} serial_t;
+
+/**
+ * @brief Initiates a serial port
+ *
+ * @param serial serial port to initiate
+ * @param cpu cpu to use for the serial port
+ * @return error code
+ */
+int serial_init(serial_t* serial, cpu_t* cpu);
+
+/**
+ * @brief Runs one serial port cycle
+ *
+ * @param serial serial port to cycle
+ * @return error code
+ */
+int serial_cycle(serial_t* serial);
+
+/**
+ * @brief Serial port bus listening handler
+ *
+ * @param serial serial port
+ * @param addr trigger address
+ * @return error code
+ */
+int serial_bus_listener(serial_t* serial, addr_t addr);
+
+/**
+ * @brief Computes how many cycles the serial port can run before shifting
+ *        a bit (and so before raising an interrupt)
+ *
+ * @param serial serial port
+ * @return number of cycles (UINT64_MAX if no transfer is in progress)
+ */
+uint64_t serial_cycles_before_event(const serial_t* serial);
+
+/**
+ * @brief Runs several serial port cycles at once, as nb_cycles calls to
+ *        serial_cycle would do; these cycles must not shift any bit
+ *
+ * @param serial serial port
+ * @param nb_cycles number of cycles to run
+ * @return error code
+ */
+int serial_cycles(serial_t* serial, uint64_t nb_cycles);
+
+/**
+ * @brief Connects a transfer which just started on the internal clock of a
+ *        serial port to the other end of a link cable: the byte of the
+ *        other end is shifted in if it waits for a transfer on the
+ *        external clock, which is then clocked along (and gets the byte
+ *        sent); the bytes exchanged are pushed to the output buffers
+ *
+ * @param master serial port whose transfer just started
+ * @param other serial port at the other end, at the same cycle
+ * @return error code
+ */
+int serial_exchange(serial_t* master, serial_t* other);
+
+/**
+ * @brief Moves the bytes sent so far from an output buffer (the consumer
+ *        side: one thread at a time, concurrently with the emulation)
+ *
+ * @param buffer output buffer to drain
+ * @param bytes (output) bytes drained, in the order they were sent
+ * @param size maximum number of bytes to drain
+ * @return number of bytes drained
+ */
+size_t serial_drain(serial_buffer_t* buffer, data_t* bytes, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
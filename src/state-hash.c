@@ -0,0 +1,198 @@
+/**
+ * @file state-hash.c
+ * @brief 64-bit hash of the whole machine state, computed at every VBLANK
+ *
+ * @date 2020
+ */
+
+#include "state-hash.h"
+#include "gameboy.h"
+#include "error.h"
+
+#include <inttypes.h>
+#include <string.h>
+
+#define TRUE 1
+#define FALSE 0
+
+#define HASH_SEED 0x9E3779B97F4A7C15ULL
+#define HASH_MULTIPLIER 0xFF51AFD7ED558CCDULL
+#define HASH_ROTATION 27
+
+#define NB_REGISTER_WORDS 11
+
+#define FIRST_PAGE (VIDEO_RAM_START >> STATE_HASH_PAGE_SHIFT)
+#define ECHO_FIRST_PAGE (ECHO_RAM_START >> STATE_HASH_PAGE_SHIFT)
+#define ECHO_LAST_PAGE (ECHO_RAM_END >> STATE_HASH_PAGE_SHIFT)
+#define ECHO_OFFSET_PAGES ((ECHO_RAM_START - WORK_RAM_START) >> STATE_HASH_PAGE_SHIFT)
+#define OAM_PAGE (GRAPH_RAM_START >> STATE_HASH_PAGE_SHIFT)
+#define IO_PAGE (REGISTERS_START >> STATE_HASH_PAGE_SHIFT)
+
+// ---------------------------------------------------------------------
+/**
+ * @brief Final mix of MurmurHash3 (every bit of the input affects every
+ *        bit of the output)
+ */
+static uint64_t mix64(uint64_t x) {
+	x ^= x >> 33;
+	x *= HASH_MULTIPLIER;
+	x ^= x >> 33;
+	x *= 0xC4CEB9FE1A85EC53ULL;
+	x ^= x >> 33;
+	return x;
+}
+
+// ---------------------------------------------------------------------
+static uint64_t hash_add(uint64_t hash, uint64_t value) {
+	return mix64(hash ^ value) + HASH_SEED;
+}
+
+// ---------------------------------------------------------------------
+/**
+ * @brief Tells whether a page is part of the hashed memory
+ */
+static int page_hashed(size_t page) {
+	return page >= FIRST_PAGE && (page < ECHO_FIRST_PAGE || page > ECHO_LAST_PAGE);
+}
+
+// ---------------------------------------------------------------------
+/**
+ * @brief Hashes a page, read through the bus (a page may span several
+ *        components; unmapped bytes read as 0)
+ */
+static uint64_t page_hash(const bus_t bus, size_t page) {
+	uint8_t bytes[STATE_HASH_PAGE_SIZE];
+	const size_t start = page << STATE_HASH_PAGE_SHIFT;
+	for(size_t i = 0; i < STATE_HASH_PAGE_SIZE; ++i) {
+		bytes[i] = bus[start + i] != NULL ? *bus[start + i] : 0;
+	}
+	uint64_t hash = HASH_SEED ^ page;
+	for(size_t i = 0; i < STATE_HASH_PAGE_SIZE; i += sizeof(uint64_t)) {
+		uint64_t word = 0;
+		memcpy(&word, bytes + i, sizeof(word));
+		hash = (hash ^ word) * HASH_MULTIPLIER;
+		hash = hash << HASH_ROTATION | hash >> (64 - HASH_ROTATION);
+	}
+	return mix64(hash);
+}
+
+// ---------------------------------------------------------------------
+/**
+ * @brief Gathers the state outside of the memory
+ */
+static void registers_words(const gameboy_t* gameboy, uint64_t words[NB_REGISTER_WORDS]) {
+	const cpu_t* cpu = &gameboy->cpu;
+	size_t i = 0;
+	words[i++] = (uint64_t) cpu->AF << 48 | (uint64_t) cpu->BC << 32 | (uint64_t) cpu->DE << 16 | cpu->HL;
+	words[i++] = (uint64_t) cpu->PC << 48 | (uint64_t) cpu->SP << 32 | (uint64_t) cpu->IME << 24
+				 | (uint64_t) cpu->IE << 16 | (uint64_t) cpu->IF << 8 | cpu->HALT;
+	words[i++] = (uint64_t) cpu->idle_time << 32 | (uint64_t) gameboy->timer.counter << 16 | gameboy->boot;
+	words[i++] = (uint64_t) gameboy->serial.in << 16 | (uint64_t) gameboy->serial.bits << 8
+				 | gameboy->serial.clock;
+
+	const lcdc_t* lcd = &gameboy->screen;
+	words[i++] = lcd->on;
+	words[i++] = lcd->next_cycle;
+	words[i++] = lcd->on_cycle;
+	words[i++] = (uint64_t) lcd->DMA_from << 24 | (uint64_t) lcd->DMA_to << 8 | lcd->window_y;
+
+	const joypad_t* pad = &gameboy->pad;
+	words[i++] = (uint64_t) pad->intern << 24 | (uint64_t) pad->old_state << 16
+				 | (uint64_t) pad->keys_state[0] << 8 | pad->keys_state[1];
+
+	words[i++] = gameboy->cycles;
+	words[i++] = gameboy->frames;
+}
+
+// ---------------------------------------------------------------------
+/**
+ * @brief Hashes the state outside of the memory
+ */
+static uint64_t registers_hash(const gameboy_t* gameboy) {
+	uint64_t words[NB_REGISTER_WORDS];
+	registers_words(gameboy, words);
+	uint64_t hash = HASH_SEED;
+	for(size_t i = 0; i < NB_REGISTER_WORDS; ++i) {
+		hash = hash_add(hash, words[i]);
+	}
+	return hash;
+}
+
+// ======================================================================
+int state_hash_init(state_hash_t* hash, const char* filename) {
+	M_REQUIRE_NON_NULL(hash);
+	memset(hash, 0, sizeof(*hash));
+	memset(hash->dirty, TRUE, sizeof(hash->dirty));
+	if(filename != NULL) {
+		hash->file = fopen(filename, "w");
+		if(hash->file == NULL) {
+			return ERR_IO;
+		}
+		fprintf(hash->file, "%s\n", STATE_HASH_MAGIC);
+	}
+	return ERR_NONE;
+}
+
+// ======================================================================
+int state_hash_frame(state_hash_t* hash, const gameboy_t* gameboy) {
+	M_REQUIRE_NON_NULL(hash);
+	M_REQUIRE_NON_NULL(gameboy);
+
+	// writes to the echo RAM change the work RAM; the OAM DMA, the timer and
+	// the joypad write to their memory without going through the CPU
+	for(size_t page = ECHO_FIRST_PAGE; page <= ECHO_LAST_PAGE; ++page) {
+		hash->dirty[page - ECHO_OFFSET_PAGES] |= hash->dirty[page];
+	}
+	hash->dirty[OAM_PAGE] = TRUE;
+	hash->dirty[IO_PAGE] = TRUE;
+
+	for(size_t page = FIRST_PAGE; page < STATE_HASH_NB_PAGES; ++page) {
+		if(hash->dirty[page] && page_hashed(page)) {
+			const uint64_t new_hash = page_hash(gameboy->bus, page);
+			hash->memory += mix64(new_hash ^ page) - mix64(hash->pages[page] ^ page);
+			hash->pages[page] = new_hash;
+		}
+	}
+	memset(hash->dirty, FALSE, sizeof(hash->dirty));
+
+	hash->last = hash_add(registers_hash(gameboy), hash->memory);
+	if(hash->file != NULL
+	   && fprintf(hash->file, "%" PRIu64 " %" PRIu64 " %016" PRIX64 "\n",
+				  gameboy->frames, gameboy->cycles, hash->last) < 0) {
+		return ERR_IO;
+	}
+	return ERR_NONE;
+}
+
+// ======================================================================
+bit_t state_hash_same(const gameboy_t* a, const gameboy_t* b) {
+	uint64_t words_a[NB_REGISTER_WORDS];
+	uint64_t words_b[NB_REGISTER_WORDS];
+	registers_words(a, words_a);
+	registers_words(b, words_b);
+	if(memcmp(words_a, words_b, sizeof(words_a))) {
+		return FALSE;
+	}
+	for(size_t addr = FIRST_PAGE << STATE_HASH_PAGE_SHIFT; addr <= UINT16_MAX; ++addr) {
+		if(!page_hashed(addr >> STATE_HASH_PAGE_SHIFT)) {
+			continue;
+		}
+		const data_t byte_a = a->bus[addr] != NULL ? *a->bus[addr] : 0;
+		const data_t byte_b = b->bus[addr] != NULL ? *b->bus[addr] : 0;
+		if(byte_a != byte_b) {
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+// ======================================================================
+int state_hash_close(state_hash_t* hash) {
+	M_REQUIRE_NON_NULL(hash);
+	int err = ERR_NONE;
+	if(hash->file != NULL && fclose(hash->file) != 0) {
+		err = ERR_IO;
+	}
+	hash->file = NULL;
+	return err;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+/**
+ * @file state-hash.h
+ * @brief 64-bit hash of the whole machine state, computed at every VBLANK
+ *
+ * The hash covers the CPU registers, the writable memories (video, extern,
+ * work and graphic RAM, I/O registers, high RAM), the timer, the serial
+ * port, the LCD controller registers and the joypad, as well as the cycle
+ * and frame counters; the cartridge ROM, which never changes, and the echo
+ * RAM, which aliases the work RAM, are left out. Two runs are in the same
+ * state at a given frame if their hashes are equal (up to collisions).
+ *
+ * The memory is hashed per 256-byte page, the hash of the memory being the
+ * sum of mixes of the page hashes: the CPU flags the pages it writes to
+ * (see cpu_t.dirty), and only those are hashed again at the next frame,
+ * together with the graphic RAM page (written by the OAM DMA) and the I/O
+ * page (written by the timer, the serial port and the joypad), which do
+ * not go through the CPU.
+ *
+ * Hash files are text: the line STATE_HASH_MAGIC, then one line per frame
+ * "FRAME CYCLE HASH" (hash in hexadecimal). See gbhashcmp.c to compare
+ * them.
+ *
+ * @date 2020
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "bit.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct gameboy_ gameboy_t;
+
+#define STATE_HASH_MAGIC "GBHASH1"
+
+#define STATE_HASH_PAGE_SHIFT 8
+#define STATE_HASH_PAGE_SIZE (1 << STATE_HASH_PAGE_SHIFT)
+#define STATE_HASH_NB_PAGES (1 << (16 - STATE_HASH_PAGE_SHIFT))
+
+/**
+ * @brief Type to represent the state hash of a gameboy
+ */
+typedef struct {
+	uint8_t dirty[STATE_HASH_NB_PAGES];         // pages written since the last frame
+	uint64_t pages[STATE_HASH_NB_PAGES];        // hash of each page at the last frame
+	uint64_t memory;                            // hash of the memory at the last frame
+	uint64_t last;                              // hash of the state at the last frame
+	FILE* file;                                 // NULL for no hash file
+} state_hash_t;
+
+/**
+ * @brief Initializes a state hash (every page to be hashed at the first
+ *        frame)
+ *
+ * @param hash state hash to initialize
+ * @param filename file to write the hash of each frame to, NULL for none
+ * @return error code
+ */
+int state_hash_init(state_hash_t* hash, const char* filename);
+
+/**
+ * @brief Hashes the state of a gameboy (at its VBLANK), writing the hash to
+ *        the hash file if any, and clears the dirty pages
+ *
+ * @param hash state hash of the gameboy
+ * @param gameboy gameboy to hash
+ * @return error code
+ */
+int state_hash_frame(state_hash_t* hash, const gameboy_t* gameboy);
+
+/**
+ * @brief Tells whether two gameboys are in the same state, comparing
+ *        exactly what state_hash_frame() hashes (equal hashes may collide)
+ *
+ * @param a first gameboy (non NULL)
+ * @param b second gameboy (non NULL)
+ * @return TRUE if their states are equal
+ */
+bit_t state_hash_same(const gameboy_t* a, const gameboy_t* b);
+
+/**
+ * @brief Closes the hash file, if any
+ *
+ * @param hash state hash to close
+ * @return error code
+ */
+int state_hash_close(state_hash_t* hash);
+
+#ifdef __cplusplus
+}
+#endif
@@ -4,13 +4,31 @@
 #include "timer.h"
 #include "cpu.h"
 #include "error.h"
-#include "cpu-storage.h"
 #include "bit.h"
 #include "memory.h"
 
 #define INIT_VALUE 0
 #define mask 3
 #define TIMER_INC 4
+#define TIMA_OVERFLOW 256
+
+/*
+ * The timer accesses its registers directly on the bus: its own updates
+ * must not be dispatched back to it as CPU writes (see io.h).
+ */
+static data_t timer_reg_get(const gbtimer_t* timer, addr_t addr){
+	data_t value = 0;
+	bus_read(*timer->cpu->bus, addr, &value);
+	return value;
+}
+
+static void timer_reg_set(gbtimer_t* timer, addr_t addr, data_t value){
+	bus_write(*timer->cpu->bus, addr, value);
+}
+
+static void timer_reg16_set(gbtimer_t* timer, addr_t addr, addr_t value){
+	bus_write16(*timer->cpu->bus, addr, value);
+}
 
 int timer_init(gbtimer_t* timer, cpu_t* cpu){
 	M_REQUIRE_NON_NULL(timer);
@@ -28,7 +46,7 @@ int timer_cycle(gbtimer_t* timer){
 	bit_t state = timer_state(timer);
 	timer->counter += TIMER_INC;
 	
-	cpu_write_at_idx(timer->cpu, REG_DIV, msb8(timer->counter));
+	timer_reg_set(timer, REG_DIV, msb8(timer->counter));
 	timer_inc_if_state_change(timer, state);
 	
 	return ERR_NONE;
@@ -47,10 +65,12 @@ int timer_bus_listener(gbtimer_t* timer, addr_t addr){
 	return ERR_NONE;
 }
 
-bit_t timer_state(gbtimer_t* timer){
+/**
+ * @brief gives the counter bit selected by TAC
+ */
+static int timer_used_bit(uint8_t tac){
 	int used_bit;
 	
-	uint8_t tac = cpu_read_at_idx(timer->cpu, REG_TAC);
 	switch (tac & mask){ 
 		case 0 : used_bit = 9;
 		break;
@@ -58,24 +78,71 @@ bit_t timer_state(gbtimer_t* timer){
 		break;
 		case 2 : used_bit = 5;
 		break;
-		case 3 : used_bit = 7;
+		default : used_bit = 7;
 		break;
 	}
+	return used_bit;
+}
 
-	return bit_get(tac, 2) & ((timer->counter >> used_bit) & 1);
+bit_t timer_state(gbtimer_t* timer){
+	uint8_t tac = timer_reg_get(timer, REG_TAC);
+	return bit_get(tac, 2) & ((timer->counter >> timer_used_bit(tac)) & 1);
 }
 
 int timer_inc_if_state_change(gbtimer_t* timer, bit_t old_state){
 	M_REQUIRE_NON_NULL(timer);
 	if(old_state == 1 && timer_state(timer) == 0){
-		uint8_t tima = cpu_read_at_idx(timer->cpu, REG_TIMA);
+		uint8_t tima = timer_reg_get(timer, REG_TIMA);
 		if(tima == 0xFF){
-			uint8_t tma = cpu_read_at_idx(timer->cpu, REG_TMA);
-			cpu_write_at_idx(timer->cpu, REG_TIMA, tma);
+			uint8_t tma = timer_reg_get(timer, REG_TMA);
+			timer_reg_set(timer, REG_TIMA, tma);
 			cpu_request_interrupt(timer->cpu, TIMER);
 		} else {
-			cpu_write16_at_idx(timer->cpu, REG_TIMA, ++tima);
+			timer_reg16_set(timer, REG_TIMA, ++tima);
 		}
 	}
 	return ERR_NONE;
 }
+
+/*
+ * TIMA is incremented on each falling edge of the used bit, that is each time
+ * the counter crosses a multiple of 2^(used_bit + 1).
+ */
+uint64_t timer_cycles_before_interrupt(const gbtimer_t* timer){
+	uint8_t tac = timer_reg_get(timer, REG_TAC);
+	if(bit_get(tac, 2) == 0){
+		return UINT64_MAX;
+	}
+	const uint64_t period = (uint64_t) 1 << (timer_used_bit(tac) + 1);
+	const uint64_t edges = TIMA_OVERFLOW - timer_reg_get(timer, REG_TIMA);
+	const uint64_t overflow = (timer->counter / period + edges) * period;
+	
+	// the overflowing cycle itself must not be run
+	return (overflow - timer->counter + TIMER_INC - 1) / TIMER_INC - 1;
+}
+
+int timer_cycles(gbtimer_t* timer, uint64_t nb_cycles){
+	M_REQUIRE_NON_NULL(timer);
+	if(nb_cycles == 0){
+		return ERR_NONE;
+	}
+	M_REQUIRE(nb_cycles <= timer_cycles_before_interrupt(timer), ERR_BAD_PARAMETER,
+			  "%s", "cannot skip a timer interrupt");
+	
+	uint8_t tac = timer_reg_get(timer, REG_TAC);
+	const uint64_t counter = timer->counter + nb_cycles * TIMER_INC;
+	uint64_t edges = 0;
+	if(bit_get(tac, 2) != 0){
+		const uint64_t period = (uint64_t) 1 << (timer_used_bit(tac) + 1);
+		edges = counter / period - timer->counter / period;
+	}
+	
+	timer->counter = (uint16_t) counter;
+	timer_reg_set(timer, REG_DIV, msb8(timer->counter));
+	if(edges > 0){
+		// same store as the one of timer_inc_if_state_change()
+		uint8_t tima = timer_reg_get(timer, REG_TIMA);
+		timer_reg16_set(timer, REG_TIMA, (uint8_t) (tima + edges));
+	}
+	return ERR_NONE;
+}
@@ -83,6 +83,24 @@ bit_t timer_state(gbtimer_t* timer);
  */
 int timer_inc_if_state_change(gbtimer_t* timer, bit_t old_state);  
 
+/**
+ * @brief compute how many cycles the timer can run before raising an interrupt
+ * 
+ * @param timer timer
+ * @return number of cycles (UINT64_MAX if the timer is disabled)
+ */
+uint64_t timer_cycles_before_interrupt(const gbtimer_t* timer);
+
+/**
+ * @brief run several timer cycles at once, as nb_cycles calls to timer_cycle
+ *        would do ; these cycles must not raise any interrupt
+ * 
+ * @param timer timer
+ * @param nb_cycles number of cycles to run
+ * @return error code
+ */
+int timer_cycles(gbtimer_t* timer, uint64_t nb_cycles);
+
 #ifdef __cplusplus
 }
 #endif
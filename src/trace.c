@@ -0,0 +1,197 @@
+/**
+ * @file trace.c
+ * @brief Binary trace of the instructions executed by the CPU
+ *
+ * @date 2020
+ */
+
+#include "trace.h"
+#include "error.h"
+
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define INIT_VALUE 0
+#define TRUE 1
+#define FALSE 0
+
+#define WRITER_SLEEP_NS 1000000
+
+_Static_assert(sizeof(trace_record_t) == 32, "trace records are 32 bytes");
+
+// ---------------------------------------------------------------------
+static int trace_write_header(FILE* file) {
+	trace_header_t header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, TRACE_MAGIC, TRACE_MAGIC_SIZE);
+	header.record_size = sizeof(trace_record_t);
+	return fwrite(&header, sizeof(header), 1, file) == 1 ? ERR_NONE : ERR_IO;
+}
+
+// ---------------------------------------------------------------------
+/**
+ * @brief Writes the records from first (included) to last (excluded), which
+ *        are at most one ring apart
+ */
+static int trace_write_records(const trace_t* trace, FILE* file, uint64_t first, uint64_t last) {
+	while(first < last) {
+		const size_t index = first & trace->mask;
+		size_t count = trace->mask + 1 - index;	// contiguous up to the end of the ring
+		if(count > last - first) {
+			count = last - first;
+		}
+		if(fwrite(&trace->records[index], sizeof(trace_record_t), count, file) != count) {
+			return ERR_IO;
+		}
+		first += count;
+	}
+	return ERR_NONE;
+}
+
+// ---------------------------------------------------------------------
+/**
+ * @brief Writer thread: spills the committed records to the file until the
+ *        trace is closed (after an error, the records are only consumed, so
+ *        that the CPU never waits forever)
+ */
+static void* trace_writer(void* arg) {
+	trace_t* trace = arg;
+	const struct timespec pause = { 0, WRITER_SLEEP_NS };
+
+	for(;;) {
+		const int running = atomic_load(&trace->running);
+		const uint64_t head = atomic_load_explicit(&trace->head, memory_order_acquire);
+		const uint64_t tail = atomic_load_explicit(&trace->tail, memory_order_relaxed);
+		if(head == tail) {
+			if(!running) {
+				break;
+			}
+			nanosleep(&pause, NULL);
+			continue;
+		}
+		if(trace->error == ERR_NONE) {
+			trace->error = trace_write_records(trace, trace->file, tail, head);
+		}
+		atomic_store_explicit(&trace->tail, head, memory_order_release);
+	}
+	return NULL;
+}
+
+// ======================================================================
+int trace_open(trace_t* trace, size_t nb_records, const char* filename, const uint64_t* clock) {
+	M_REQUIRE_NON_NULL(trace);
+	M_REQUIRE_NON_NULL(clock);
+	M_REQUIRE(nb_records != 0, ERR_BAD_PARAMETER, "%s", "empty trace ring");
+
+	size_t size = 1;
+	while(size < nb_records) {
+		size <<= 1;
+	}
+
+	memset(trace, 0, sizeof(*trace));
+	trace->mask = size - 1;
+	trace->clock = clock;
+	atomic_init(&trace->head, INIT_VALUE);
+	atomic_init(&trace->tail, INIT_VALUE);
+	atomic_init(&trace->running, FALSE);
+	trace->records = calloc(size, sizeof(trace_record_t));
+	if(trace->records == NULL) {
+		return ERR_MEM;
+	}
+
+	if(filename != NULL) {
+		trace->file = fopen(filename, "wb");
+		if(trace->file == NULL || trace_write_header(trace->file) != ERR_NONE) {
+			if(trace->file != NULL) {
+				fclose(trace->file);
+			}
+			free(trace->records);
+			trace->records = NULL;
+			return ERR_IO;
+		}
+		atomic_store(&trace->running, TRUE);
+		if(pthread_create(&trace->writer, NULL, trace_writer, trace) != 0) {
+			fclose(trace->file);
+			free(trace->records);
+			trace->records = NULL;
+			return ERR_IO;
+		}
+	}
+	return ERR_NONE;
+}
+
+// ======================================================================
+int trace_close(trace_t* trace) {
+	M_REQUIRE_NON_NULL(trace);
+
+	int err = ERR_NONE;
+	if(trace->file != NULL) {
+		atomic_store(&trace->running, FALSE);
+		pthread_join(trace->writer, NULL);
+		err = trace->error;
+		if(fclose(trace->file) != 0 && err == ERR_NONE) {
+			err = ERR_IO;
+		}
+		trace->file = NULL;
+	}
+	free(trace->records);
+	trace->records = NULL;
+	trace->current = NULL;
+	return err;
+}
+
+// ======================================================================
+trace_record_t* trace_begin(trace_t* trace) {
+	const uint64_t head = atomic_load_explicit(&trace->head, memory_order_relaxed);
+	if(trace->file != NULL) {
+		while(head - atomic_load_explicit(&trace->tail, memory_order_acquire) > trace->mask) {
+			sched_yield();
+		}
+	}
+	trace->current = &trace->records[head & trace->mask];
+	trace->current->cycle = *trace->clock;
+	trace->current->flags = INIT_VALUE;
+	trace->current->write_addr = INIT_VALUE;
+	trace->current->write_value = INIT_VALUE;
+	return trace->current;
+}
+
+// ======================================================================
+void trace_commit(trace_t* trace) {
+	trace->current = NULL;
+	const uint64_t head = atomic_load_explicit(&trace->head, memory_order_relaxed);
+	atomic_store_explicit(&trace->head, head + 1, memory_order_release);
+}
+
+// ======================================================================
+void trace_write(trace_t* trace, addr_t addr, uint16_t value, int is16) {
+	if(trace->current != NULL) {
+		trace->current->write_addr = addr;
+		trace->current->write_value = value;
+		trace->current->flags |= is16 ? TRACE_WRITE16 : TRACE_WRITE;
+	}
+}
+
+// ======================================================================
+int trace_save(const trace_t* trace, const char* filename) {
+	M_REQUIRE_NON_NULL(trace);
+	M_REQUIRE_NON_NULL(filename);
+	M_REQUIRE_NON_NULL(trace->records);
+
+	FILE* file = fopen(filename, "wb");
+	if(file == NULL) {
+		return ERR_IO;
+	}
+	const uint64_t head = atomic_load(&trace->head);
+	const uint64_t first = head > trace->mask ? head - trace->mask - 1 : INIT_VALUE;
+	int err = trace_write_header(file);
+	if(err == ERR_NONE) {
+		err = trace_write_records(trace, file, first, head);
+	}
+	if(fclose(file) != 0 && err == ERR_NONE) {
+		err = ERR_IO;
+	}
+	return err;
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+/**
+ * @file trace.h
+ * @brief Binary trace of the instructions executed by the CPU
+ *
+ * Each instruction dispatched (and each interrupt) appends a fixed-size
+ * record to a ring buffer. Without file, the ring keeps the last records
+ * (see trace_save()); with a file, a writer thread spills the records to it
+ * and the CPU waits whenever the ring is full, so that nothing is lost.
+ * A dispatch which fails still appends its record, flagged TRACE_ERROR.
+ *
+ * Trace files start with a trace_header_t, followed by the records, in the
+ * byte order of the host. Cycles skipped by the gameboy (HALT, idle loops)
+ * show as gaps in the cycle numbers. See gbtrace.c to print them.
+ *
+ * @date 2020
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "memory.h"     // addr_t, data_t
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TRACE_MAGIC "GBTRACE1"
+#define TRACE_MAGIC_SIZE 8
+
+#define TRACE_DEFAULT_RECORDS (1 << 16)
+
+// trace_record_t flags
+#define TRACE_PREFIXED  0x01    // 0xCB instruction, see prefixed_opcode
+#define TRACE_INTERRUPT 0x02    // interrupt dispatch, pc is the vector
+#define TRACE_WRITE     0x04    // the instruction wrote one byte, see write_*
+#define TRACE_WRITE16   0x08    // the instruction wrote two bytes (from write_addr)
+#define TRACE_ERROR     0x10    // the dispatch failed (the last record of the trace)
+
+/**
+ * @brief One executed instruction, with the registers before its execution
+ */
+typedef struct {
+	uint64_t cycle;
+	uint16_t pc;
+	uint16_t AF;
+	uint16_t BC;
+	uint16_t DE;
+	uint16_t HL;
+	uint16_t SP;
+	uint16_t write_addr;
+	uint16_t write_value;   // low byte only when one byte is written
+	uint8_t opcode;
+	uint8_t prefixed_opcode;
+	uint8_t flags;
+	uint8_t IME;
+	uint8_t IE;
+	uint8_t IF;
+	uint8_t reserved[2];
+} trace_record_t;
+
+/**
+ * @brief Header of the trace files
+ */
+typedef struct {
+	char magic[TRACE_MAGIC_SIZE];
+	uint32_t record_size;
+	uint32_t reserved;
+} trace_header_t;
+
+/**
+ * @brief Type to represent a trace
+ */
+typedef struct {
+	trace_record_t* records;
+	size_t mask;                // number of records - 1
+	_Atomic uint64_t head;      // records produced since trace_open()
+	_Atomic uint64_t tail;      // records written to the file
+	trace_record_t* current;    // record of the instruction being executed
+	const uint64_t* clock;      // cycle counter of the traced gameboy
+
+	FILE* file;
+	pthread_t writer;
+	atomic_int running;
+	int error;                  // first error of the writer
+} trace_t;
+
+/**
+ * @brief Starts a trace
+ *
+ * @param trace trace to initialize
+ * @param nb_records size of the ring (rounded up to a power of 2)
+ * @param filename file to spill the records to, NULL to only keep the
+ *        last ones in memory
+ * @param clock cycle counter to read for each record
+ * @return error code
+ */
+int trace_open(trace_t* trace, size_t nb_records, const char* filename, const uint64_t* clock);
+
+/**
+ * @brief Stops a trace: writes the remaining records and closes its file
+ *
+ * @param trace trace to stop
+ * @return error code (ERR_IO if some record could not be written)
+ */
+int trace_close(trace_t* trace);
+
+/**
+ * @brief Gives the record to fill for the next instruction (waiting for
+ *        the writer if the ring is full)
+ *
+ * @param trace trace to append to
+ * @return the record to fill, to commit with trace_commit()
+ */
+trace_record_t* trace_begin(trace_t* trace);
+
+/**
+ * @brief Appends the record given by trace_begin()
+ *
+ * @param trace trace to append to
+ */
+void trace_commit(trace_t* trace);
+
+/**
+ * @brief Notes a write of the current instruction (ignored outside of
+ *        trace_begin() and trace_commit(), e.g. LCD controller writes)
+ *
+ * @param trace trace of the CPU
+ * @param addr address written
+ * @param value value written
+ * @param is16 whether two bytes are written
+ */
+void trace_write(trace_t* trace, addr_t addr, uint16_t value, int is16);
+
+/**
+ * @brief Writes the records still in the ring, oldest first, to a trace
+ *        file (for traces without file)
+ *
+ * @param trace trace to save
+ * @param filename file to write
+ * @return error code
+ */
+int trace_save(const trace_t* trace, const char* filename);
+
+#ifdef __cplusplus
+}
+#endif
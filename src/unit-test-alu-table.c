@@ -0,0 +1,67 @@
+/**
+ * @file unit-test-alu-table.c
+ * @brief Checks the table-driven ALU (alu-table.h) exhaustively against
+ *        alu.c (compiled without -DALU_TABLES)
+ *
+ * @date 2020
+ */
+
+#include "alu.h"
+#include "alu-table.h"
+#include "error.h"
+
+#include <stdio.h>
+
+// flags of the result before the operation: alu.c or-es into them
+static const flags_t initial_flags[] = { 0, FLAG_Z | FLAG_N | FLAG_H | FLAG_C, 0x0F };
+#define NB_INITIAL_FLAGS (sizeof(initial_flags) / sizeof(initial_flags[0]))
+
+static unsigned long nb_checks = 0;
+static unsigned long nb_failures = 0;
+
+// ======================================================================
+#define check(name, reference, table, ...) \
+	do { \
+		for(size_t f = 0; f < NB_INITIAL_FLAGS; ++f) { \
+			alu_output_t expected = { 0, initial_flags[f] }; \
+			alu_output_t actual = { 0, initial_flags[f] }; \
+			const int expected_err = reference(&expected, __VA_ARGS__); \
+			const int actual_err = table(&actual, __VA_ARGS__); \
+			++nb_checks; \
+			if(expected_err != actual_err || expected.value != actual.value \
+			   || expected.flags != actual.flags) { \
+				if(nb_failures++ < 10) { \
+					fprintf(stderr, "%s(%s): %04X %02X (%d) instead of %04X %02X (%d)\n", name, \
+							#__VA_ARGS__, actual.value, actual.flags, actual_err, \
+							expected.value, expected.flags, expected_err); \
+				} \
+			} \
+		} \
+	} while(0)
+
+// ======================================================================
+int main(void)
+{
+	for(unsigned c = 0; c < 2; ++c) {
+		for(unsigned x = 0; x < 256; ++x) {
+			for(unsigned y = 0; y < 256; ++y) {
+				check("alu_add8", alu_add8, alu_table_add8, (uint8_t) x, (uint8_t) y, (bit_t) c);
+				check("alu_sub8", alu_sub8, alu_table_sub8, (uint8_t) x, (uint8_t) y, (bit_t) c);
+			}
+		}
+	}
+	for(unsigned x = 0; x < 256; ++x) {
+		check("alu_shiftR_A", alu_shiftR_A, alu_table_shiftR_A, (uint8_t) x);
+		for(rot_dir_t dir = LEFT; dir <= RIGHT; ++dir) {
+			check("alu_shift", alu_shift, alu_table_shift, (uint8_t) x, dir);
+			check("alu_rotate", alu_rotate, alu_table_rotate, (uint8_t) x, dir);
+			for(size_t f = 0; f < NB_INITIAL_FLAGS; ++f) {
+				check("alu_carry_rotate", alu_carry_rotate, alu_table_carry_rotate,
+					  (uint8_t) x, dir, initial_flags[f]);
+			}
+		}
+	}
+
+	printf("unit-test-alu-table: %lu checks, %lu failures\n", nb_checks, nb_failures);
+	return nb_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,175 @@
+/**
+ * @file unit-test-gb-pool.c
+ * @brief Checks the pool of gameboys (gb-pool.h): threads check gameboys
+ *        out, attach things to them, run them and return them; every
+ *        gameboy returned is then in the state of a gameboy just reset,
+ *        with nothing attached
+ *
+ * @date 2020
+ */
+
+#include "gb-pool.h"
+#include "harness.h"
+#include "cpu-fusion.h"
+#include "state-hash.h"
+#include "watch.h"
+#include "error.h"
+
+#include <pthread.h>
+#include <stdio.h>
+
+// a ROM which prints on its serial port
+#define ROM "../provided/tests/data/blargg_roms/01-special.gb"
+#define NB_GAMEBOYS 3
+#define NB_THREADS 4
+#define NB_ROUNDS 3
+#define RUN_CYCLES 200000
+
+/**
+ * @brief Pool a thread runs its rounds on, and what they did
+ */
+typedef struct {
+	gb_pool_t* pool;
+	int err;
+	unsigned long nb_writes;    // seen by the watchpoints
+	unsigned long nb_silent;    // rounds without serial output
+} thread_data_t;
+
+static unsigned long nb_checks = 0;
+static unsigned long nb_failures = 0;
+
+// ======================================================================
+#define check(cond, ...) \
+	do { \
+		++nb_checks; \
+		if(!(cond)) { \
+			if(nb_failures++ < 10) { \
+				fprintf(stderr, "%s: ", #cond); \
+				fprintf(stderr, __VA_ARGS__); \
+				fprintf(stderr, "\n"); \
+			} \
+		} \
+	} while(0)
+
+// ======================================================================
+static watch_action_t count_write(void* data, const cpu_t* cpu, watch_kind_t kind,
+								  addr_t addr, data_t value)
+{
+	(void) cpu;
+	(void) kind;
+	(void) addr;
+	(void) value;
+	++*(unsigned long*) data;
+	return WATCH_CONTINUE;
+}
+
+// ======================================================================
+/**
+ * @brief Checks gameboys out of the pool, attaches a trace, a state hash,
+ *        a watchpoint, fusion counters and a coverage bitmap to them, runs
+ *        them with other fast paths and returns them
+ */
+static void* run_rounds(void* arg)
+{
+	thread_data_t* thread = arg;
+	gb_pool_t* pool = thread->pool;
+	int err = ERR_NONE;
+	for(int round = 0; round < NB_ROUNDS && err == ERR_NONE; ++round) {
+		gameboy_t* gameboy = NULL;
+		err = gb_pool_acquire(pool, &gameboy);
+		if(err != ERR_NONE) {
+			break;
+		}
+		err = gameboy_trace_start(gameboy, NULL, 64);
+		if(err == ERR_NONE) {
+			err = gameboy_hash_start(gameboy, NULL);
+		}
+		if(err == ERR_NONE) {
+			err = watch_add(&gameboy->watch, 0xC000, 0xDFFF, WATCH_WRITE, count_write, &thread->nb_writes, NULL);
+		}
+		uint64_t fusion_counts[CPU_NB_FUSIONS] = { 0 };
+		gameboy->cpu.fusion_counts = fusion_counts;
+		uint8_t coverage[CPU_COVERAGE_SIZE] = { 0 };
+		gameboy->cpu.coverage = coverage;
+		gameboy->fast_paths = round % 2 == 0 ? 0 : GB_FAST_ALL | GB_FAST_FUSION;
+		if(err == ERR_NONE) {
+			err = gameboy_key(gameboy, round % 2 == 0 ? START_KEY : A_KEY, 1);
+		}
+		if(err == ERR_NONE) {
+			err = gameboy_run_until(gameboy, gameboy->cycles + RUN_CYCLES);
+			thread->nb_silent += atomic_load(&gameboy->serial.out.head) == 0;
+		}
+		const int release_err = gb_pool_release(pool, gameboy);
+		if(err == ERR_NONE) {
+			err = release_err;
+		}
+	}
+	thread->err = err;
+	return NULL;
+}
+
+// ======================================================================
+int main(void)
+{
+	// what the ROMs print is dropped
+	FILE* report = harness_report();
+	if(report == NULL) {
+		fputs("unit-test-gb-pool: cannot redirect stdout\n", stderr);
+		return 1;
+	}
+	gameboy_t reference;
+	int err = gameboy_create(&reference, ROM);
+	if(err == ERR_NONE) {
+		err = gameboy_reset(&reference, GB_RESET_POST_BOOT);
+	}
+	if(err != ERR_NONE) {
+		fprintf(stderr, "unit-test-gb-pool: %s: %s\n", ROM, ERR_MESSAGES[err - ERR_NONE]);
+		return 1;
+	}
+	gb_pool_t pool;
+	err = gb_pool_create(&pool, ROM, NB_GAMEBOYS, GB_RESET_POST_BOOT);
+	if(err != ERR_NONE) {
+		fprintf(stderr, "unit-test-gb-pool: %s: %s\n", ROM, ERR_MESSAGES[err - ERR_NONE]);
+		gameboy_free(&reference);
+		return 1;
+	}
+
+	// more threads than gameboys, so that some wait for one to be returned
+	thread_data_t threads_data[NB_THREADS];
+	pthread_t threads[NB_THREADS];
+	for(int i = 0; i < NB_THREADS; ++i) {
+		threads_data[i] = (thread_data_t) { &pool, ERR_NONE, 0, 0 };
+		check(pthread_create(&threads[i], NULL, run_rounds, &threads_data[i]) == 0, "thread %d", i);
+	}
+	for(int i = 0; i < NB_THREADS; ++i) {
+		pthread_join(threads[i], NULL);
+		check(threads_data[i].err == ERR_NONE, "thread %d: %s", i,
+			  ERR_MESSAGES[threads_data[i].err - ERR_NONE]);
+		// (or the checks of the state after the release would be vacuous)
+		check(threads_data[i].nb_writes > 0 && threads_data[i].nb_silent == 0, "thread %d", i);
+	}
+
+	check(pool.nb_available == NB_GAMEBOYS, "%zu gameboys returned", pool.nb_available);
+	for(size_t i = 0; i < pool.nb_gameboys; ++i) {
+		const gameboy_t* gameboy = &pool.gameboys[i];
+		check(state_hash_same(gameboy, &reference), "gameboy %zu", i);
+		check(gameboy->cycles == reference.cycles, "gameboy %zu: cycle %llu", i,
+			  (unsigned long long) gameboy->cycles);
+		check(gameboy->cpu.trace == NULL && gameboy->cpu.fusion_counts == NULL
+			  && gameboy->cpu.coverage == NULL, "gameboy %zu", i);
+		check(gameboy->hash == NULL && gameboy->cpu.dirty == NULL, "gameboy %zu", i);
+		check(gameboy->recorder == NULL && gameboy->movie == NULL, "gameboy %zu", i);
+		for(size_t w = 0; w < WATCH_MAX; ++w) {
+			check(gameboy->watch.points[w].kinds == 0, "gameboy %zu: watchpoint %zu", i, w);
+		}
+		check(atomic_load(&gameboy->serial.out.head) == 0 && atomic_load(&gameboy->serial.out.tail) == 0
+			  && atomic_load(&gameboy->serial.out.lost) == 0, "gameboy %zu: serial output", i);
+		check(gameboy->fast_paths == GB_FAST_ALL, "gameboy %zu: fast paths %02X", i, gameboy->fast_paths);
+	}
+
+	gb_pool_free(&pool);
+	gameboy_free(&reference);
+	fprintf(report, "unit-test-gb-pool: %lu checks, %lu failures\n", nb_checks, nb_failures);
+	fclose(report);
+	return nb_failures == 0 ? 0 : 1;
+}
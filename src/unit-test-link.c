@@ -0,0 +1,171 @@
+/**
+ * @file unit-test-link.c
+ * @brief Checks the link cable (link.h) on a transfer between a gameboy on
+ *        the internal clock and one on the external clock: the bytes
+ *        received at both ends, the states reached whatever the quantum,
+ *        and the rollback of the gameboy which went beyond the transfer
+ *
+ * @date 2020
+ */
+
+#include "link.h"
+#include "state-hash.h"
+#include "error.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define ROM_SIZE 0x8000
+#define ENTRY 0x0100
+#define CODE 0x0150
+#define RECEIVED 0xC000         // where each ROM stores the byte it received
+#define MASTER_BYTE 0x42
+#define PEER_BYTE 0x99
+#define RUN_CYCLES 100000
+#define SMALL_QUANTUM 1000
+
+// waits (256 iterations), so that the peer waits for the transfer first,
+// then sends MASTER_BYTE on the internal clock (SC = 0x81)
+static const uint8_t master_code[] = {
+	0x06, 0x00, 0x05, 0x20, 0xFD,   // LD B,0 ; DEC B ; JR NZ,-3
+	0x3E, MASTER_BYTE, 0xE0, 0x01,  // LD A,MASTER_BYTE ; LDH (SB),A
+	0x3E, 0x81, 0xE0, 0x02,         // LD A,0x81 ; LDH (SC),A
+	0xF0, 0x02, 0xCB, 0x7F, 0x20, 0xFA, // LDH A,(SC) ; BIT 7,A ; JR NZ,-6
+	0xF0, 0x01, 0xEA, 0x00, 0xC0,   // LDH A,(SB) ; LD (RECEIVED),A
+	0x18, 0xFE                      // JR -2
+};
+
+// sends PEER_BYTE on the external clock (SC = 0x80)
+static const uint8_t peer_code[] = {
+	0x3E, PEER_BYTE, 0xE0, 0x01,    // LD A,PEER_BYTE ; LDH (SB),A
+	0x3E, 0x80, 0xE0, 0x02,         // LD A,0x80 ; LDH (SC),A
+	0xF0, 0x02, 0xCB, 0x7F, 0x20, 0xFA, // LDH A,(SC) ; BIT 7,A ; JR NZ,-6
+	0xF0, 0x01, 0xEA, 0x00, 0xC0,   // LDH A,(SB) ; LD (RECEIVED),A
+	0x18, 0xFE                      // JR -2
+};
+
+static unsigned long nb_checks = 0;
+static unsigned long nb_failures = 0;
+
+// ======================================================================
+#define check(cond, ...) \
+	do { \
+		++nb_checks; \
+		if(!(cond)) { \
+			if(nb_failures++ < 10) { \
+				fprintf(stderr, "%s: ", #cond); \
+				fprintf(stderr, __VA_ARGS__); \
+				fprintf(stderr, "\n"); \
+			} \
+		} \
+	} while(0)
+
+// ======================================================================
+/**
+ * @brief Writes a 32 KB ROM (no MBC) which jumps to the given code
+ *
+ * @param path (input/output) template of mkstemp(), then the file written
+ * @param code code of the ROM
+ * @param size size of the code
+ * @return error code
+ */
+static int write_rom(char* path, const uint8_t* code, size_t size)
+{
+	uint8_t* rom = calloc(ROM_SIZE, 1);
+	if(rom == NULL) {
+		return ERR_MEM;
+	}
+	const uint8_t jump[] = { 0x00, 0xC3, CODE & 0xFF, CODE >> 8 };   // NOP ; JP CODE
+	memcpy(rom + ENTRY, jump, sizeof(jump));
+	memcpy(rom + CODE, code, size);
+
+	const int fd = mkstemp(path);
+	FILE* file = fd < 0 ? NULL : fdopen(fd, "wb");
+	int err = file == NULL ? ERR_IO : ERR_NONE;
+	if(err == ERR_NONE && fwrite(rom, 1, ROM_SIZE, file) != ROM_SIZE) {
+		err = ERR_IO;
+	}
+	if(file != NULL) {
+		fclose(file);
+	} else if(fd >= 0) {
+		close(fd);
+	}
+	free(rom);
+	return err;
+}
+
+// ======================================================================
+/**
+ * @brief Runs the two ROMs, linked from their post-boot state, for
+ *        RUN_CYCLES with the given quantum
+ */
+static int run_linked(gameboy_t gameboys[LINK_NB_GAMEBOYS], const char* master, const char* peer,
+					  uint64_t quantum, link_t* link)
+{
+	M_EXIT_IF_ERR(gameboy_create(&gameboys[0], master));
+	M_EXIT_IF_ERR(gameboy_create(&gameboys[1], peer));
+	for(int i = 0; i < LINK_NB_GAMEBOYS; ++i) {
+		// (what is sent is not echoed on stdout with -DBLARGG)
+		gameboys[i].serial_echo = NULL;
+		M_EXIT_IF_ERR(gameboy_reset(&gameboys[i], GB_RESET_POST_BOOT));
+	}
+	M_EXIT_IF_ERR(link_connect(link, &gameboys[0], &gameboys[1], quantum));
+	const int err = link_run_until(link, gameboys[0].cycles + RUN_CYCLES);
+	link_disconnect(link);
+	return err;
+}
+
+// ======================================================================
+static data_t received(const gameboy_t* gameboy)
+{
+	data_t byte = 0;
+	bus_read(gameboy->bus, RECEIVED, &byte);
+	return byte;
+}
+
+// ======================================================================
+int main(void)
+{
+	char master[] = "/tmp/unit-test-link-master-XXXXXX";
+	char peer[] = "/tmp/unit-test-link-peer-XXXXXX";
+	int err = write_rom(master, master_code, sizeof(master_code));
+	if(err == ERR_NONE) {
+		err = write_rom(peer, peer_code, sizeof(peer_code));
+	}
+
+	// the peer, waiting for the transfer, runs beyond its start up to the
+	// end of the quantum and is rolled back: farther with the default one
+	const uint64_t quanta[] = { LINK_DEFAULT_QUANTUM, SMALL_QUANTUM };
+	gameboy_t gameboys[2][LINK_NB_GAMEBOYS];
+	memset(gameboys, 0, sizeof(gameboys));
+	link_t links[2];
+	for(size_t q = 0; q < 2 && err == ERR_NONE; ++q) {
+		err = run_linked(gameboys[q], master, peer, quanta[q], &links[q]);
+	}
+	if(err != ERR_NONE) {
+		fprintf(stderr, "unit-test-link: %s\n", ERR_MESSAGES[err - ERR_NONE]);
+	} else {
+		for(size_t q = 0; q < 2; ++q) {
+			check(received(&gameboys[q][0]) == PEER_BYTE, "quantum %llu: master received %02X",
+				  (unsigned long long) quanta[q], received(&gameboys[q][0]));
+			check(received(&gameboys[q][1]) == MASTER_BYTE, "quantum %llu: peer received %02X",
+				  (unsigned long long) quanta[q], received(&gameboys[q][1]));
+		}
+		check(links[0].nb_rollbacks > 0, "%s", "no rollback");
+		for(int i = 0; i < LINK_NB_GAMEBOYS; ++i) {
+			check(state_hash_same(&gameboys[0][i], &gameboys[1][i]), "gameboy %d: the quanta differ", i);
+		}
+	}
+
+	for(size_t q = 0; q < 2; ++q) {
+		for(int i = 0; i < LINK_NB_GAMEBOYS; ++i) {
+			gameboy_free(&gameboys[q][i]);
+		}
+	}
+	unlink(master);
+	unlink(peer);
+	printf("unit-test-link: %lu checks, %lu failures\n", nb_checks, nb_failures);
+	return err == ERR_NONE && nb_failures == 0 ? 0 : 1;
+}
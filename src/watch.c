@@ -0,0 +1,89 @@
+/**
+ * @file watch.c
+ * @brief Read, write and execute watchpoints on address ranges
+ *
+ * @date 2020
+ */
+
+#include "watch.h"
+#include "error.h"
+
+#include <string.h>
+
+#define TRUE 1
+#define FALSE 0
+
+// ---------------------------------------------------------------------
+/**
+ * @brief Recomputes the flags of the pages from the watchpoints
+ */
+static void watch_flag_pages(watch_table_t* table) {
+	memset(table->pages, 0, sizeof(table->pages));
+	table->kinds = 0;
+	for(int i = 0; i < WATCH_MAX; ++i) {
+		const watchpoint_t* point = &table->points[i];
+		if(point->kinds != 0) {
+			for(size_t page = point->start >> WATCH_PAGE_SHIFT;
+				page <= (size_t) (point->end >> WATCH_PAGE_SHIFT); ++page) {
+				table->pages[page] |= point->kinds;
+			}
+			table->kinds |= point->kinds;
+		}
+	}
+}
+
+// ======================================================================
+int watch_init(watch_table_t* table) {
+	M_REQUIRE_NON_NULL(table);
+	memset(table, 0, sizeof(*table));
+	table->stop = FALSE;
+	return ERR_NONE;
+}
+
+// ======================================================================
+int watch_add(watch_table_t* table, addr_t start, addr_t end, uint8_t kinds,
+			  watch_callback_t callback, void* data, int* id) {
+	M_REQUIRE_NON_NULL(table);
+	M_REQUIRE_NON_NULL(callback);
+	M_REQUIRE(start <= end, ERR_BAD_PARAMETER, "range %04X-%04X", start, end);
+	M_REQUIRE(kinds != 0 && (kinds & ~(WATCH_READ | WATCH_WRITE | WATCH_EXEC)) == 0,
+			  ERR_BAD_PARAMETER, "kinds %02X", kinds);
+
+	for(int i = 0; i < WATCH_MAX; ++i) {
+		watchpoint_t* point = &table->points[i];
+		if(point->kinds == 0) {
+			point->start = start;
+			point->end = end;
+			point->kinds = kinds;
+			point->callback = callback;
+			point->data = data;
+			watch_flag_pages(table);
+			if(id != NULL) {
+				*id = i;
+			}
+			return ERR_NONE;
+		}
+	}
+	return ERR_MEM;
+}
+
+// ======================================================================
+int watch_remove(watch_table_t* table, int id) {
+	M_REQUIRE_NON_NULL(table);
+	M_REQUIRE(id >= 0 && id < WATCH_MAX && table->points[id].kinds != 0,
+			  ERR_BAD_PARAMETER, "no watchpoint %d", id);
+	memset(&table->points[id], 0, sizeof(watchpoint_t));
+	watch_flag_pages(table);
+	return ERR_NONE;
+}
+
+// ======================================================================
+void watch_hit(watch_table_t* table, const cpu_t* cpu, watch_kind_t kind, addr_t addr, data_t value) {
+	for(int i = 0; i < WATCH_MAX; ++i) {
+		const watchpoint_t* point = &table->points[i];
+		if((point->kinds & kind) && addr >= point->start && addr <= point->end
+		   && point->callback(point->data, cpu, kind, addr, value) == WATCH_BREAK) {
+			table->stop = TRUE;
+		}
+	}
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+/**
+ * @file watch.h
+ * @brief Read, write and execute watchpoints on address ranges
+ *
+ * Each 256-byte page of the address space has flags telling which kinds of
+ * accesses are watched somewhere in it: the CPU only looks the watchpoints
+ * up (watch_hit()) for an access to a flagged page, so unwatched addresses
+ * cost one flag test.
+ *
+ * Accesses are the ones made through the CPU bus interface (cpu-storage.h):
+ * reads include the bytes of the instructions fetched, and the LCD
+ * controller registers it updates are seen as writes.
+ *
+ * @date 2020
+ */
+
+#include "cpu.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define WATCH_PAGE_SHIFT 8
+#define WATCH_NB_PAGES (1 << (16 - WATCH_PAGE_SHIFT))
+#define WATCH_MAX 32
+
+/**
+ * @brief Kinds of accesses (to be or-ed)
+ */
+typedef enum {
+	WATCH_READ = 0x1,
+	WATCH_WRITE = 0x2,
+	WATCH_EXEC = 0x4
+} watch_kind_t;
+
+/**
+ * @brief What the emulation does after a hit
+ */
+typedef enum {
+	WATCH_CONTINUE,
+	WATCH_BREAK     // stop gameboy_run_until()/gameboy_run_frame() at the end of the cycle
+} watch_action_t;
+
+/**
+ * @brief Watchpoint callback, called with the CPU during the access (its PC
+ *        is still the one of the instruction accessing), the kind of access,
+ *        the address and the value read, written or executed (opcode)
+ */
+typedef watch_action_t (*watch_callback_t)(void* data, const cpu_t* cpu,
+		watch_kind_t kind, addr_t addr, data_t value);
+
+/**
+ * @brief One watchpoint on [start, end]
+ */
+typedef struct {
+	addr_t start;
+	addr_t end;
+	uint8_t kinds;      // 0 for a free slot
+	watch_callback_t callback;
+	void* data;
+} watchpoint_t;
+
+/**
+ * @brief Type to represent the watchpoints of a CPU
+ */
+struct watch_table_ {
+	uint8_t pages[WATCH_NB_PAGES];  // kinds watched in each page
+	uint8_t kinds;                  // kinds watched anywhere
+	watchpoint_t points[WATCH_MAX];
+	bit_t stop;                     // some callback asked to break
+};
+typedef struct watch_table_ watch_table_t;
+
+/**
+ * @brief Tells whether some access of the given kind to the given address
+ *        has to be looked up
+ */
+#define watch_flagged(table, addr, kind) \
+	((table) != NULL && ((table)->pages[(addr) >> WATCH_PAGE_SHIFT] & (kind)))
+
+/**
+ * @brief Initializes an empty watchpoint table
+ *
+ * @param table table to initialize
+ * @return error code
+ */
+int watch_init(watch_table_t* table);
+
+/**
+ * @brief Adds a watchpoint
+ *
+ * @param table table to add to
+ * @param start first address watched
+ * @param end last address watched (included)
+ * @param kinds kinds of accesses watched (or of watch_kind_t)
+ * @param callback called for each access watched
+ * @param data given to the callback
+ * @param id (output) identifier of the watchpoint (may be NULL)
+ * @return error code (ERR_MEM when WATCH_MAX watchpoints are set)
+ */
+int watch_add(watch_table_t* table, addr_t start, addr_t end, uint8_t kinds,
+			  watch_callback_t callback, void* data, int* id);
+
+/**
+ * @brief Removes a watchpoint
+ *
+ * @param table table to remove from
+ * @param id identifier given by watch_add()
+ * @return error code
+ */
+int watch_remove(watch_table_t* table, int id);
+
+/**
+ * @brief Calls the callbacks of the watchpoints matching an access (slow
+ *        path, see watch_flagged())
+ *
+ * @param table table of the CPU
+ * @param cpu CPU accessing
+ * @param kind kind of access
+ * @param addr address accessed
+ * @param value value read, written or executed
+ */
+void watch_hit(watch_table_t* table, const cpu_t* cpu, watch_kind_t kind, addr_t addr, data_t value);
+
+#ifdef __cplusplus
+}
+#endif